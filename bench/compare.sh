@@ -0,0 +1,15 @@
+#!/bin/sh
+# usage: bench/compare.sh <zinc-a> <zinc-b> <program.zinc>
+# Builds the program with each compiler in a scratch directory and times the
+# resulting executable with stdout sent to /dev/null.
+set -e
+prog=$(realpath "$3")
+for zc in "$1" "$2"; do
+    zc=$(realpath "$zc")
+    dir=$(mktemp -d)
+    cp "$prog" "$dir/prog.zinc"
+    (cd "$dir" && "$zc" prog.zinc > /dev/null)
+    echo "$zc:"
+    (cd "$dir" && time ./test > /dev/null)
+    rm -rf "$dir"
+done
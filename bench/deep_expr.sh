@@ -0,0 +1,41 @@
+#!/bin/sh
+# usage: bench/deep_expr.sh <zinc> [terms] [stack-kb]
+# Compile time of one machine-generated expression of `terms` operands, as a
+# left-deep chain (x + x - x ...) and as a right-nested one (x - (x - ...)),
+# at a quarter, half and all of `terms` (default 1000000). The compiler runs
+# with its native stack limited to `stack-kb` (default 1024), so any walker
+# that recursed once per operator would crash; the times should grow
+# linearly with the number of terms. --run also covers the VM's compiler.
+set -e
+zc=$(realpath "$1")
+terms=${2:-1000000}
+stack=${3:-1024}
+dir=$(mktemp -d)
+cd "$dir"
+for shape in left right; do
+    for n in $((terms / 4)) $((terms / 2)) $terms; do
+        awk -v n="$n" -v shape="$shape" 'BEGIN {
+            printf "fn main() {\n    let x = scan();\n    print("
+            if (shape == "left") {
+                printf "x"
+                for (i = 1; i < n; i++)
+                    printf (i % 2 ? " + x" : " - x")
+            } else {
+                for (i = 1; i < n; i++)
+                    printf "x - ("
+                printf "x"
+                for (i = 1; i < n; i++)
+                    printf ")"
+            }
+            printf ", \"\\n\");\n}\n"
+        }' > prog.zinc
+        for mode in "--emit=asm" "--backend=direct --emit=obj" "--run"; do
+            start=$(date +%s%N)
+            (ulimit -s "$stack" && "$zc" $mode prog.zinc < /dev/null > /dev/null)
+            end=$(date +%s%N)
+            echo "$shape $n terms, $mode: $(( (end - start) / 1000000 )) ms"
+        done
+    done
+done
+cd /
+rm -rf "$dir"
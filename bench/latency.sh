@@ -0,0 +1,26 @@
+#!/bin/sh
+# usage: bench/latency.sh <zinc> <program.zinc> [runs]
+# End-to-end latency (compile + run, output discarded) of each pipeline,
+# averaged over `runs` iterations in a scratch directory.
+set -e
+zc=$(realpath "$1")
+prog=$(realpath "$2")
+runs=${3:-200}
+dir=$(mktemp -d)
+cd "$dir"
+for mode in "" "--backend=direct" "--jit" "--run" "--tiered"; do
+    if [ -z "$mode" ] && ! command -v nasm > /dev/null; then
+        echo "nasm+ld: skipped (nasm not installed)"
+        continue
+    fi
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        "$zc" $mode "$prog" < /dev/null > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "${mode:-nasm+ld}: $(( (end - start) / runs / 1000 )) us per program"
+done
+cd /
+rm -rf "$dir"
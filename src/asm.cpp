@@ -0,0 +1,205 @@
+#include "asm.h"
+#include <cctype>
+#include <cstring>
+
+static bool is_label_char(char c)
+{
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$';
+}
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+AsmLine parse_asm_line(const std::string &text) { return parse_asm_line(text.data(), text.size()); }
+
+AsmLine parse_asm_line(const char *text, size_t length)
+{
+    AsmLine line;
+    const char *b = text, *e = text + length;
+    while (b < e && is_space(*b))
+        ++b;
+    while (e > b && is_space(e[-1]))
+        --e;
+
+    // label: "name:"
+    if (b < e && e[-1] == ':')
+    {
+        const char *p = b;
+        while (p < e - 1 && is_label_char(*p))
+            ++p;
+        if (p == e - 1)
+        {
+            line.kind = AsmLine::Kind::Label;
+            line.op.assign(b, e - 1);
+            return line;
+        }
+    }
+
+    // section/global/... and data definitions ("str_0: db ...") are kept verbatim
+    const char *sp = b;
+    while (sp < e && *sp != ' ' && *sp != '\t')
+        ++sp;
+    size_t first_len = static_cast<size_t>(sp - b);
+    auto first_is = [&](const char *w) { return first_len == strlen(w) && memcmp(b, w, first_len) == 0; };
+    if (first_is("section") || first_is("global") || first_is("extern") || first_is("align") || first_is("db") ||
+        first_is("dq") || memchr(b, ':', first_len))
+    {
+        line.kind = AsmLine::Kind::Directive;
+        line.op.assign(b, e);
+        return line;
+    }
+
+    line.kind = AsmLine::Kind::Instr;
+    line.op.assign(b, sp);
+    if (sp == e)
+        return line;
+
+    // split operands on commas outside [] and quotes
+    auto push_arg = [&](const char *ab, const char *ae)
+    {
+        while (ab < ae && is_space(*ab))
+            ++ab;
+        while (ae > ab && is_space(ae[-1]))
+            --ae;
+        line.args.emplace_back(ab, ae);
+    };
+    const char *cur = sp + 1;
+    int depth = 0;
+    bool quoted = false;
+    for (const char *p = cur; p < e; ++p)
+    {
+        char c = *p;
+        if (c == '\'')
+            quoted = !quoted;
+        else if (!quoted && c == '[')
+            depth++;
+        else if (!quoted && c == ']')
+            depth--;
+        else if (c == ',' && depth == 0 && !quoted)
+        {
+            push_arg(cur, p);
+            cur = p + 1;
+        }
+    }
+    push_arg(cur, e);
+    if (line.args.back().empty())
+        line.args.pop_back();
+    return line;
+}
+
+std::string format_asm_line(const AsmLine &line)
+{
+    std::string s;
+    format_asm_line(line, s);
+    return s;
+}
+
+void format_asm_line(const AsmLine &line, std::string &out)
+{
+    if (line.kind != AsmLine::Kind::Instr)
+    {
+        out += line.op;
+        if (line.kind == AsmLine::Kind::Label)
+            out += ':';
+        return;
+    }
+    out += "    ";
+    out += line.op;
+    for (size_t i = 0; i < line.args.size(); ++i)
+    {
+        out += i ? ',' : ' ';
+        out += line.args[i];
+    }
+}
+
+void append_decimal(std::string &out, unsigned long long v)
+{
+    char buf[20];
+    char *p = buf + sizeof(buf);
+    do
+    {
+        *--p = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    out.append(p, static_cast<size_t>(buf + sizeof(buf) - p));
+}
+
+void append_decimal(std::string &out, long long v)
+{
+    if (v < 0)
+    {
+        out += '-';
+        append_decimal(out, 0 - static_cast<unsigned long long>(v));
+    }
+    else
+        append_decimal(out, static_cast<unsigned long long>(v));
+}
+
+AsmStream &AsmStream::operator<<(const char *s)
+{
+    return append(s, strlen(s));
+}
+
+AsmStream &AsmStream::operator<<(long long v)
+{
+    append_decimal(pending, v);
+    return *this;
+}
+
+AsmStream &AsmStream::operator<<(unsigned long long v)
+{
+    append_decimal(pending, v);
+    return *this;
+}
+
+AsmStream &AsmStream::append(const char *s, size_t n)
+{
+    while (n > 0)
+    {
+        auto nl = static_cast<const char *>(memchr(s, '\n', n));
+        if (!nl)
+        {
+            pending.append(s, n);
+            break;
+        }
+        size_t len = static_cast<size_t>(nl - s);
+        if (pending.empty())
+            end_line(s, len); // a whole line in one fragment: parse it in place
+        else
+        {
+            pending.append(s, len);
+            end_line(pending.data(), pending.size());
+            pending.clear();
+        }
+        s = nl + 1;
+        n -= len + 1;
+    }
+    return *this;
+}
+
+void AsmStream::end_line(const char *s, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        if (!is_space(s[i]))
+        {
+            lines.push_back(parse_asm_line(s, n));
+            return;
+        }
+}
+
+std::string AsmStream::text() const
+{
+    std::string s;
+    s.reserve(lines.size() * 16);
+    for (auto &l : lines)
+    {
+        format_asm_line(l, s);
+        s += '\n';
+    }
+    return s;
+}
+
+void AsmStream::write(std::ostream &os) const
+{
+    std::string s = text();
+    os.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
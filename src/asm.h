@@ -0,0 +1,54 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One line of generated assembly
+struct AsmLine {
+    enum class Kind { Instr, Label, Directive };
+    Kind kind = Kind::Instr;
+    std::string op;                // mnemonic, label name, or raw directive text
+    std::vector<std::string> args; // instruction operands, trimmed
+};
+
+// Parse one line of NASM text into an AsmLine
+AsmLine parse_asm_line(const std::string &text);
+AsmLine parse_asm_line(const char *text, size_t length);
+// Format an AsmLine back to NASM text (without trailing newline)
+std::string format_asm_line(const AsmLine &line);
+// Same, appended to `out`
+void format_asm_line(const AsmLine &line, std::string &out);
+
+// Append the decimal digits of `v` to `out` (no locale, no temporaries)
+void append_decimal(std::string &out, long long v);
+void append_decimal(std::string &out, unsigned long long v);
+
+// In-memory assembly buffer.
+// Codegen writes text fragments with <<; every completed line is parsed into
+// an AsmLine so passes (peephole, ...) can rewrite the instruction list
+// before it is emitted as text. Fragments are copied into the pending line in
+// bulk and integers are formatted in place, so nothing goes through iostreams
+// until write() hands the whole listing over in one call.
+class AsmStream {
+public:
+    std::vector<AsmLine> lines;
+
+    AsmStream &operator<<(const std::string &s) { return append(s.data(), s.size()); }
+    AsmStream &operator<<(const char *s);
+    AsmStream &operator<<(char c) { return append(&c, 1); }
+    AsmStream &operator<<(int v) { return *this << static_cast<long long>(v); }
+    AsmStream &operator<<(long v) { return *this << static_cast<long long>(v); }
+    AsmStream &operator<<(long long v);
+    AsmStream &operator<<(unsigned long v) { return *this << static_cast<unsigned long long>(v); }
+    AsmStream &operator<<(unsigned long long v);
+
+    // all lines as NASM text
+    std::string text() const;
+    // emit all lines as NASM text with a single write
+    void write(std::ostream &os) const;
+
+private:
+    std::string pending; // current unterminated line
+    AsmStream &append(const char *s, size_t n);
+    void end_line(const char *s, size_t n);
+};
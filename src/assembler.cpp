@@ -0,0 +1,937 @@
+#include "assembler.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+// ---------------- Operands ----------------
+struct Operand {
+    enum class Kind { Reg, Mem, Imm, Label };
+    Kind kind = Kind::Imm;
+    int size = 0;          // bytes; 0 = not given (memory without byte/word/...)
+    int reg = -1;          // Reg
+    bool byte_rex = false; // spl/bpl/sil/dil: only reachable with a REX prefix
+    int base = -1;         // Mem
+    int index = -1;
+    int scale = 1;
+    bool rip = false;      // [rel sym+disp]
+    int64_t value = 0;     // Imm value, or Mem displacement
+    std::string sym;       // Label target, or Mem symbol
+};
+
+struct RegInfo {
+    const char *name;
+    int num;
+    int size;
+};
+
+static const RegInfo reg_table[] = {
+    {"rax", 0, 8}, {"rcx", 1, 8}, {"rdx", 2, 8}, {"rbx", 3, 8}, {"rsp", 4, 8}, {"rbp", 5, 8}, {"rsi", 6, 8},
+    {"rdi", 7, 8}, {"r8", 8, 8}, {"r9", 9, 8}, {"r10", 10, 8}, {"r11", 11, 8}, {"r12", 12, 8}, {"r13", 13, 8},
+    {"r14", 14, 8}, {"r15", 15, 8},
+    {"eax", 0, 4}, {"ecx", 1, 4}, {"edx", 2, 4}, {"ebx", 3, 4}, {"esp", 4, 4}, {"ebp", 5, 4}, {"esi", 6, 4},
+    {"edi", 7, 4}, {"r8d", 8, 4}, {"r9d", 9, 4}, {"r10d", 10, 4}, {"r11d", 11, 4}, {"r12d", 12, 4},
+    {"r13d", 13, 4}, {"r14d", 14, 4}, {"r15d", 15, 4},
+    {"ax", 0, 2}, {"cx", 1, 2}, {"dx", 2, 2}, {"bx", 3, 2}, {"sp", 4, 2}, {"bp", 5, 2}, {"si", 6, 2},
+    {"di", 7, 2}, {"r8w", 8, 2}, {"r9w", 9, 2}, {"r10w", 10, 2}, {"r11w", 11, 2}, {"r12w", 12, 2},
+    {"r13w", 13, 2}, {"r14w", 14, 2}, {"r15w", 15, 2},
+    {"al", 0, 1}, {"cl", 1, 1}, {"dl", 2, 1}, {"bl", 3, 1}, {"spl", 4, 1}, {"bpl", 5, 1}, {"sil", 6, 1},
+    {"dil", 7, 1}, {"r8b", 8, 1}, {"r9b", 9, 1}, {"r10b", 10, 1}, {"r11b", 11, 1}, {"r12b", 12, 1},
+    {"r13b", 13, 1}, {"r14b", 14, 1}, {"r15b", 15, 1},
+};
+
+static const RegInfo *find_reg(const std::string &name)
+{
+    for (auto &r : reg_table)
+        if (name == r.name)
+            return &r;
+    return nullptr;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t");
+    if (b == std::string::npos)
+        return "";
+    size_t e = s.find_last_not_of(" \t");
+    return s.substr(b, e - b + 1);
+}
+
+static std::runtime_error asm_error(const std::string &msg, const AsmLine &line)
+{
+    return std::runtime_error("assembler: " + msg + " in '" + trim(format_asm_line(line)) + "'");
+}
+
+// decimal, 0x hex or a one-character constant 'c', with optional sign
+static bool parse_number(const std::string &text, int64_t &out)
+{
+    std::string s = trim(text);
+    bool neg = false;
+    if (!s.empty() && (s[0] == '-' || s[0] == '+'))
+    {
+        neg = s[0] == '-';
+        s = trim(s.substr(1));
+    }
+    if (s.size() == 3 && s[0] == '\'' && s[2] == '\'')
+        out = static_cast<unsigned char>(s[1]);
+    else
+    {
+        if (s.empty() || !isdigit(static_cast<unsigned char>(s[0])))
+            return false;
+        char *end = nullptr;
+        out = static_cast<int64_t>(strtoull(s.c_str(), &end, 0));
+        if (*end != '\0')
+            return false;
+    }
+    if (neg)
+        out = -out;
+    return true;
+}
+
+// ".foo" belongs to the last non-local label, as in NASM
+static std::string qualify(const std::string &name, const std::string &scope)
+{
+    return !name.empty() && name[0] == '.' ? scope + name : name;
+}
+
+static Operand parse_operand(const std::string &text, const std::string &scope, const AsmLine &line)
+{
+    Operand op;
+    std::string s = trim(text);
+
+    static const struct { const char *word; int size; } size_words[] = {
+        {"byte", 1}, {"word", 2}, {"dword", 4}, {"qword", 8}};
+    for (auto &w : size_words)
+    {
+        size_t n = strlen(w.word);
+        if (s.compare(0, n, w.word) == 0 && s.size() > n && (s[n] == ' ' || s[n] == '['))
+        {
+            op.size = w.size;
+            s = trim(s.substr(n));
+            break;
+        }
+    }
+
+    if (!s.empty() && s[0] == '[')
+    {
+        if (s.back() != ']')
+            throw asm_error("bad memory operand", line);
+        op.kind = Operand::Kind::Mem;
+        std::string inner = trim(s.substr(1, s.size() - 2));
+        if (inner.compare(0, 4, "rel ") == 0)
+        {
+            op.rip = true;
+            inner = trim(inner.substr(4));
+        }
+
+        // terms separated by + and -
+        size_t i = 0;
+        while (i < inner.size())
+        {
+            int sign = 1;
+            if (inner[i] == '+' || inner[i] == '-')
+            {
+                sign = inner[i] == '-' ? -1 : 1;
+                ++i;
+            }
+            size_t j = inner.find_first_of("+-", i);
+            std::string term = trim(inner.substr(i, j == std::string::npos ? std::string::npos : j - i));
+            i = j == std::string::npos ? inner.size() : j;
+
+            int64_t n;
+            size_t star = term.find('*');
+            if (star != std::string::npos)
+            {
+                auto r = find_reg(trim(term.substr(0, star)));
+                if (!r || r->size != 8 || !parse_number(term.substr(star + 1), n) || sign < 0)
+                    throw asm_error("bad index", line);
+                op.index = r->num;
+                op.scale = static_cast<int>(n);
+            }
+            else if (auto r = find_reg(term))
+            {
+                if (r->size != 8 || sign < 0)
+                    throw asm_error("bad address register", line);
+                if (op.base < 0)
+                    op.base = r->num;
+                else if (op.index < 0)
+                    op.index = r->num;
+                else
+                    throw asm_error("too many address registers", line);
+            }
+            else if (parse_number(term, n))
+                op.value += sign * n;
+            else if (op.sym.empty() && sign > 0)
+                op.sym = qualify(term, scope);
+            else
+                throw asm_error("bad address term '" + term + "'", line);
+        }
+        if (op.scale != 1 && op.scale != 2 && op.scale != 4 && op.scale != 8)
+            throw asm_error("bad scale", line);
+        if (op.rip && (op.base >= 0 || op.index >= 0))
+            throw asm_error("rip-relative address with registers", line);
+        if (!op.sym.empty() && !op.rip)
+            throw asm_error("absolute addresses are not supported (use [rel ...])", line);
+        return op;
+    }
+
+    if (auto r = find_reg(s))
+    {
+        op.kind = Operand::Kind::Reg;
+        op.reg = r->num;
+        op.size = r->size;
+        op.byte_rex = r->size == 1 && r->num >= 4 && r->num < 8;
+        return op;
+    }
+    if (parse_number(s, op.value))
+    {
+        op.kind = Operand::Kind::Imm;
+        return op;
+    }
+    if (s.empty())
+        throw asm_error("missing operand", line);
+    op.kind = Operand::Kind::Label;
+    op.sym = qualify(s, scope);
+    return op;
+}
+
+static bool fits8(int64_t v) { return v >= -128 && v <= 127; }
+static bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+// ---------------- Encoding ----------------
+
+// One encoded instruction: bytes plus at most one rel32 field to resolve
+struct Code {
+    std::vector<uint8_t> bytes;
+    bool has_fixup = false;
+    size_t fixup_at = 0;  // offset of the rel32 field
+    std::string fixup_sym;
+    int64_t fixup_add = 0;
+
+    void imm(int64_t v, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+};
+
+// [66] [REX] opcode ModRM [SIB] [disp] [imm]
+static void emit_op(Code &c, int opsize, std::initializer_list<uint8_t> opcode, int reg, const Operand &rm,
+                    int imm_size = 0, int64_t imm = 0, bool force_rex = false)
+{
+    if (opsize == 2)
+        c.bytes.push_back(0x66);
+    uint8_t rex = 0x40;
+    if (opsize == 8)
+        rex |= 8;
+    if (reg & 8)
+        rex |= 4;
+    if (rm.kind == Operand::Kind::Reg)
+    {
+        if (rm.reg & 8)
+            rex |= 1;
+        force_rex |= rm.byte_rex;
+    }
+    else
+    {
+        if (rm.index >= 0 && (rm.index & 8))
+            rex |= 2;
+        if (rm.base >= 0 && (rm.base & 8))
+            rex |= 1;
+    }
+    if (rex != 0x40 || force_rex)
+        c.bytes.push_back(rex);
+    c.bytes.insert(c.bytes.end(), opcode.begin(), opcode.end());
+
+    int r = (reg & 7) << 3;
+    if (rm.kind == Operand::Kind::Reg)
+        c.bytes.push_back(static_cast<uint8_t>(0xC0 | r | (rm.reg & 7)));
+    else if (rm.rip)
+    {
+        c.bytes.push_back(static_cast<uint8_t>(0x05 | r));
+        c.has_fixup = true;
+        c.fixup_at = c.bytes.size();
+        c.fixup_sym = rm.sym;
+        c.fixup_add = rm.value;
+        c.imm(0, 4);
+    }
+    else
+    {
+        if (rm.base < 0 || rm.index == 4)
+            throw std::runtime_error("assembler: unsupported address form");
+        int mod = rm.value == 0 && (rm.base & 7) != 5 ? 0 : fits8(rm.value) ? 1 : 2;
+        if (!fits32(rm.value))
+            throw std::runtime_error("assembler: displacement out of range");
+        bool sib = rm.index >= 0 || (rm.base & 7) == 4;
+        c.bytes.push_back(static_cast<uint8_t>(mod << 6 | r | (sib ? 4 : rm.base & 7)));
+        if (sib)
+        {
+            int ss = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            int idx = rm.index >= 0 ? rm.index & 7 : 4;
+            c.bytes.push_back(static_cast<uint8_t>(ss << 6 | idx << 3 | (rm.base & 7)));
+        }
+        if (mod == 1)
+            c.imm(rm.value, 1);
+        else if (mod == 2)
+            c.imm(rm.value, 4);
+    }
+    c.imm(imm, imm_size);
+}
+
+static const std::unordered_map<std::string, int> alu_ops = {
+    {"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7}};
+static const std::unordered_map<std::string, int> unary_ops = {
+    {"not", 2}, {"neg", 3}, {"mul", 4}, {"div", 6}, {"idiv", 7}};
+static const std::unordered_map<std::string, int> shift_ops = {
+    {"rol", 0}, {"ror", 1}, {"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7}};
+static const std::unordered_map<std::string, int> cond_codes = {
+    {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2}, {"ae", 3}, {"nb", 3}, {"nc", 3},
+    {"e", 4}, {"z", 4}, {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6}, {"a", 7}, {"nbe", 7},
+    {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11}, {"po", 11}, {"l", 12}, {"nge", 12},
+    {"ge", 13}, {"nl", 13}, {"le", 14}, {"ng", 14}, {"g", 15}, {"nle", 15}};
+
+static int cond_code(const std::string &op, size_t prefix_len)
+{
+    if (op.size() <= prefix_len)
+        return -1;
+    auto it = cond_codes.find(op.substr(prefix_len));
+    return it == cond_codes.end() ? -1 : it->second;
+}
+
+// operand size of a two-operand instruction, from whichever side knows it
+static int pair_size(const Operand &a, const Operand &b, const AsmLine &line)
+{
+    int size = a.size ? a.size : b.kind == Operand::Kind::Reg ? b.size : 0;
+    if (!size)
+        throw asm_error("operation size not specified", line);
+    if (b.kind == Operand::Kind::Reg && a.size && a.size != b.size)
+        throw asm_error("mismatched operand sizes", line);
+    return size;
+}
+
+static bool is_rm(const Operand &op) { return op.kind == Operand::Kind::Reg || op.kind == Operand::Kind::Mem; }
+
+// every instruction except jmp/jcc to a label, which are relaxed later
+static Code encode(const AsmLine &line, const std::string &scope)
+{
+    const std::string &op = line.op;
+    std::vector<Operand> a;
+    for (auto &arg : line.args)
+        a.push_back(parse_operand(arg, scope, line));
+    auto want = [&](size_t n)
+    {
+        if (a.size() != n)
+            throw asm_error("expected " + std::to_string(n) + " operand(s)", line);
+    };
+    using K = Operand::Kind;
+    Code c;
+
+    if (auto alu = alu_ops.find(op); alu != alu_ops.end())
+    {
+        want(2);
+        int n = alu->second;
+        if (a[1].kind == K::Imm && is_rm(a[0]))
+        {
+            int size = a[0].size;
+            if (!size)
+                throw asm_error("operation size not specified", line);
+            if (size == 1)
+                emit_op(c, 1, {0x80}, n, a[0], 1, a[1].value);
+            else if (fits8(a[1].value))
+                emit_op(c, size, {0x83}, n, a[0], 1, a[1].value);
+            else if (fits32(a[1].value))
+                emit_op(c, size, {0x81}, n, a[0], size == 2 ? 2 : 4, a[1].value);
+            else
+                throw asm_error("immediate out of range", line);
+        }
+        else if (a[1].kind == K::Reg && is_rm(a[0]))
+        {
+            int size = pair_size(a[0], a[1], line);
+            emit_op(c, size, {static_cast<uint8_t>(n * 8 + (size == 1 ? 0 : 1))}, a[1].reg, a[0], 0, 0, a[1].byte_rex);
+        }
+        else if (a[0].kind == K::Reg && a[1].kind == K::Mem)
+        {
+            int size = pair_size(a[1], a[0], line);
+            emit_op(c, size, {static_cast<uint8_t>(n * 8 + (size == 1 ? 2 : 3))}, a[0].reg, a[1], 0, 0, a[0].byte_rex);
+        }
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op == "test")
+    {
+        want(2);
+        if (a[1].kind == K::Imm && is_rm(a[0]))
+        {
+            int size = a[0].size;
+            if (!size)
+                throw asm_error("operation size not specified", line);
+            emit_op(c, size, {static_cast<uint8_t>(size == 1 ? 0xF6 : 0xF7)}, 0, a[0], size > 4 ? 4 : size,
+                    a[1].value);
+        }
+        else if (a[1].kind == K::Reg && is_rm(a[0]))
+        {
+            int size = pair_size(a[0], a[1], line);
+            emit_op(c, size, {static_cast<uint8_t>(size == 1 ? 0x84 : 0x85)}, a[1].reg, a[0], 0, 0, a[1].byte_rex);
+        }
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op == "mov")
+    {
+        want(2);
+        if (a[0].kind == K::Reg && a[1].kind == K::Imm)
+        {
+            int r = a[0].reg, size = a[0].size;
+            int64_t v = a[1].value;
+            if (size == 8 && v >= 0 && v <= 0xFFFFFFFFLL)
+                size = 4; // mov r32 zero-extends, as NASM encodes it
+            if (size == 8 && fits32(v))
+                emit_op(c, 8, {0xC7}, 0, a[0], 4, v);
+            else
+            {
+                if (size == 2)
+                    c.bytes.push_back(0x66);
+                if (size == 8 || r >= 8 || a[0].byte_rex)
+                    c.bytes.push_back(static_cast<uint8_t>(0x40 | (size == 8 ? 8 : 0) | (r >> 3)));
+                c.bytes.push_back(static_cast<uint8_t>((size == 1 ? 0xB0 : 0xB8) + (r & 7)));
+                c.imm(v, size);
+            }
+        }
+        else if (a[0].kind == K::Mem && a[1].kind == K::Imm)
+        {
+            int size = a[0].size;
+            if (!size)
+                throw asm_error("operation size not specified", line);
+            if (!fits32(a[1].value))
+                throw asm_error("immediate out of range", line);
+            emit_op(c, size, {static_cast<uint8_t>(size == 1 ? 0xC6 : 0xC7)}, 0, a[0], size > 4 ? 4 : size,
+                    a[1].value);
+        }
+        else if (a[1].kind == K::Reg && is_rm(a[0]))
+        {
+            int size = pair_size(a[0], a[1], line);
+            emit_op(c, size, {static_cast<uint8_t>(size == 1 ? 0x88 : 0x89)}, a[1].reg, a[0], 0, 0,
+                    a[1].byte_rex);
+        }
+        else if (a[0].kind == K::Reg && a[1].kind == K::Mem)
+        {
+            int size = pair_size(a[1], a[0], line);
+            emit_op(c, size, {static_cast<uint8_t>(size == 1 ? 0x8A : 0x8B)}, a[0].reg, a[1], 0, 0,
+                    a[0].byte_rex);
+        }
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op == "movzx" || op == "movsx")
+    {
+        want(2);
+        if (a[0].kind != K::Reg || !is_rm(a[1]) || (a[1].size != 1 && a[1].size != 2))
+            throw asm_error("unsupported operands", line);
+        uint8_t opc = (op == "movzx" ? 0xB6 : 0xBE) + (a[1].size == 2 ? 1 : 0);
+        emit_op(c, a[0].size, {0x0F, opc}, a[0].reg, a[1], 0, 0, a[1].byte_rex);
+    }
+    else if (op == "lea")
+    {
+        want(2);
+        if (a[0].kind != K::Reg || a[1].kind != K::Mem)
+            throw asm_error("unsupported operands", line);
+        emit_op(c, a[0].size, {0x8D}, a[0].reg, a[1]);
+    }
+    else if (op == "imul" && a.size() >= 2)
+    {
+        // imul r, imm is shorthand for imul r, r, imm
+        Operand src = a.size() == 3 || a[1].kind != K::Imm ? a[1] : a[0];
+        const Operand *imm = a.size() == 3 ? &a[2] : a[1].kind == K::Imm ? &a[1] : nullptr;
+        if (a[0].kind != K::Reg || !is_rm(src))
+            throw asm_error("unsupported operands", line);
+        if (!imm)
+            emit_op(c, a[0].size, {0x0F, 0xAF}, a[0].reg, src);
+        else if (fits8(imm->value))
+            emit_op(c, a[0].size, {0x6B}, a[0].reg, src, 1, imm->value);
+        else if (fits32(imm->value))
+            emit_op(c, a[0].size, {0x69}, a[0].reg, src, a[0].size == 2 ? 2 : 4, imm->value);
+        else
+            throw asm_error("immediate out of range", line);
+    }
+    else if (auto un = unary_ops.find(op); un != unary_ops.end() || op == "imul")
+    {
+        want(1);
+        if (!is_rm(a[0]) || !a[0].size)
+            throw asm_error("unsupported operands", line);
+        int n = op == "imul" ? 5 : un->second;
+        emit_op(c, a[0].size, {static_cast<uint8_t>(a[0].size == 1 ? 0xF6 : 0xF7)}, n, a[0]);
+    }
+    else if (op == "inc" || op == "dec")
+    {
+        want(1);
+        if (!is_rm(a[0]) || !a[0].size)
+            throw asm_error("unsupported operands", line);
+        emit_op(c, a[0].size, {static_cast<uint8_t>(a[0].size == 1 ? 0xFE : 0xFF)}, op == "dec", a[0]);
+    }
+    else if (auto sh = shift_ops.find(op); sh != shift_ops.end())
+    {
+        want(2);
+        int size = a[0].size;
+        if (!is_rm(a[0]) || !size)
+            throw asm_error("unsupported operands", line);
+        bool byte = size == 1;
+        if (a[1].kind == K::Reg && a[1].reg == 1 && a[1].size == 1)
+            emit_op(c, size, {static_cast<uint8_t>(byte ? 0xD2 : 0xD3)}, sh->second, a[0]);
+        else if (a[1].kind == K::Imm && a[1].value == 1)
+            emit_op(c, size, {static_cast<uint8_t>(byte ? 0xD0 : 0xD1)}, sh->second, a[0]);
+        else if (a[1].kind == K::Imm)
+            emit_op(c, size, {static_cast<uint8_t>(byte ? 0xC0 : 0xC1)}, sh->second, a[0], 1, a[1].value);
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op == "push" || op == "pop")
+    {
+        want(1);
+        bool push = op == "push";
+        if (a[0].kind == K::Reg && a[0].size == 8)
+        {
+            if (a[0].reg >= 8)
+                c.bytes.push_back(0x41);
+            c.bytes.push_back(static_cast<uint8_t>((push ? 0x50 : 0x58) + (a[0].reg & 7)));
+        }
+        else if (push && a[0].kind == K::Imm && fits32(a[0].value))
+        {
+            c.bytes.push_back(fits8(a[0].value) ? 0x6A : 0x68);
+            c.imm(a[0].value, fits8(a[0].value) ? 1 : 4);
+        }
+        else if (a[0].kind == K::Mem)
+            emit_op(c, 4, {static_cast<uint8_t>(push ? 0xFF : 0x8F)}, push ? 6 : 0, a[0]);
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op == "call" || op == "jmp")
+    {
+        // jmp to a label is handled as a relaxable branch by the caller
+        want(1);
+        if (a[0].kind == K::Label && op == "call")
+        {
+            c.bytes.push_back(0xE8);
+            c.has_fixup = true;
+            c.fixup_at = 1;
+            c.fixup_sym = a[0].sym;
+            c.imm(0, 4);
+        }
+        else if (is_rm(a[0]) && (a[0].kind == K::Mem || a[0].size == 8))
+            emit_op(c, 4, {0xFF}, op == "call" ? 2 : 4, a[0]);
+        else
+            throw asm_error("unsupported operands", line);
+    }
+    else if (op.compare(0, 3, "set") == 0 && cond_code(op, 3) >= 0)
+    {
+        want(1);
+        if (!is_rm(a[0]) || (a[0].size != 1 && a[0].kind == K::Reg))
+            throw asm_error("setcc needs a byte operand", line);
+        emit_op(c, 1, {0x0F, static_cast<uint8_t>(0x90 + cond_code(op, 3))}, 0, a[0]);
+    }
+    else if (op.compare(0, 4, "cmov") == 0 && cond_code(op, 4) >= 0)
+    {
+        want(2);
+        if (a[0].kind != K::Reg || !is_rm(a[1]) || a[0].size == 1)
+            throw asm_error("unsupported operands", line);
+        emit_op(c, a[0].size, {0x0F, static_cast<uint8_t>(0x40 + cond_code(op, 4))}, a[0].reg, a[1]);
+    }
+    else if (op == "rep")
+    {
+        static const std::unordered_map<std::string, std::vector<uint8_t>> string_ops = {
+            {"movsb", {0xA4}}, {"movsq", {0x48, 0xA5}}, {"stosb", {0xAA}}, {"stosq", {0x48, 0xAB}}};
+        auto it = line.args.size() == 1 ? string_ops.find(line.args[0]) : string_ops.end();
+        if (it == string_ops.end())
+            throw asm_error("unsupported rep form", line);
+        c.bytes.push_back(0xF3);
+        c.bytes.insert(c.bytes.end(), it->second.begin(), it->second.end());
+    }
+    else
+    {
+        static const std::unordered_map<std::string, std::vector<uint8_t>> plain = {
+            {"ret", {0xC3}}, {"leave", {0xC9}}, {"cqo", {0x48, 0x99}}, {"cdq", {0x99}},
+            {"syscall", {0x0F, 0x05}}, {"nop", {0x90}}, {"ud2", {0x0F, 0x0B}}};
+        auto it = plain.find(op);
+        if (it == plain.end())
+            throw asm_error("unknown instruction", line);
+        want(0);
+        c.bytes = it->second;
+    }
+    return c;
+}
+
+// ---------------- Layout ----------------
+
+// A section is built as a list of items; only branches change size
+struct Item {
+    enum class Kind { Code, Branch, Label, Space, Align };
+    Kind kind;
+    Code code;          // Code
+    int cond = -1;      // Branch: -1 = jmp, else condition code
+    bool is_long = false;
+    std::string target; // Branch target / Label name
+    uint64_t amount = 0; // Space bytes / Align boundary
+    uint64_t offset = 0; // assigned by layout
+
+    uint64_t size(uint64_t at) const
+    {
+        switch (kind)
+        {
+        case Kind::Code:
+            return code.bytes.size();
+        case Kind::Branch:
+            return !is_long ? 2 : cond < 0 ? 5 : 6;
+        case Kind::Space:
+            return amount;
+        case Kind::Align:
+            return (amount - at % amount) % amount;
+        default:
+            return 0;
+        }
+    }
+};
+
+struct LabelPos {
+    ObjSectionId section;
+    uint64_t offset;
+};
+
+static const ObjSectionId all_sections[] = {ObjSectionId::Text, ObjSectionId::Data, ObjSectionId::Bss};
+
+// split "a, 'b,c', 3" on commas outside quotes
+static std::vector<std::string> split_data_items(const std::string &s)
+{
+    std::vector<std::string> items;
+    std::string cur;
+    char quote = 0;
+    for (char c : s)
+    {
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == ',')
+        {
+            items.push_back(trim(cur));
+            cur.clear();
+            continue;
+        }
+        cur += c;
+    }
+    if (!trim(cur).empty())
+        items.push_back(trim(cur));
+    return items;
+}
+
+void apply_relocations(std::vector<uint8_t> &bytes, uint64_t addr, const ObjSection &sec, const uint64_t base[3])
+{
+    for (auto &r : sec.relocs)
+    {
+        int64_t v = static_cast<int64_t>(base[static_cast<int>(r.target)]) + r.addend -
+                    static_cast<int64_t>(addr + r.offset);
+        if (!fits32(v))
+            throw std::runtime_error("linker: relocation out of range");
+        for (int i = 0; i < 4; ++i)
+            bytes[r.offset + i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+// The program as items per section, before layout
+struct ItemList {
+    std::map<ObjSectionId, std::vector<Item>> items;
+    std::vector<std::pair<std::string, ObjSectionId>> label_order;
+    std::vector<std::string> globals;
+};
+
+static ItemList build_items(const std::vector<AsmLine> &lines)
+{
+    ItemList list;
+    auto &items = list.items;
+    auto &label_order = list.label_order;
+    auto &globals = list.globals;
+    std::unordered_set<std::string> defined;
+    ObjSectionId cur = ObjSectionId::Text;
+    std::vector<Item> cold; // .text.cold, laid out after the rest of .text
+    bool in_cold = false;
+    std::string scope;
+    auto current = [&]() -> std::vector<Item> & { return in_cold ? cold : items[cur]; };
+
+    auto define = [&](const std::string &raw)
+    {
+        if (raw.empty() || raw[0] != '.')
+            scope = raw;
+        Item it{Item::Kind::Label};
+        it.target = qualify(raw, scope);
+        if (!defined.insert(it.target).second)
+            throw std::runtime_error("assembler: label '" + it.target + "' defined twice");
+        label_order.push_back({it.target, cur});
+        current().push_back(std::move(it));
+    };
+    auto bytes = [&](const std::vector<uint8_t> &b, const AsmLine &line)
+    {
+        if (cur == ObjSectionId::Bss)
+            throw asm_error("initialized data in .bss", line);
+        Item it{Item::Kind::Code};
+        it.code.bytes = b;
+        current().push_back(it);
+    };
+
+    for (auto &line : lines)
+    {
+        if (line.kind == AsmLine::Kind::Label)
+        {
+            define(line.op);
+            continue;
+        }
+        if (line.kind == AsmLine::Kind::Instr)
+        {
+            if (cur != ObjSectionId::Text)
+                throw asm_error("instruction outside .text", line);
+            int cc = line.op.size() > 1 && line.op[0] == 'j' ? cond_code(line.op, 1) : -1;
+            bool branch = line.op == "jmp" || cc >= 0;
+            if (branch && line.args.size() == 1 &&
+                parse_operand(line.args[0], scope, line).kind == Operand::Kind::Label)
+            {
+                Item it{Item::Kind::Branch};
+                it.cond = line.op == "jmp" ? -1 : cc;
+                it.target = qualify(trim(line.args[0]), scope);
+                current().push_back(std::move(it));
+                continue;
+            }
+            if (cc >= 0)
+                throw asm_error("conditional jump needs a label", line);
+            Item it{Item::Kind::Code};
+            it.code = encode(line, scope);
+            current().push_back(std::move(it));
+            continue;
+        }
+
+        // directives: optional "name:" prefix, then keyword and arguments
+        std::string text = trim(line.op);
+        size_t sp = text.find_first_of(" \t");
+        std::string first = text.substr(0, sp);
+        std::string rest = sp == std::string::npos ? "" : trim(text.substr(sp));
+        if (!first.empty() && first.back() == ':')
+        {
+            define(first.substr(0, first.size() - 1));
+            sp = rest.find_first_of(" \t");
+            first = rest.substr(0, sp);
+            rest = sp == std::string::npos ? "" : trim(rest.substr(sp));
+        }
+
+        if (first == "section")
+        {
+            // .text.cold may carry NASM's section attributes
+            in_cold = rest.substr(0, rest.find_first_of(" \t")) == ".text.cold";
+            if (rest == ".text" || in_cold)
+                cur = ObjSectionId::Text;
+            else if (rest == ".data")
+                cur = ObjSectionId::Data;
+            else if (rest == ".bss")
+                cur = ObjSectionId::Bss;
+            else
+                throw asm_error("unknown section", line);
+        }
+        else if (first == "global")
+        {
+            for (auto &g : split_data_items(rest))
+                globals.push_back(g);
+        }
+        else if (first == "align")
+        {
+            int64_t n;
+            if (!parse_number(rest, n) || n <= 0 || (n & (n - 1)))
+                throw asm_error("bad alignment", line);
+            Item it{Item::Kind::Align};
+            it.amount = static_cast<uint64_t>(n);
+            current().push_back(it);
+        }
+        else if (first == "db" || first == "dw" || first == "dd" || first == "dq")
+        {
+            int width = first == "db" ? 1 : first == "dw" ? 2 : first == "dd" ? 4 : 8;
+            std::vector<uint8_t> b;
+            for (auto &item : split_data_items(rest))
+            {
+                int64_t v;
+                if (item.size() >= 2 && (item[0] == '"' || item[0] == '\'') && item.back() == item[0] &&
+                    !(item.size() == 3 && width > 1))
+                {
+                    for (size_t i = 1; i + 1 < item.size(); ++i)
+                        b.push_back(static_cast<uint8_t>(item[i]));
+                    while (b.size() % width)
+                        b.push_back(0);
+                }
+                else if (parse_number(item, v))
+                    for (int i = 0; i < width; ++i)
+                        b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+                else
+                    throw asm_error("bad data item '" + item + "'", line);
+            }
+            bytes(b, line);
+        }
+        else if (first == "resb" || first == "resw" || first == "resd" || first == "resq")
+        {
+            int64_t n;
+            if (!parse_number(rest, n) || n < 0)
+                throw asm_error("bad reservation", line);
+            int width = first == "resb" ? 1 : first == "resw" ? 2 : first == "resd" ? 4 : 8;
+            if (cur != ObjSectionId::Bss)
+                bytes(std::vector<uint8_t>(static_cast<size_t>(n * width), 0), line);
+            else
+            {
+                Item it{Item::Kind::Space};
+                it.amount = static_cast<uint64_t>(n * width);
+                current().push_back(it);
+            }
+        }
+        else
+            throw asm_error("unsupported directive", line);
+    }
+
+    if (!cold.empty())
+    {
+        Item it{Item::Kind::Align};
+        it.amount = 16;
+        items[ObjSectionId::Text].push_back(it);
+        items[ObjSectionId::Text].insert(items[ObjSectionId::Text].end(), cold.begin(), cold.end());
+    }
+
+    return list;
+}
+
+// Relaxation: start every branch short and lengthen the ones that do not
+// reach. Branches only ever grow, so this terminates. Assigns every item its
+// offset and returns the labels; a branch to a label not in `items` is long.
+static std::unordered_map<std::string, LabelPos> layout_items(std::map<ObjSectionId, std::vector<Item>> &items)
+{
+    std::unordered_map<std::string, LabelPos> labels;
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        labels.clear();
+        for (auto sec : all_sections)
+        {
+            uint64_t at = 0;
+            for (auto &it : items[sec])
+            {
+                it.offset = at;
+                if (it.kind == Item::Kind::Label)
+                    labels[it.target] = {sec, at};
+                at += it.size(at);
+            }
+        }
+        for (auto &it : items[ObjSectionId::Text])
+        {
+            if (it.kind != Item::Kind::Branch || it.is_long)
+                continue;
+            auto l = labels.find(it.target);
+            int64_t disp = l == labels.end() || l->second.section != ObjSectionId::Text
+                               ? INT64_MAX
+                               : static_cast<int64_t>(l->second.offset) - static_cast<int64_t>(it.offset + 2);
+            if (!fits8(disp))
+                it.is_long = changed = true;
+        }
+    }
+
+    return labels;
+}
+
+uint64_t code_size(const std::vector<AsmLine> &lines)
+{
+    ItemList list = build_items(lines);
+    layout_items(list.items);
+    auto &text = list.items[ObjSectionId::Text];
+    return text.empty() ? 0 : text.back().offset + text.back().size(text.back().offset);
+}
+
+ObjectFile assemble(const std::vector<AsmLine> &lines)
+{
+    ItemList list = build_items(lines);
+    auto &items = list.items;
+    std::unordered_map<std::string, LabelPos> labels = layout_items(items);
+
+    auto lookup = [&](const std::string &name) -> const LabelPos &
+    {
+        auto l = labels.find(name);
+        if (l == labels.end())
+            throw std::runtime_error("assembler: symbol '" + name + "' not defined");
+        return l->second;
+    };
+
+    ObjectFile obj;
+    obj.text.align = 16;
+    obj.data.align = 8;
+    obj.bss.align = 8;
+    for (auto sec : all_sections)
+    {
+        ObjSection &out = obj.section(sec);
+        for (auto &it : items[sec])
+        {
+            if (sec == ObjSectionId::Bss)
+            {
+                out.size += it.size(out.size);
+                continue;
+            }
+            if (it.kind == Item::Kind::Branch)
+            {
+                const LabelPos &t = lookup(it.target);
+                if (t.section != ObjSectionId::Text)
+                    throw std::runtime_error("assembler: jump to data label '" + it.target + "'");
+                int64_t end = static_cast<int64_t>(it.offset + it.size(it.offset));
+                int64_t disp = static_cast<int64_t>(t.offset) - end;
+                Code c;
+                if (!it.is_long)
+                    c.bytes = {static_cast<uint8_t>(it.cond < 0 ? 0xEB : 0x70 + it.cond)};
+                else if (it.cond < 0)
+                    c.bytes = {0xE9};
+                else
+                    c.bytes = {0x0F, static_cast<uint8_t>(0x80 + it.cond)};
+                c.imm(disp, it.is_long ? 4 : 1);
+                out.bytes.insert(out.bytes.end(), c.bytes.begin(), c.bytes.end());
+                continue;
+            }
+            if (it.kind == Item::Kind::Align)
+            {
+                out.bytes.insert(out.bytes.end(), it.size(out.bytes.size()), sec == ObjSectionId::Text ? 0x90 : 0);
+                continue;
+            }
+            if (it.kind != Item::Kind::Code)
+                continue;
+
+            Code &c = it.code;
+            if (c.has_fixup)
+            {
+                // rel32 is relative to the end of the instruction
+                const LabelPos &t = lookup(c.fixup_sym);
+                uint64_t field = it.offset + c.fixup_at;
+                int64_t to_end = static_cast<int64_t>(c.bytes.size() - c.fixup_at);
+                if (t.section == sec)
+                {
+                    int64_t v = static_cast<int64_t>(t.offset) + c.fixup_add - static_cast<int64_t>(field) - to_end;
+                    for (int i = 0; i < 4; ++i)
+                        c.bytes[c.fixup_at + i] = static_cast<uint8_t>(v >> (8 * i));
+                }
+                else
+                    out.relocs.push_back({field, t.section, static_cast<int64_t>(t.offset) + c.fixup_add - to_end});
+            }
+            out.bytes.insert(out.bytes.end(), c.bytes.begin(), c.bytes.end());
+        }
+        if (sec != ObjSectionId::Bss)
+            out.size = out.bytes.size();
+    }
+
+    std::unordered_set<std::string> global_set;
+    for (auto &g : list.globals)
+    {
+        lookup(g);
+        global_set.insert(g);
+    }
+    for (auto &l : list.label_order)
+        obj.symbols.push_back({l.first, l.second, labels[l.first].offset, global_set.count(l.first) > 0});
+    return obj;
+}
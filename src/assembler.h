@@ -0,0 +1,61 @@
+#pragma once
+#include "asm.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// In-memory x86-64 assembler for the NASM subset codegen and the runtime emit.
+// Works on the AsmLine list directly, so the direct backend never prints or
+// re-parses assembly text. Unsupported input throws std::runtime_error.
+// .text.cold is not a section of its own: its code goes at the end of .text,
+// where ld would put it.
+
+enum class ObjSectionId { Text, Data, Bss };
+
+// Reference from one section into another, left for the linker.
+// The value stored at `offset` is S + addend - P (R_X86_64_PC32), where S is
+// the start of `target`.
+struct ObjReloc {
+    uint64_t offset;
+    ObjSectionId target;
+    int64_t addend;
+};
+
+struct ObjSection {
+    std::vector<uint8_t> bytes; // empty for .bss
+    uint64_t size = 0;          // .bss size (== bytes.size() otherwise)
+    uint64_t align = 1;
+    std::vector<ObjReloc> relocs;
+};
+
+struct ObjSymbol {
+    std::string name; // local labels are qualified: "main.else_3"
+    ObjSectionId section;
+    uint64_t value;
+    bool global;
+};
+
+struct ObjectFile {
+    ObjSection text, data, bss;
+    std::vector<ObjSymbol> symbols; // in definition order
+
+    ObjSection &section(ObjSectionId id)
+    {
+        return id == ObjSectionId::Text ? text : id == ObjSectionId::Data ? data : bss;
+    }
+    const ObjSection &section(ObjSectionId id) const
+    {
+        return id == ObjSectionId::Text ? text : id == ObjSectionId::Data ? data : bss;
+    }
+};
+
+// Encode the program. Jumps take the short form whenever the target is in range.
+ObjectFile assemble(const std::vector<AsmLine> &lines);
+
+// Bytes of .text `lines` would encode to on their own; jumps to labels
+// outside `lines` count in their long form.
+uint64_t code_size(const std::vector<AsmLine> &lines);
+
+// Resolve `sec`'s relocations in `bytes`, a copy of its contents placed at
+// `addr`, once every section has an address (`base`, indexed by ObjSectionId).
+void apply_relocations(std::vector<uint8_t> &bytes, uint64_t addr, const ObjSection &sec, const uint64_t base[3]);
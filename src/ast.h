@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
@@ -15,8 +16,35 @@ protected:
     static void indentPrint(int n) { for (int i=0;i<n;i++) std::cout << "  "; }
 };
 
+// Execution counts of a function, call, branch or loop (profile.h): the
+// counter index under --profile-generate, the counts under --profile-use or
+// the estimates of the layout pass (optimize.h).
+struct ProfileSite {
+    int site = -1;      // first counter, -1 when not instrumented
+    uint64_t count = 0; // entries, calls, condition tests or loop entries
+    uint64_t taken = 0; // if: then-branch runs; while: body iterations
+    bool cold = false;  // function, or the unlikely side of an if, goes to .text.cold
+};
+
 // Expressions
-struct Expr : Node { using Ptr = std::unique_ptr<Expr>; };
+struct Expr : Node {
+    using Ptr = std::unique_ptr<Expr>;
+    // moves the operands out, so that a tree can be freed without recursion
+    virtual void release_operands(std::vector<Ptr> &) {}
+};
+
+// Frees the operands of `e` from an explicit stack: destroying a generated
+// chain of a million operators through unique_ptr alone would nest a million
+// destructor calls.
+inline void free_operands(Expr &e) {
+    std::vector<Expr::Ptr> stack;
+    e.release_operands(stack);
+    while (!stack.empty()) {
+        Expr::Ptr top = std::move(stack.back());
+        stack.pop_back();
+        if (top) top->release_operands(stack);
+    }
+}
 
 struct Identifier : Expr {
     std::string name;
@@ -54,6 +82,8 @@ struct UnaryExpr : Expr {
     std::string op;
     Expr::Ptr right;
     UnaryExpr(std::string o, Expr::Ptr r): op(std::move(o)), right(std::move(r)) {}
+    ~UnaryExpr() override { free_operands(*this); }
+    void release_operands(std::vector<Expr::Ptr> &out) override { out.push_back(std::move(right)); }
     void pretty_print(int indent = 0) const override {
         indentPrint(indent); std::cout << "Unary(" << op << ")\n";
         right->pretty_print(indent+1);
@@ -66,6 +96,11 @@ struct BinaryExpr : Expr {
     Expr::Ptr right;
     BinaryExpr(std::string o, Expr::Ptr l, Expr::Ptr r)
         : op(std::move(o)), left(std::move(l)), right(std::move(r)) {}
+    ~BinaryExpr() override { free_operands(*this); }
+    void release_operands(std::vector<Expr::Ptr> &out) override {
+        out.push_back(std::move(left));
+        out.push_back(std::move(right));
+    }
     void pretty_print(int indent = 0) const override {
         indentPrint(indent); std::cout << "Binary(" << op << ")\n";
         left->pretty_print(indent+1);
@@ -76,7 +111,13 @@ struct BinaryExpr : Expr {
 struct CallExpr : Expr {
     Expr::Ptr callee;
     std::vector<Expr::Ptr> args;
+    ProfileSite profile;
     CallExpr(Expr::Ptr c, std::vector<Expr::Ptr> a): callee(std::move(c)), args(std::move(a)) {}
+    ~CallExpr() override { free_operands(*this); }
+    void release_operands(std::vector<Expr::Ptr> &out) override {
+        out.push_back(std::move(callee));
+        for (auto &a : args) out.push_back(std::move(a));
+    }
     void pretty_print(int indent = 0) const override {
         indentPrint(indent); std::cout << "Call\n";
         callee->pretty_print(indent+1);
@@ -132,6 +173,7 @@ struct IfStmt : Stmt {
     Expr::Ptr cond;
     std::unique_ptr<BlockStmt> thenBranch;
     std::unique_ptr<BlockStmt> elseBranch; // optional
+    ProfileSite profile;
     IfStmt(Expr::Ptr c, std::unique_ptr<BlockStmt> t, std::unique_ptr<BlockStmt> e)
         : cond(std::move(c)), thenBranch(std::move(t)), elseBranch(std::move(e)) {}
     void pretty_print(int indent = 0) const override {
@@ -147,9 +189,16 @@ struct IfExpr : Expr {
     Expr::Ptr cond;
     Expr::Ptr thenExpr;
     Expr::Ptr elseExpr;
+    ProfileSite profile;
 
     IfExpr(Expr::Ptr c, Expr::Ptr t, Expr::Ptr e)
         : cond(std::move(c)), thenExpr(std::move(t)), elseExpr(std::move(e)) {}
+    ~IfExpr() override { free_operands(*this); }
+    void release_operands(std::vector<Expr::Ptr> &out) override {
+        out.push_back(std::move(cond));
+        out.push_back(std::move(thenExpr));
+        out.push_back(std::move(elseExpr));
+    }
 
     void pretty_print(int indent = 0) const override {
         indentPrint(indent); std::cout << "IfExpr\n";
@@ -159,11 +208,82 @@ struct IfExpr : Expr {
     }
 };
 
+// Expression walkers keep their own stack instead of recursing: generated
+// code can nest a million operators in one expression, far deeper than the
+// native stack goes.
+
+// Pushes the operands of `e` so that they pop in evaluation order: left then
+// right, condition then branches, arguments in order (the callee of a call is
+// a name, not an operand). E is Expr or const Expr.
+template <class E>
+void push_operands(std::vector<E *> &stack, E *e) {
+    auto push = [&](Expr *x) { if (x) stack.push_back(x); };
+    if (auto bin = dynamic_cast<const BinaryExpr *>(e)) {
+        push(bin->right.get());
+        push(bin->left.get());
+    } else if (auto u = dynamic_cast<const UnaryExpr *>(e)) {
+        push(u->right.get());
+    } else if (auto ife = dynamic_cast<const IfExpr *>(e)) {
+        push(ife->elseExpr.get());
+        push(ife->thenExpr.get());
+        push(ife->cond.get());
+    } else if (auto c = dynamic_cast<const CallExpr *>(e)) {
+        for (size_t i = c->args.size(); i-- > 0;) push(c->args[i].get());
+    }
+}
+
+// The same for the slots holding the operands, for passes that replace them.
+inline void push_operand_slots(std::vector<Expr::Ptr *> &stack, Expr *e) {
+    auto push = [&](Expr::Ptr &x) { if (x) stack.push_back(&x); };
+    if (auto bin = dynamic_cast<BinaryExpr *>(e)) {
+        push(bin->right);
+        push(bin->left);
+    } else if (auto u = dynamic_cast<UnaryExpr *>(e)) {
+        push(u->right);
+    } else if (auto ife = dynamic_cast<IfExpr *>(e)) {
+        push(ife->elseExpr);
+        push(ife->thenExpr);
+        push(ife->cond);
+    } else if (auto c = dynamic_cast<CallExpr *>(e)) {
+        for (size_t i = c->args.size(); i-- > 0;) push(c->args[i]);
+    }
+}
+
+// Visits `root` and its subexpressions in evaluation order: enter(e) before
+// the operands of e, which are skipped when it returns false, and leave(e)
+// after them (only for nodes whose operands were entered).
+template <class E, class Enter, class Leave>
+void walk_expr(E *root, Enter enter, Leave leave) {
+    std::vector<E *> todo;
+    std::vector<std::pair<E *, size_t>> open; // entered, with the size of todo after its operands
+    if (root) todo.push_back(root);
+    while (!todo.empty() || !open.empty()) {
+        if (!open.empty() && open.back().second == todo.size()) {
+            E *done = open.back().first;
+            open.pop_back();
+            leave(done);
+            continue;
+        }
+        E *e = todo.back();
+        todo.pop_back();
+        if (!enter(e)) continue;
+        size_t base = todo.size();
+        push_operands(todo, e);
+        open.push_back({e, base});
+    }
+}
+
+template <class E, class Enter>
+void walk_expr(E *root, Enter enter) {
+    walk_expr(root, enter, [](E *) {});
+}
+
 
 
 struct WhileStmt : Stmt {
     Expr::Ptr cond;
     std::unique_ptr<BlockStmt> body;
+    ProfileSite profile;
     WhileStmt(Expr::Ptr c, std::unique_ptr<BlockStmt> b): cond(std::move(c)), body(std::move(b)) {}
     void pretty_print(int indent = 0) const override {
         indentPrint(indent); std::cout << "While\n";
@@ -177,6 +297,7 @@ struct FunctionDecl : Stmt {
     std::vector<std::pair<std::string,std::string>> params; // (name, typename optional)
     std::string returnType; // optional
     std::unique_ptr<BlockStmt> body;
+    ProfileSite profile;
     FunctionDecl(std::string n, std::vector<std::pair<std::string,std::string>> p, std::string r, std::unique_ptr<BlockStmt> b)
         : name(std::move(n)), params(std::move(p)), returnType(std::move(r)), body(std::move(b)) {}
     void pretty_print(int indent = 0) const override {
@@ -1,18 +1,53 @@
 #include "codegen.h"
+#include "assembler.h"
+#include "frame.h"
+#include "globals.h"
+#include "peephole.h"
+#include "runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <iostream>
-
-static int label_count = 0;
-static std::string gen_label(const std::string &base) { return base + "_" + std::to_string(label_count++); }
+#include <thread>
 
 std::string CodeGenContext::add_string(const std::string &s)
 {
+    if (module_strings)
+    {
+        auto it = module_strings->find(s);
+        if (it != module_strings->end())
+            return it->second;
+    }
     if (string_labels.count(s) == 0)
         string_labels[s] = "str_" + std::to_string(string_labels.size());
     return string_labels[s];
 }
 
+std::string CodeGenContext::local_operand(const std::string &name) const
+{
+    auto reg = register_locals.find(name);
+    if (reg != register_locals.end())
+        return reg->second;
+    if (globals && globals->count(name) &&
+        std::none_of(envStack.begin(), envStack.end(), [&](const std::unordered_map<std::string, int> &scope)
+                     { return scope.count(name) > 0; }))
+        return "[rel " + global_label(name) + "]";
+    int off = lookupLocal(name);
+    std::string s;
+    if (!leaf_frame)
+    {
+        s = "[rbp-";
+        append_decimal(s, static_cast<long long>(off));
+        return s + "]";
+    }
+    int disp = push_depth - red_zone_base - off;
+    s = disp < 0 ? "[rsp-" : "[rsp+";
+    append_decimal(s, static_cast<long long>(disp < 0 ? -disp : disp));
+    return s + "]";
+}
+
 std::string escape_string(const std::string &input)
 {
     std::string output;
@@ -51,7 +86,7 @@ std::string escape_string(const std::string &input)
 }
 
 // ---------------- Data Section ----------------
-static void write_data_section(std::ofstream &out, CodeGenContext &ctx)
+static void write_data_section(AsmStream &out, CodeGenContext &ctx)
 {
     out << "section .data\n";
     for (auto &p : ctx.string_labels)
@@ -64,17 +99,204 @@ static void write_data_section(std::ofstream &out, CodeGenContext &ctx)
         }
         out << "0\n"; // optional trailing newline and null terminator
     }
+}
+
+// Globals (globals.h), at the start of their sections so the quadwords are
+// aligned: the ones with a nonzero value from .data, the rest zero-filled in
+// .bss
+static void write_globals(AsmStream &out, const std::vector<const Stmt *> &stmts)
+{
+    std::vector<std::pair<std::string, std::string>> data;
+    std::vector<std::string> bss;
+    for (auto stmt : stmts)
+        if (auto l = dynamic_cast<const LetStmt *>(stmt))
+        {
+            // bake_globals writes the values in decimal
+            auto n = dynamic_cast<const NumberLiteral *>(l->init.get());
+            if (n && n->value != "0")
+                data.push_back({l->name, n->value});
+            else
+                bss.push_back(l->name);
+        }
+    if (!data.empty())
+    {
+        out << "section .data\n";
+        for (auto &d : data)
+            out << global_label(d.first) << ": dq " << d.second << "\n";
+    }
+    if (!bss.empty())
+    {
+        out << "section .bss\n";
+        for (auto &name : bss)
+            out << global_label(name) << ": resq 1\n";
+    }
+}
 
-    out << "section .bss\n";
-    out << "num_buf: resb 20\n";
+// --profile-generate: the block zinc_profile_dump writes (profile.h)
+static void write_profile_data(AsmStream &out, const ProfileInstrumentation &profile)
+{
+    out << "zinc_profile_path: db ";
+    for (char c : profile.path)
+        out << (int)(unsigned char)c << ",";
+    out << "0\n";
+    out << "align 8\n";
+    out << "zinc_profile: db 90,73,78,67,80,82,70,49\n"; // "ZINCPRF1"
+    out << "    dq " << profile.checksum << "," << profile.counters << "\n";
+    for (int i = 0; i < profile.counters; i += 16)
+    {
+        out << "    dq 0";
+        for (int j = i + 1; j < i + 16 && j < profile.counters; ++j)
+            out << ",0";
+        out << "\n";
+    }
 }
 
 // Forward declarations
-void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx);
-void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx);
+void gen_expr(AsmStream &out, const Expr *expr, CodeGenContext &ctx);
+void gen_stmt(AsmStream &out, const Stmt *stmt, CodeGenContext &ctx);
+
+// ---------------- Profile ----------------
+
+// --profile-generate: bump counter `which` of a site (0: count, 1: taken)
+static void count_site(AsmStream &out, const CodeGenContext &ctx, const ProfileSite &p, int which = 0)
+{
+    if (ctx.profile_counters && p.site >= 0)
+        out << "    inc qword [rel zinc_profile+" << 8 * (3 + p.site + which) << "]\n";
+}
+
+// `label:`, the code `gen` writes, `jmp back`, placed after the function's
+// code so the likely path falls through without jumping over it, or in
+// .text.cold when `cold`
+template <class Gen>
+static void gen_out_of_line(CodeGenContext &ctx, const std::string &label, const std::string &back, Gen gen,
+                            bool cold)
+{
+    AsmStream block;
+    block << label << ":\n";
+    gen(block);
+    block << "    jmp " << back << "\n";
+    AsmStream &to = cold ? ctx.cold : ctx.out_of_line;
+    to.lines.insert(to.lines.end(), std::make_move_iterator(block.lines.begin()),
+                    std::make_move_iterator(block.lines.end()));
+}
+
+// code that rarely or never runs, kept off the pages and cache lines of the
+// rest (ld places it after .text)
+static const char *cold_section = "section .text.cold progbits alloc exec nowrite align=16\n";
 
 // ---------------- Expression Generation ----------------
-void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx)
+
+// rax = rax op rbx, for the operator of `bin`
+static void gen_binary_op(AsmStream &out, const BinaryExpr *bin, CodeGenContext &ctx)
+{
+    if (bin->op == "+")
+        out << "    add rax,rbx\n";
+    else if (bin->op == "-")
+        out << "    sub rax,rbx\n";
+    else if (bin->op == "*")
+        out << "    imul rax,rbx\n";
+    else if (bin->op == "%")
+        out << "    cqo\n    idiv rbx\n    mov rax,rdx\n";
+    else if (bin->op == "/")
+        out << "    cqo\n    idiv rbx\n"; // result in RAX
+
+    else if (bin->op == "=")
+    {
+        if (auto idl = dynamic_cast<const Identifier *>(bin->left.get()))
+        {
+            out << "    mov " << ctx.local_operand(idl->name) << ",rbx\n";
+            out << "    mov rax,rbx\n";
+        }
+    }
+    // Comparison (sets 0 or 1 in rax)
+    else if (bin->op == "==")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    sete al\n";
+        out << "    movzx rax,al\n";
+    }
+    else if (bin->op == "!=")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    setne al\n";
+        out << "    movzx rax,al\n";
+    }
+    else if (bin->op == "<")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    setl al\n";
+        out << "    movzx rax,al\n";
+    }
+    else if (bin->op == "<=")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    setle al\n";
+        out << "    movzx rax,al\n";
+    }
+    else if (bin->op == ">")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    setg al\n";
+        out << "    movzx rax,al\n";
+    }
+    else if (bin->op == ">=")
+    {
+        out << "    cmp rax,rbx\n";
+        out << "    setge al\n";
+        out << "    movzx rax,al\n";
+    }
+
+    // Logical (assume non-zero = true)
+    else if (bin->op == "&&")
+    {
+        std::string label_false = ctx.new_label("and_false");
+        std::string label_end = ctx.new_label("and_end");
+        out << "    cmp rax,0\n";
+        out << "    je " << label_false << "\n";
+        out << "    cmp rbx,0\n";
+        out << "    je " << label_false << "\n";
+        out << "    mov rax,1\n";
+        out << "    jmp " << label_end << "\n";
+        out << label_false << ":\n";
+        out << "    xor rax,rax\n";
+        out << label_end << ":\n";
+    }
+    else if (bin->op == "||")
+    {
+        std::string label_true = ctx.new_label("or_true");
+        std::string label_end = ctx.new_label("or_end");
+        out << "    cmp rax,0\n";
+        out << "    jne " << label_true << "\n";
+        out << "    cmp rbx,0\n";
+        out << "    jne " << label_true << "\n";
+        out << "    xor rax,rax\n";
+        out << "    jmp " << label_end << "\n";
+        out << label_true << ":\n";
+        out << "    mov rax,1\n";
+        out << label_end << ":\n";
+    }
+
+    // Bitwise
+    else if (bin->op == "&")
+        out << "    and rax,rbx\n";
+    else if (bin->op == "|")
+        out << "    or rax,rbx\n";
+    else if (bin->op == "^")
+        out << "    xor rax,rbx\n";
+    else if (bin->op == "<<")
+    {
+        out << "    mov cl, bl\n"; // Move lower 8 bits of rbx into cl (shift count)
+        out << "    shl rax, cl\n";
+    }
+    else if (bin->op == ">>")
+    {
+        out << "    mov cl, bl\n";
+        out << "    shr rax, cl\n";
+    }
+}
+
+// rax = value of `expr`, which is not a binary expression
+static void gen_operand(AsmStream &out, const Expr *expr, CodeGenContext &ctx)
 {
     if (auto n = dynamic_cast<const NumberLiteral *>(expr))
     {
@@ -85,8 +307,7 @@ void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx)
         // Prefer codegen env lookup; fall back to semantic symbol's stackOffset
         try
         {
-            int off = ctx.lookupLocal(id->name);
-            out << "    mov rax,[rbp-" << off << "]\n";
+            out << "    mov rax," << ctx.local_operand(id->name) << "\n";
         }
         catch (...)
         {
@@ -101,134 +322,46 @@ void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx)
         }
     }
 
-    else if (auto bin = dynamic_cast<const BinaryExpr *>(expr))
+    else if (auto ife = dynamic_cast<const IfExpr *>(expr))
     {
-        gen_expr(out, bin->left.get(), ctx);
-        out << "    push rax\n";
-        gen_expr(out, bin->right.get(), ctx);
-        out << "    mov rbx,rax\n    pop rax\n";
-        if (bin->op == "+")
-            out << "    add rax,rbx\n";
-        else if (bin->op == "-")
-            out << "    sub rax,rbx\n";
-        else if (bin->op == "*")
-            out << "    imul rax,rbx\n";
-        else if (bin->op == "%")
-            out << "    cqo\n    idiv rbx\n    mov rax,rdx\n";
-        else if (bin->op == "/")
-            out << "    cqo\n    idiv rbx\n"; // result in RAX
-
-        else if (bin->op == "=")
-        {
-            if (auto idl = dynamic_cast<const Identifier *>(bin->left.get()))
-            {
-                out << "    mov [rbp-" << ctx.locals[idl->name] << "],rbx\n";
-                out << "    mov rax,rbx\n";
-            }
-        }
-        // Comparison (sets 0 or 1 in rax)
-        else if (bin->op == "==")
-        {
-            out << "    cmp rax,rbx\n";
-            out << "    sete al\n";
-            out << "    movzx rax,al\n";
-        }
-        else if (bin->op == "!=")
-        {
-            out << "    cmp rax,rbx\n";
-            out << "    setne al\n";
-            out << "    movzx rax,al\n";
-        }
-        else if (bin->op == "<")
-        {
-            out << "    cmp rax,rbx\n";
-            out << "    setl al\n";
-            out << "    movzx rax,al\n";
-        }
-        else if (bin->op == "<=")
+        std::string elseLabel = ctx.new_label("else");
+        std::string endLabel = ctx.new_label("ifend");
+        const ProfileSite &p = ife->profile;
+        auto gen_then = [&](AsmStream &to)
         {
-            out << "    cmp rax,rbx\n";
-            out << "    setle al\n";
-            out << "    movzx rax,al\n";
-        }
-        else if (bin->op == ">")
-        {
-            out << "    cmp rax,rbx\n";
-            out << "    setg al\n";
-            out << "    movzx rax,al\n";
-        }
-        else if (bin->op == ">=")
-        {
-            out << "    cmp rax,rbx\n";
-            out << "    setge al\n";
-            out << "    movzx rax,al\n";
-        }
+            count_site(to, ctx, p, 1);
+            gen_expr(to, ife->thenExpr.get(), ctx); // result in rax
+        };
+        auto gen_else = [&](AsmStream &to) { gen_expr(to, ife->elseExpr.get(), ctx); };
 
-        // Logical (assume non-zero = true)
-        else if (bin->op == "&&")
-        {
-            std::string label_false = gen_label("and_false");
-            std::string label_end = gen_label("and_end");
-            out << "    cmp rax,0\n";
-            out << "    je " << label_false << "\n";
-            out << "    cmp rbx,0\n";
-            out << "    je " << label_false << "\n";
-            out << "    mov rax,1\n";
-            out << "    jmp " << label_end << "\n";
-            out << label_false << ":\n";
-            out << "    xor rax,rax\n";
-            out << label_end << ":\n";
-        }
-        else if (bin->op == "||")
+        count_site(out, ctx, p);
+        gen_expr(out, ife->cond.get(), ctx); // result in rax
+        out << "    cmp rax, 0\n";
+        if (p.taken * 2 < p.count) // counted or estimated: then is the unlikely side
         {
-            std::string label_true = gen_label("or_true");
-            std::string label_end = gen_label("or_end");
-            out << "    cmp rax,0\n";
-            out << "    jne " << label_true << "\n";
-            out << "    cmp rbx,0\n";
-            out << "    jne " << label_true << "\n";
-            out << "    xor rax,rax\n";
-            out << "    jmp " << label_end << "\n";
-            out << label_true << ":\n";
-            out << "    mov rax,1\n";
-            out << label_end << ":\n";
+            std::string thenLabel = ctx.new_label("then");
+            out << "    jne " << thenLabel << "\n";
+            gen_else(out);
+            out << endLabel << ":\n";
+            gen_out_of_line(ctx, thenLabel, endLabel, gen_then, p.cold);
         }
-
-        // Bitwise
-        else if (bin->op == "&")
-            out << "    and rax,rbx\n";
-        else if (bin->op == "|")
-            out << "    or rax,rbx\n";
-        else if (bin->op == "^")
-            out << "    xor rax,rbx\n";
-        else if (bin->op == "<<")
+        else if (p.taken * 2 > p.count) // counted or estimated: else is the unlikely side
         {
-            out << "    mov cl, bl\n"; // Move lower 8 bits of rbx into cl (shift count)
-            out << "    shl rax, cl\n";
+            out << "    je " << elseLabel << "\n";
+            gen_then(out);
+            out << endLabel << ":\n";
+            gen_out_of_line(ctx, elseLabel, endLabel, gen_else, p.cold);
         }
-        else if (bin->op == ">>")
+        else
         {
-            out << "    mov cl, bl\n";
-            out << "    shr rax, cl\n";
+            out << "    je " << elseLabel << "\n";
+            gen_then(out);
+            out << "    jmp " << endLabel << "\n";
+            out << elseLabel << ":\n";
+            gen_else(out);
+            out << endLabel << ":\n";
         }
     }
-    else if (auto ife = dynamic_cast<const IfExpr *>(expr))
-    {
-        std::string elseLabel = gen_label("else");
-        std::string endLabel = gen_label("ifend");
-
-        gen_expr(out, ife->cond.get(), ctx); // result in rax
-        out << "    cmp rax, 0\n";
-        out << "    je ." << elseLabel << "\n";
-
-        gen_expr(out, ife->thenExpr.get(), ctx); // result in rax
-        out << "    jmp ." << endLabel << "\n";
-
-        out << "." << elseLabel << ":\n";
-        gen_expr(out, ife->elseExpr.get(), ctx); // result in rax
-
-        out << "." << endLabel << ":\n";
-    }
 
     else if (auto c = dynamic_cast<const CallExpr *>(expr))
     {
@@ -244,54 +377,17 @@ void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx)
                     if (auto sl = dynamic_cast<const StringLiteral *>(arg.get()))
                     {
                         std::string lbl = ctx.add_string(sl->value);
-                        out << "    mov rax, 1\n";
-                        out << "    mov rdi, 1\n";
                         out << "    lea rsi, [rel " << lbl << "]\n";
-                        out << "    mov rdx, " << sl->value.size() << "\n";
-                        out << "    syscall\n";
-
-                        out << "    add r12, rdx\n";
+                        out << "    mov rdx, " << escape_string(sl->value).size() << "\n";
+                        out << "    call " << ctx.use_runtime("zinc_print_str") << "\n";
                     }
                     else
                     {
                         gen_expr(out, arg.get(), ctx); // result in rax
-                        out << "    mov rbx, rax\n";
-                        out << "    lea rdi, [rel num_buf+19]\n";
-
-                        std::string label = gen_label("conv");
-
-                        // Special case for zero
-                        out << "    cmp rbx, 0\n";
-                        out << "    jne ." << label << "_start\n";
-                        out << "    dec rdi\n";
-                        out << "    mov byte [rdi], '0'\n";
-                        out << "    mov r8, rdi\n";
-                        out << "    jmp ." << label << "_done\n";
-
-                        out << "." << label << "_start:\n";
-                        out << "    mov r8, rdi\n";
-                        out << "." << label << "_loop:\n";
-                        out << "    xor rdx, rdx\n";
-                        out << "    mov rax, rbx\n";
-                        out << "    mov rcx, 10\n";
-                        out << "    div rcx\n";
-                        out << "    add dl, '0'\n";
-                        out << "    dec rdi\n";
-                        out << "    mov [rdi], dl\n";
-                        out << "    mov rbx, rax\n";
-                        out << "    test rax, rax\n";
-                        out << "    jnz ." << label << "_loop\n";
-
-                        out << "." << label << "_done:\n";
-                        out << "    mov rsi, rdi\n";
-                        out << "    mov rdx, r8\n";
-                        out << "    sub rdx, rdi\n";
-                        out << "    mov rax, 1\n";
-                        out << "    mov rdi, 1\n";
-                        out << "    syscall\n";
-
-                        out << "    add r12, rdx\n";
+                        out << "    mov rdi, rax\n";
+                        out << "    call " << ctx.use_runtime("zinc_print_int") << "\n";
                     }
+                    out << "    add r12, rax\n";
                 }
 
                 out << "    mov rax, r12\n"; // total printed
@@ -299,54 +395,147 @@ void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx)
             }
             else if (idc->name == "scan")
             {
-                out << "    mov rax, 0\n";
-                out << "    mov rdi, 0\n";
-                out << "    lea rsi, [rel input_buf]\n";
-                out << "    mov rdx, 32\n";
-                out << "    syscall\n";
-
-                out << "    mov rcx, 0\n";         // accumulator
-                out << "    mov rsi, input_buf\n"; // pointer to buffer
-                out << "    mov rdx, rax\n";       // bytes read
-
-                std::string loopLabel = gen_label("scan_loop");
-                std::string doneLabel = gen_label("scan_done");
-
-                out << loopLabel << ":\n";
-                out << "    cmp rdx, 0\n";
-                out << "    je " << doneLabel << "\n";
-                out << "    mov al, byte [rsi]\n";
-                out << "    cmp al, '0'\n";
-                out << "    jl skip_char_" << loopLabel << "\n";
-                out << "    cmp al, '9'\n";
-                out << "    jg skip_char_" << loopLabel << "\n";
-                out << "    sub al, '0'\n";
-                out << "    imul rcx, rcx, 10\n";
-                out << "    add rcx, rax\n";
-                out << "skip_char_" << loopLabel << ":\n";
-                out << "    inc rsi\n";
-                out << "    dec rdx\n";
-                out << "    jmp " << loopLabel << "\n";
-                out << doneLabel << ":\n";
-                out << "    mov rax, rcx\n"; // integer return in rax
+                out << "    call " << ctx.use_runtime("zinc_scan_int") << "\n"; // integer return in rax
             }
 
             else
             {
-                static const std::string regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-                for (size_t i = 0; i < c->args.size(); ++i)
+                const RegisterUsage &usage = *ctx.registers;
+                size_t n = c->args.size();
+                if (n > usage.max_args())
+                    throw std::runtime_error("call to " + idc->name + ": more than " +
+                                             std::to_string(usage.max_args()) + " arguments");
+                // an argument goes straight into its register unless a later
+                // one writes that register; those wait on the stack
+                std::vector<char> spill(n);
+                RegMask later = 0;
+                for (size_t i = n; i-- > 0;)
+                {
+                    spill[i] = (later & reg_bit(internal_arg_regs[i])) != 0;
+                    later |= usage.expr_writes(c->args[i].get());
+                }
+                for (size_t i = 0; i < n; ++i)
                 {
                     gen_expr(out, c->args[i].get(), ctx);
-                    out << "    mov " << regs[i] << ",rax\n";
+                    if (spill[i])
+                    {
+                        out << "    push rax\n";
+                        ctx.pushed(8);
+                    }
+                    else
+                        out << "    mov " << internal_arg_regs[i] << ",rax\n";
                 }
+                for (size_t i = n; i-- > 0;)
+                    if (spill[i])
+                    {
+                        out << "    pop " << internal_arg_regs[i] << "\n";
+                        ctx.pushed(-8);
+                    }
+                count_site(out, ctx, c->profile);
                 out << "    call " << idc->name << "\n";
             }
         }
     }
 }
 
+// rax = value of `expr`. A binary expression is its left operand, push rax,
+// its right operand, mov rbx,rax / pop rax and the operator. Chains of them
+// are walked with an explicit stack: only if-expressions and calls recurse.
+void gen_expr(AsmStream &out, const Expr *expr, CodeGenContext &ctx)
+{
+    std::vector<std::pair<const BinaryExpr *, bool>> pending; // true once the right operand is under way
+    const Expr *e = expr;
+    while (true)
+    {
+        while (auto bin = dynamic_cast<const BinaryExpr *>(e))
+        {
+            pending.push_back({bin, false});
+            e = bin->left.get();
+        }
+        gen_operand(out, e, ctx);
+        while (!pending.empty() && pending.back().second)
+        {
+            out << "    mov rbx,rax\n    pop rax\n";
+            ctx.pushed(-8);
+            gen_binary_op(out, pending.back().first, ctx);
+            pending.pop_back();
+        }
+        if (pending.empty())
+            return;
+        out << "    push rax\n";
+        ctx.pushed(8);
+        pending.back().second = true;
+        e = pending.back().first->right.get();
+    }
+}
+
+// ---------------- Leaf functions ----------------
+// What the leaf-frame layout needs to know about a body: whether it calls
+// anything and how deep the push rax / pop rax pairs of binary expressions
+// nest.
+struct LeafInfo {
+    int max_push = 0; // bytes
+};
+
+// false if `expr` contains a call; the right operand of a binary expression
+// runs 8 bytes deeper than the expression
+static bool scan_leaf_expr(const Expr *expr, LeafInfo &info)
+{
+    std::vector<std::pair<const Expr *, int>> todo; // subexpression, bytes pushed around it
+    if (expr)
+        todo.push_back({expr, 0});
+    while (!todo.empty())
+    {
+        const Expr *e = todo.back().first;
+        int depth = todo.back().second;
+        todo.pop_back();
+        if (dynamic_cast<const CallExpr *>(e))
+            return false;
+        if (auto bin = dynamic_cast<const BinaryExpr *>(e))
+        {
+            info.max_push = std::max(info.max_push, depth + 8);
+            todo.push_back({bin->right.get(), depth + 8});
+            todo.push_back({bin->left.get(), depth});
+        }
+        else if (auto ife = dynamic_cast<const IfExpr *>(e))
+        {
+            todo.push_back({ife->elseExpr.get(), depth});
+            todo.push_back({ife->thenExpr.get(), depth});
+            todo.push_back({ife->cond.get(), depth});
+        }
+        else if (auto u = dynamic_cast<const UnaryExpr *>(e))
+            todo.push_back({u->right.get(), depth});
+    }
+    return true;
+}
+
+static bool scan_leaf(const Stmt *stmt, LeafInfo &info)
+{
+    if (!stmt)
+        return true;
+    if (auto b = dynamic_cast<const BlockStmt *>(stmt))
+    {
+        for (auto &s : b->stmts)
+            if (!scan_leaf(s.get(), info))
+                return false;
+        return true;
+    }
+    if (auto l = dynamic_cast<const LetStmt *>(stmt))
+        return scan_leaf_expr(l->init.get(), info);
+    if (auto e = dynamic_cast<const ExprStmt *>(stmt))
+        return scan_leaf_expr(e->expr.get(), info);
+    if (auto r = dynamic_cast<const ReturnStmt *>(stmt))
+        return scan_leaf_expr(r->value.get(), info);
+    if (auto i = dynamic_cast<const IfStmt *>(stmt))
+        return scan_leaf_expr(i->cond.get(), info) && scan_leaf(i->thenBranch.get(), info) &&
+               scan_leaf(i->elseBranch.get(), info);
+    if (auto w = dynamic_cast<const WhileStmt *>(stmt))
+        return scan_leaf_expr(w->cond.get(), info) && scan_leaf(w->body.get(), info);
+    return false;
+}
+
 // ---------------- Statement Generation ----------------
-void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx)
+void gen_stmt(AsmStream &out, const Stmt *stmt, CodeGenContext &ctx)
 {
     if (auto f = dynamic_cast<const FunctionDecl *>(stmt))
     {
@@ -354,72 +543,83 @@ void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx)
         ctx.envStack.clear();
         ctx.envStack.emplace_back();
         ctx.stack_offset = 0;
+        ctx.label_prefix = f->name + ".";
+        ctx.label_count = 0;
 
-        // allocate params first (so params are at lower offsets)
-        static const std::string regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-        for (size_t i = 0; i < f->params.size(); ++i)
-        {
-            int off = ctx.allocateLocal(f->params[i].first);
-            // we don't emit mov regs->stack until after prologue below
-        }
+        ctx.register_locals.clear();
+        ctx.push_depth = ctx.max_push_depth = 0;
 
-        // Pre-scan function body for let-decls (recursively) and allocate offsets
-        std::function<void(const Stmt *)> preScan = [&](const Stmt *s)
-        {
-            if (!s)
-                return;
-            if (auto b = dynamic_cast<const BlockStmt *>(s))
-            {
-                for (auto &st : b->stmts)
-                    preScan(st.get());
-            }
-            else if (auto l = dynamic_cast<const LetStmt *>(s))
-            {
-                ctx.allocateLocal(l->name);
-            }
-            else if (auto iff = dynamic_cast<const IfStmt *>(s))
-            {
-                preScan(iff->thenBranch.get());
-                if (iff->elseBranch)
-                    preScan(iff->elseBranch.get());
-            }
-            else if (auto wh = dynamic_cast<const WhileStmt *>(s))
-            {
-                preScan(wh->body.get());
-            }
-            else if (auto fn = dynamic_cast<const FunctionDecl *>(s))
+        // parameters stay in their argument registers unless the body writes
+        // them (calls, idiv's rdx, shift counts in rcx; ipra.h)
+        const RegisterUsage &usage = *ctx.registers;
+        if (f->params.size() > usage.max_args())
+            throw std::runtime_error("function " + f->name + ": more than " + std::to_string(usage.max_args()) +
+                                     " parameters");
+        RegMask written = usage.body_writes(*f);
+        std::set<std::string> in_registers;
+        for (size_t i = 0; i < f->params.size(); ++i)
+            if (!(written & reg_bit(internal_arg_regs[i])))
             {
-                // nested function: don't include its locals in parent function frame
+                ctx.register_locals[f->params[i].first] = internal_arg_regs[i];
+                in_registers.insert(f->params[i].first);
             }
-        };
 
-        if (auto b = dynamic_cast<const BlockStmt *>(f->body.get()))
-            preScan(b);
+        // slots for params and lets; names that are never live at the same
+        // time may share one (frame.h)
+        FrameLayout frame = layout_frame(*f, ctx.slot_coloring, in_registers);
+
+        // A leaf (no calls, not even to the runtime) needs no frame pointer
+        // when its slots fit in the red zone under the deepest push.
+        LeafInfo leaf;
+        ctx.leaf_frame = ctx.omit_leaf_frames && scan_leaf(f->body.get(), leaf) && frame.size + leaf.max_push <= 128;
+        ctx.red_zone_base = leaf.max_push;
+        ctx.envStack.back().insert(frame.offsets.begin(), frame.offsets.end());
+        ctx.stack_offset = frame.size;
+        ctx.frame_sizes.push_back({f->name, frame.uncolored_size, frame.size});
 
         // emit label / prologue
+        if (f->profile.cold)
+            out << cold_section;
         out << f->name << ":\n";
-        out << "    push rbp\n    mov rbp,rsp\n";
-        out << "    sub rsp," << ctx.stack_offset << "\n";
+        if (!ctx.leaf_frame)
+        {
+            out << "    push rbp\n    mov rbp,rsp\n";
+            out << "    sub rsp," << ctx.stack_offset << "\n";
+        }
 
         // now move parameters to their allocated stack slots
         for (size_t i = 0; i < f->params.size(); ++i)
         {
-            int off;
+            std::string slot;
             try
             {
-                off = ctx.lookupLocal(f->params[i].first);
+                slot = ctx.local_operand(f->params[i].first);
             }
             catch (...)
             {
                 continue;
             }
-            out << "    mov [rbp-" << off << "]," << regs[i] << "\n";
+            if (slot != internal_arg_regs[i])
+                out << "    mov " << slot << "," << internal_arg_regs[i] << "\n";
         }
+        count_site(out, ctx, f->profile);
 
         // generate body
         gen_stmt(out, f->body.get(), ctx);
+        if (ctx.leaf_frame && ctx.max_push_depth > ctx.red_zone_base)
+            throw std::runtime_error("internal: push depth of " + f->name + " underestimated");
 
-        out << "    leave\n    ret\n";
+        out << (ctx.leaf_frame ? "    ret\n" : "    leave\n    ret\n");
+        out.lines.insert(out.lines.end(), std::make_move_iterator(ctx.out_of_line.lines.begin()),
+                         std::make_move_iterator(ctx.out_of_line.lines.end()));
+        ctx.out_of_line.lines.clear();
+        if (!ctx.cold.lines.empty() && !f->profile.cold)
+            out << cold_section;
+        out.lines.insert(out.lines.end(), std::make_move_iterator(ctx.cold.lines.begin()),
+                         std::make_move_iterator(ctx.cold.lines.end()));
+        if (f->profile.cold || !ctx.cold.lines.empty())
+            out << "section .text\n";
+        ctx.cold.lines.clear();
     }
 
     else if (auto b = dynamic_cast<const BlockStmt *>(stmt))
@@ -430,8 +630,7 @@ void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx)
         if (l->init)
         {
             gen_expr(out, l->init.get(), ctx);
-            int off = ctx.lookupLocal(l->name);
-            out << "    mov [rbp-" << off << "],rax\n";
+            out << "    mov " << ctx.local_operand(l->name) << ",rax\n";
         }
     }
 
@@ -439,36 +638,87 @@ void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx)
     {
         if (r->value)
             gen_expr(out, r->value.get(), ctx);
-        out << "    leave\n    ret\n";
+        out << (ctx.leaf_frame ? "    ret\n" : "    leave\n    ret\n");
     }
     else if (auto e = dynamic_cast<const ExprStmt *>(stmt))
         gen_expr(out, e->expr.get(), ctx);
 
     else if (auto i = dynamic_cast<const IfStmt *>(stmt))
     {
-        std::string label_else = gen_label("else");
-        std::string label_end = gen_label("ifend");
+        std::string label_else = ctx.new_label("else");
+        std::string label_end = ctx.new_label("ifend");
+        const ProfileSite &p = i->profile;
+        auto gen_then = [&](AsmStream &to)
+        {
+            count_site(to, ctx, p, 1);
+            gen_stmt(to, i->thenBranch.get(), ctx);
+        };
+        auto gen_else = [&](AsmStream &to)
+        {
+            // Else-if can come here if represented similarly in AST
+            if (i->elseBranch)
+                gen_stmt(to, i->elseBranch.get(), ctx);
+        };
 
         // Evaluate the if condition
+        count_site(out, ctx, p);
         gen_expr(out, i->cond.get(), ctx);
         out << "    cmp rax, 0\n";
-        out << "    je " << label_else << "\n";
-        gen_stmt(out, i->thenBranch.get(), ctx);
-        out << "    jmp " << label_end << "\n";
-
-        out << label_else << ":\n";
-        if (i->elseBranch)
+        // with counts (profiled or estimated, optimize.h), the branch taken
+        // less than half the time moves after the function's code, or to
+        // .text.cold, and the other one falls through
+        if (p.taken * 2 < p.count)
         {
-            // Else-if can come here if represented similarly in AST
-            gen_stmt(out, i->elseBranch.get(), ctx);
+            std::string label_then = ctx.new_label("then");
+            out << "    jne " << label_then << "\n";
+            gen_else(out);
+            out << label_end << ":\n";
+            gen_out_of_line(ctx, label_then, label_end, gen_then, p.cold);
+        }
+        else if (p.taken * 2 > p.count && i->elseBranch)
+        {
+            out << "    je " << label_else << "\n";
+            gen_then(out);
+            out << label_end << ":\n";
+            gen_out_of_line(ctx, label_else, label_end, gen_else, p.cold);
+        }
+        else
+        {
+            out << "    je " << label_else << "\n";
+            gen_then(out);
+            out << "    jmp " << label_end << "\n";
+            out << label_else << ":\n";
+            gen_else(out);
+            out << label_end << ":\n";
         }
-        out << label_end << ":\n";
     }
 
     else if (auto w = dynamic_cast<const WhileStmt *>(stmt))
     {
-        std::string label_start = gen_label("while_start");
-        std::string label_end = gen_label("while_end");
+        std::string label_start = ctx.new_label("while_start");
+        std::string label_end = ctx.new_label("while_end");
+        const ProfileSite &p = w->profile;
+        count_site(out, ctx, p);
+
+        // expected to iterate more often than it is entered: test at the
+        // bottom, so each iteration takes one branch instead of two. A loop
+        // averaging 4+ iterations gets its top aligned; the padding sits
+        // behind the jmp and never runs
+        if (p.taken > p.count)
+        {
+            std::string label_test = ctx.new_label("while_test");
+            out << "    jmp " << label_test << "\n";
+            if (p.taken >= 4 * p.count)
+                out << "align 16\n";
+            out << label_start << ":\n";
+            count_site(out, ctx, p, 1);
+            gen_stmt(out, w->body.get(), ctx);
+            out << label_test << ":\n";
+            gen_expr(out, w->cond.get(), ctx);
+            out << "    cmp rax, 0\n";
+            out << "    jne " << label_start << "\n";
+            return;
+        }
 
         out << label_start << ":\n";
 
@@ -478,6 +728,7 @@ void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx)
         out << "    je " << label_end << "\n";
 
         // Generate loop body
+        count_site(out, ctx, p, 1);
         gen_stmt(out, w->body.get(), ctx);
 
         // Jump back to start
@@ -522,60 +773,286 @@ void collect_strings(const Stmt *stmt, CodeGenContext &ctx)
 
 void collect_strings_expr(const Expr *expr, CodeGenContext &ctx)
 {
-    if (!expr)
-        return;
+    // strings in call arguments and binary operands, in source order
+    walk_expr(expr, [&](const Expr *e)
+              {
+                  if (auto sl = dynamic_cast<const StringLiteral *>(e))
+                      ctx.add_string(sl->value);
+                  return dynamic_cast<const CallExpr *>(e) || dynamic_cast<const BinaryExpr *>(e);
+              });
+}
 
-    if (auto c = dynamic_cast<const CallExpr *>(expr))
+static void dump_frame_sizes(std::ostream &os, const std::vector<FrameSize> &sizes)
+{
+    os << "frame sizes (one slot per let -> colored):\n";
+    long before = 0, after = 0;
+    for (auto &s : sizes)
+    {
+        os << "  " << s.function << ": " << s.before << " -> " << s.after << " bytes\n";
+        before += s.before;
+        after += s.after;
+    }
+    os << "  total: " << before << " -> " << after << " bytes\n";
+}
+
+// Run body(0) .. body(n-1) on up to `jobs` threads (0 = one per core).
+// The first exception in index order is rethrown once every task is done.
+static void parallel_for(size_t n, unsigned jobs, const std::function<void(size_t)> &body)
+{
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = static_cast<unsigned>(std::min<size_t>(jobs, n));
+    std::vector<std::exception_ptr> errors(n);
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
     {
-        for (auto &arg : c->args)
+        for (size_t i; (i = next.fetch_add(1)) < n;)
         {
-            if (auto sl = dynamic_cast<const StringLiteral *>(arg.get()))
+            try
             {
-                ctx.add_string(sl->value);
+                body(i);
             }
-            else
+            catch (...)
             {
-                collect_strings_expr(arg.get(), ctx);
+                errors[i] = std::current_exception();
             }
         }
-    }
-    else if (auto bin = dynamic_cast<const BinaryExpr *>(expr))
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < jobs; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+    for (auto &e : errors)
+        if (e)
+            std::rethrow_exception(e);
+}
+
+// ---------------- Whole Program ----------------
+
+// Functions main or zinc$init (globals.h) can reach through calls; all of
+// them when there is no main
+static std::set<std::string> reachable_functions(const std::vector<const Stmt *> &stmts)
+{
+    std::unordered_map<std::string, const FunctionDecl *> by_name;
+    for (auto stmt : stmts)
+        if (auto f = dynamic_cast<const FunctionDecl *>(stmt))
+            by_name[f->name] = f;
+    std::set<std::string> live;
+    if (!by_name.count("main"))
     {
-        collect_strings_expr(bin->left.get(), ctx);
-        collect_strings_expr(bin->right.get(), ctx);
+        for (auto &f : by_name)
+            live.insert(f.first);
+        return live;
     }
-    else if (auto id = dynamic_cast<const Identifier *>(expr))
+    std::vector<std::string> work = {"main", init_function};
+    while (!work.empty())
     {
-        // No strings to collect
+        std::string name = std::move(work.back());
+        work.pop_back();
+        auto it = by_name.find(name);
+        if (it != by_name.end() && live.insert(name).second)
+            collect_calls(it->second->body.get(), work);
     }
-    else if (auto n = dynamic_cast<const NumberLiteral *>(expr))
+    return live;
+}
+
+// `name`'s code with its own name in labels and recursive calls replaced by
+// "@", so functions that differ only in their names compare equal
+static std::string code_key(const std::vector<AsmLine> &lines, const std::string &name)
+{
+    std::string key;
+    auto add = [&](const std::string &s)
     {
-        // No strings to collect
-    }
-    // ✅ Add this block:
-    else if (auto sl = dynamic_cast<const StringLiteral *>(expr))
+        if (s == name)
+            key += '@';
+        else if (s.size() > name.size() && s.compare(0, name.size(), name) == 0 && s[name.size()] == '.')
+            key.append("@").append(s, name.size(), std::string::npos);
+        else
+            key += s;
+    };
+    for (auto &l : lines)
     {
-        ctx.add_string(sl->value);
+        key += static_cast<char>('0' + static_cast<int>(l.kind));
+        add(l.op);
+        for (auto &a : l.args)
+        {
+            key += ',';
+            add(a);
+        }
+        key += '\n';
     }
+    return key;
 }
 
-void gen_program(std::ofstream &out, const std::vector<Stmt::Ptr> &program)
+// One function's code, generated independently of the others
+struct FunctionCode {
+    AsmStream code;
+    std::set<std::string> runtime_used;
+    PeepholeStats stats;
+    std::vector<FrameSize> frame_sizes;
+};
+
+// shared by gen_program and gen_functions; `with_start` adds the _start entry
+static void gen_unit(AsmStream &out, const std::vector<const Stmt *> &stmts, const CodeGenOptions &opts,
+                     bool with_start)
 {
     CodeGenContext ctx;
 
     // Collect all strings from all statements and their expressions, recursively
-    for (auto &stmt : program)
-        collect_strings(stmt.get(), ctx);
+    for (auto stmt : stmts)
+        collect_strings(stmt, ctx);
 
-    write_data_section(out, ctx);
+    // Every function gets its own context, buffer and peephole run, so they
+    // can be generated in parallel; labels are scoped by function name and
+    // the buffers are joined in source order, so the output does not depend
+    // on the number of threads. Besides functions, the top level only has
+    // the declarations of globals (globals.h).
+    //
+    // A whole program leaves out the functions main cannot reach (generated
+    // anyway under --dfe-stats, to count their bytes) and their strings.
+    bool prune = with_start && opts.dead_functions;
+    std::set<std::string> live;
+    if (prune)
+    {
+        live = reachable_functions(stmts);
+        CodeGenContext used;
+        for (auto stmt : stmts)
+        {
+            auto f = dynamic_cast<const FunctionDecl *>(stmt);
+            if (!f || live.count(f->name))
+                collect_strings(stmt, used);
+        }
+        for (auto it = ctx.string_labels.begin(); it != ctx.string_labels.end();)
+            it = used.string_labels.count(it->first) ? std::next(it) : ctx.string_labels.erase(it);
+    }
+    std::vector<const Stmt *> functions;
+    std::vector<const FunctionDecl *> decls;
+    std::vector<bool> dead;
+    std::set<std::string> globals;
+    RuntimeOptions runtime = opts.runtime;
+    for (auto stmt : stmts)
+        if (auto f = dynamic_cast<const FunctionDecl *>(stmt))
+        {
+            functions.push_back(stmt);
+            decls.push_back(f);
+            dead.push_back(prune && !live.count(f->name));
+            runtime.init |= f->name == init_function;
+        }
+        else if (auto l = dynamic_cast<const LetStmt *>(stmt))
+            globals.insert(l->name);
+    RegisterUsage registers(decls, opts.ipra);
+    ctx.registers = &registers;
+    std::vector<FunctionCode> parts(functions.size());
+    parallel_for(functions.size(), opts.jobs,
+                 [&](size_t i)
+                 {
+                     if (dead[i] && !opts.dfe_stats)
+                         return;
+                     CodeGenContext fctx;
+                     fctx.module_strings = &ctx.string_labels;
+                     fctx.slot_coloring = opts.slot_coloring;
+                     fctx.omit_leaf_frames = !opts.keep_frame_pointers;
+                     fctx.registers = &registers;
+                     fctx.globals = &globals;
+                     fctx.profile_counters = !opts.profile.path.empty();
+                     gen_stmt(parts[i].code, functions[i], fctx);
+                     // the runtime is hand-scheduled and returns values outside
+                     // rax, which the peephole pass's model of `ret` does not
+                     // know about, so it is appended after
+                     if (opts.peephole)
+                         peephole_optimize(parts[i].code.lines, parts[i].stats);
+                     parts[i].runtime_used = std::move(fctx.runtime_used);
+                     parts[i].frame_sizes = std::move(fctx.frame_sizes);
+                 });
+
+    // Identical code folding: a function whose code equals an earlier one's
+    // but for its name becomes a second label on that code. Callers assume
+    // only what the folded function's own identical code does (ipra.h), so
+    // this is safe without looking at the call sites.
+    int folded = 0;
+    uint64_t folded_bytes = 0;
+    if (with_start && opts.fold_identical)
+    {
+        std::unordered_map<std::string, size_t> first_with;
+        for (size_t i = 0; i < parts.size(); ++i)
+        {
+            if (dead[i])
+                continue;
+            auto ins = first_with.emplace(code_key(parts[i].code.lines, decls[i]->name), i);
+            if (ins.second)
+                continue;
+            std::vector<AsmLine> &code = parts[ins.first->second].code.lines;
+            const std::string &name = decls[ins.first->second]->name;
+            auto at = std::find_if(code.begin(), code.end(), [&](const AsmLine &l)
+                                   { return l.kind == AsmLine::Kind::Label && l.op == name; });
+            AsmStream alias;
+            alias << decls[i]->name << ":\n";
+            code.insert(at, alias.lines.begin(), alias.lines.end());
+            if (opts.icf_stats)
+                folded_bytes += code_size(parts[i].code.lines);
+            parts[i].code.lines.clear();
+            ++folded;
+        }
+    }
 
-    out << "section .text\n";
-    out << "global _start\n";
+    AsmStream body;
+    PeepholeStats stats;
+    size_t next_function = 0;
+    int dropped = 0;
+    uint64_t dropped_bytes = 0;
+    for (auto stmt : stmts)
+    {
+        if (!dynamic_cast<const FunctionDecl *>(stmt))
+            continue;
+        if (dead[next_function])
+        {
+            ++dropped;
+            if (opts.dfe_stats)
+                dropped_bytes += code_size(parts[next_function].code.lines);
+            ++next_function;
+            continue;
+        }
+        FunctionCode &part = parts[next_function++];
+        body.lines.insert(body.lines.end(), std::make_move_iterator(part.code.lines.begin()),
+                          std::make_move_iterator(part.code.lines.end()));
+        ctx.runtime_used.insert(part.runtime_used.begin(), part.runtime_used.end());
+        stats.merge(part.stats);
+        ctx.frame_sizes.insert(ctx.frame_sizes.end(), part.frame_sizes.begin(), part.frame_sizes.end());
+    }
+    if (opts.peephole && opts.peephole_stats)
+        stats.dump(std::cerr);
+    if (opts.frame_stats)
+        dump_frame_sizes(std::cerr, ctx.frame_sizes);
+    if (prune && opts.dfe_stats)
+        std::cerr << "dfe: " << dropped << " unreachable functions dropped, " << dropped_bytes << " bytes\n";
+    if (with_start && opts.fold_identical && opts.icf_stats)
+        std::cerr << "icf: " << folded << " functions folded into identical ones, " << folded_bytes << " bytes\n";
 
-    out << "_start:\n";
-    out << "    call main\n";
-    out << "    mov rax,60\n    xor rdi,rdi\n    syscall\n";
+    // functions first, so _start knows which runtime pieces are needed
+    write_globals(out, stmts);
+    write_data_section(out, ctx);
+    if (with_start && !opts.profile.path.empty())
+        write_profile_data(out, opts.profile);
+    if (with_start)
+        write_start(out, ctx.runtime_used, runtime);
+    else
+        out << "section .text\n";
+    out.lines.insert(out.lines.end(), std::make_move_iterator(body.lines.begin()),
+                     std::make_move_iterator(body.lines.end()));
+    write_runtime(out, ctx.runtime_used, runtime);
+}
 
+void gen_program(AsmStream &out, const std::vector<Stmt::Ptr> &program, const CodeGenOptions &opts)
+{
+    std::vector<const Stmt *> stmts;
     for (auto &stmt : program)
-        gen_stmt(out, stmt.get(), ctx);
+        stmts.push_back(stmt.get());
+    gen_unit(out, stmts, opts, true);
+}
+
+void gen_functions(AsmStream &out, const std::vector<const FunctionDecl *> &fns, const CodeGenOptions &opts)
+{
+    gen_unit(out, std::vector<const Stmt *>(fns.begin(), fns.end()), opts, false);
 }
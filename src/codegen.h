@@ -5,15 +5,48 @@
 #include <vector>
 #include <memory>
 #include <fstream>
+#include <set>
 #include <unordered_map>
 #include "environment.h"
+#include "asm.h"
+#include "runtime.h"
+#include "ipra.h"
+#include "profile.h"
+
+// frame bytes of one function, before and after slot coloring
+struct FrameSize {
+    std::string function;
+    int before, after;
+};
 
 struct CodeGenContext {
     std::map<std::string, int> locals;
     std::unordered_map<std::string,std::string> string_labels;
+    // module-wide string table, collected before functions are generated
+    const std::unordered_map<std::string,std::string> *module_strings = nullptr;
     std::shared_ptr<Environment> semEnv;          // set by caller (from SemanticAnalyzer)
     std::vector<std::unordered_map<std::string,int>> envStack; // codegen scopes (name -> offset)
     int stack_offset = 0; // total bytes allocated for this function so far
+    std::string label_prefix; // "fname." while generating fname
+    int label_count = 0;      // per function, so functions can be generated independently
+    bool slot_coloring = true;          // share frame slots between non-interfering names
+    bool omit_leaf_frames = true;       // leaf functions skip rbp and keep locals in the red zone
+    const RegisterUsage *registers = nullptr; // clobber sets of the unit's functions (ipra.h)
+    const std::set<std::string> *globals = nullptr; // names not local to a function that are globals (globals.h)
+
+    // Current function's frame. In a leaf frame there is no rbp: locals sit
+    // in the red zone below the entry rsp, under the deepest expression push,
+    // and are addressed from rsp, so push_depth must track every push/pop.
+    bool leaf_frame = false;
+    int red_zone_base = 0;  // bytes between the entry rsp and the first local
+    int push_depth = 0;     // bytes pushed by expression code right now
+    int max_push_depth = 0;
+    std::unordered_map<std::string, std::string> register_locals; // params left in their argument register
+    std::vector<FrameSize> frame_sizes; // one entry per function generated
+    std::set<std::string> runtime_used; // runtime routines called so far
+    bool profile_counters = false;      // bump ProfileSite counters (--profile-generate)
+    AsmStream out_of_line;              // blocks the counts say are unlikely, after the function's code
+    AsmStream cold;                     // blocks marked cold (ProfileSite), for .text.cold
 
     CodeGenContext() { envStack.emplace_back(); }
 
@@ -42,9 +75,49 @@ struct CodeGenContext {
     }
 
     std::string add_string(const std::string &s);
+
+    // operand holding local `name`: a register, [rbp-N], or [rsp+N] in a leaf
+    // frame; [rel zinc_global_name] for a global the function does not shadow
+    std::string local_operand(const std::string &name) const;
+
+    void pushed(int bytes) {
+        push_depth += bytes;
+        if (push_depth > max_push_depth) max_push_depth = push_depth;
+    }
+
+    // fresh label local to the current function: "main.else_3"
+    std::string new_label(const std::string &base) {
+        std::string l = label_prefix + base + "_";
+        append_decimal(l, static_cast<long long>(label_count++));
+        return l;
+    }
+
+    // record that a runtime routine is needed and return its label
+    const std::string &use_runtime(const std::string &name) { return *runtime_used.insert(name).first; }
+};
+
+struct CodeGenOptions {
+    bool peephole = true;        // run the peephole pass over the instruction list
+    bool peephole_stats = false; // print per-rule hit counts to stderr
+    RuntimeOptions runtime;      // how print/scan behave at run time
+    unsigned jobs = 0;           // threads generating functions (0 = one per core)
+    bool slot_coloring = true;   // assign frame slots by liveness (frame.h)
+    bool keep_frame_pointers = false; // rbp frames even in leaf functions (for profilers)
+    bool ipra = true;            // internal calling convention with per-function clobber sets (ipra.h)
+    bool frame_stats = false;    // print per-function frame sizes to stderr
+    bool dead_functions = true;  // leave out functions main cannot reach (whole programs only)
+    bool dfe_stats = false;      // print how many functions and bytes that dropped to stderr
+    bool fold_identical = true;  // merge functions whose code is identical but for the name
+    bool icf_stats = false;      // print how many functions and bytes folding saved to stderr
+    ProfileInstrumentation profile; // --profile-generate: counters and where _start writes them (profile.h)
 };
 
 // Forward declarations
-void gen_expr(std::ofstream &out, const Expr *expr, CodeGenContext &ctx);
-void gen_stmt(std::ofstream &out, const Stmt *stmt, CodeGenContext &ctx);
-void gen_program(std::ofstream &out, const std::vector<Stmt::Ptr> &program);
+void gen_expr(AsmStream &out, const Expr *expr, CodeGenContext &ctx);
+void gen_stmt(AsmStream &out, const Stmt *stmt, CodeGenContext &ctx);
+// whole program: .data, _start, functions, runtime
+void gen_program(AsmStream &out, const std::vector<Stmt::Ptr> &program, const CodeGenOptions &opts = {});
+// only `fns` (and the runtime they use), no _start: code loaded next to a host
+void gen_functions(AsmStream &out, const std::vector<const FunctionDecl *> &fns, const CodeGenOptions &opts);
+// string literal with \n, \t, ... escapes resolved (the bytes print writes)
+std::string escape_string(const std::string &input);
@@ -0,0 +1,300 @@
+#include "elf.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ---------------- ELF64 constants ----------------
+static const uint16_t ET_REL = 1, ET_EXEC = 2;
+static const uint16_t EM_X86_64 = 62;
+static const uint32_t PT_LOAD = 1, PT_GNU_STACK = 0x6474E551;
+static const uint32_t PF_X = 1, PF_W = 2, PF_R = 4;
+static const uint32_t SHT_PROGBITS = 1, SHT_SYMTAB = 2, SHT_STRTAB = 3, SHT_RELA = 4, SHT_NOBITS = 8;
+static const uint64_t SHF_WRITE = 1, SHF_ALLOC = 2, SHF_EXECINSTR = 4, SHF_INFO_LINK = 0x40;
+static const uint8_t STB_LOCAL = 0, STB_GLOBAL = 1;
+static const uint8_t STT_NOTYPE = 0, STT_SECTION = 3;
+static const uint32_t R_X86_64_PC32 = 2;
+
+// section header indices in the object file; the section symbols use the same
+// numbers. Executables have the same first four sections and no .rela.*.
+enum { SEC_NULL, SEC_TEXT, SEC_DATA, SEC_BSS, SEC_RELA_TEXT, SEC_RELA_DATA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB,
+       SEC_COUNT };
+enum { EXE_SYMTAB = SEC_RELA_TEXT, EXE_STRTAB, EXE_SHSTRTAB, EXE_SEC_COUNT };
+
+// static executables are linked at the traditional non-PIE base
+static const uint64_t EXE_BASE = 0x400000;
+static const uint64_t PAGE_SIZE = 0x1000;
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+static int section_index(ObjSectionId id)
+{
+    return id == ObjSectionId::Text ? SEC_TEXT : id == ObjSectionId::Data ? SEC_DATA : SEC_BSS;
+}
+
+// little-endian byte buffer
+struct ElfBuf {
+    std::vector<uint8_t> b;
+
+    void u8(uint8_t v) { b.push_back(v); }
+    void u16(uint16_t v) { put(v, 2); }
+    void u32(uint32_t v) { put(v, 4); }
+    void u64(uint64_t v) { put(v, 8); }
+    void put(uint64_t v, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+    void pad(size_t align)
+    {
+        while (b.size() % align)
+            b.push_back(0);
+    }
+};
+
+// append a NUL-terminated name to a string table, returning its offset
+static uint32_t add_string(ElfBuf &table, const std::string &s)
+{
+    size_t at = table.b.size();
+    table.b.insert(table.b.end(), s.begin(), s.end());
+    table.b.push_back(0);
+    return static_cast<uint32_t>(at);
+}
+
+struct SectionHeader {
+    uint32_t name = 0, type = 0;
+    uint64_t flags = 0, addr = 0, offset = 0, size = 0;
+    uint32_t link = 0, info = 0;
+    uint64_t addralign = 0, entsize = 0;
+};
+
+// Section table under construction: contents are appended to `file` and the
+// matching header is filled in as they are placed.
+struct SectionTable {
+    ElfBuf file;
+    ElfBuf shstrtab;
+    std::vector<SectionHeader> sh;
+
+    explicit SectionTable(size_t count) : sh(count)
+    {
+        shstrtab.u8(0);
+    }
+
+    SectionHeader &add(int s, const char *name, uint32_t type, uint64_t flags, uint64_t align)
+    {
+        sh[s].name = add_string(shstrtab, name);
+        sh[s].type = type;
+        sh[s].flags = flags;
+        sh[s].addralign = align;
+        return sh[s];
+    }
+    // copy `bytes` into the file at the next `align` boundary
+    SectionHeader &place(int s, const char *name, uint32_t type, uint64_t flags, uint64_t align,
+                         const std::vector<uint8_t> &bytes)
+    {
+        file.pad(align);
+        SectionHeader &h = add(s, name, type, flags, align);
+        h.offset = file.b.size();
+        h.size = bytes.size();
+        file.b.insert(file.b.end(), bytes.begin(), bytes.end());
+        return h;
+    }
+    // append the section header table, returning its file offset
+    uint64_t write_headers()
+    {
+        file.pad(8);
+        uint64_t shoff = file.b.size();
+        for (auto &h : sh)
+        {
+            file.u32(h.name);
+            file.u32(h.type);
+            file.u64(h.flags);
+            file.u64(h.addr);
+            file.u64(h.offset);
+            file.u64(h.size);
+            file.u32(h.link);
+            file.u32(h.info);
+            file.u64(h.addralign);
+            file.u64(h.entsize);
+        }
+        return shoff;
+    }
+};
+
+static void put_symbol(ElfBuf &out, uint32_t name, uint8_t bind, uint8_t type, uint16_t shndx, uint64_t value)
+{
+    out.u32(name);
+    out.u8(static_cast<uint8_t>(bind << 4 | type));
+    out.u8(0); // st_other: default visibility
+    out.u16(shndx);
+    out.u64(value);
+    out.u64(0); // st_size
+}
+
+// null, one symbol per section, locals, then globals (ELF wants locals first).
+// `base` is the address of .text/.data/.bss (0 in relocatable objects).
+// Returns the index of the first global symbol.
+static uint32_t put_symbols(ElfBuf &symtab, ElfBuf &strtab, const ObjectFile &obj, const uint64_t base[3])
+{
+    put_symbol(symtab, 0, STB_LOCAL, STT_NOTYPE, 0, 0);
+    for (int s = SEC_TEXT; s <= SEC_BSS; ++s)
+        put_symbol(symtab, 0, STB_LOCAL, STT_SECTION, static_cast<uint16_t>(s), base[s - SEC_TEXT]);
+    uint32_t first_global = 4;
+    for (int pass = 0; pass < 2; ++pass)
+        for (auto &sym : obj.symbols)
+        {
+            if (sym.global != (pass == 1))
+                continue;
+            int s = section_index(sym.section);
+            put_symbol(symtab, add_string(strtab, sym.name), sym.global ? STB_GLOBAL : STB_LOCAL, STT_NOTYPE,
+                       static_cast<uint16_t>(s), base[s - SEC_TEXT] + sym.value);
+            if (!sym.global)
+                first_global++;
+        }
+    return first_global;
+}
+
+static void put_elf_header(std::vector<uint8_t> &file, uint16_t type, uint64_t entry, uint16_t phnum, uint64_t shoff,
+                           uint16_t shnum, uint16_t shstrndx)
+{
+    ElfBuf hdr;
+    const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* LE */, 1 /* version */};
+    hdr.b.assign(ident, ident + 16);
+    hdr.u16(type);
+    hdr.u16(EM_X86_64);
+    hdr.u32(1);                // e_version
+    hdr.u64(entry);            // e_entry
+    hdr.u64(phnum ? 64 : 0);   // e_phoff: right after this header
+    hdr.u64(shoff);            // e_shoff
+    hdr.u32(0);                // e_flags
+    hdr.u16(64);               // e_ehsize
+    hdr.u16(phnum ? 56 : 0);   // e_phentsize
+    hdr.u16(phnum);            // e_phnum
+    hdr.u16(64);               // e_shentsize
+    hdr.u16(shnum);
+    hdr.u16(shstrndx);
+    std::copy(hdr.b.begin(), hdr.b.end(), file.begin());
+}
+
+static void put_relocs(ElfBuf &out, const std::vector<ObjReloc> &relocs)
+{
+    for (auto &r : relocs)
+    {
+        out.u64(r.offset);
+        out.u64(static_cast<uint64_t>(section_index(r.target)) << 32 | R_X86_64_PC32);
+        out.u64(static_cast<uint64_t>(r.addend));
+    }
+}
+
+void write_elf_object(std::ostream &os, const ObjectFile &obj)
+{
+    ElfBuf strtab, symtab;
+    strtab.u8(0);
+    const uint64_t base[3] = {0, 0, 0};
+    uint32_t first_global = put_symbols(symtab, strtab, obj, base);
+
+    // file layout: header, section contents, section header table
+    SectionTable st(SEC_COUNT);
+    st.file.b.resize(64);
+    st.place(SEC_TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, obj.text.align, obj.text.bytes);
+    st.place(SEC_DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, obj.data.align, obj.data.bytes);
+    SectionHeader &bss = st.add(SEC_BSS, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, obj.bss.align);
+    bss.offset = st.file.b.size();
+    bss.size = obj.bss.size;
+
+    ElfBuf rela_text, rela_data;
+    put_relocs(rela_text, obj.text.relocs);
+    put_relocs(rela_data, obj.data.relocs);
+    SectionHeader &rt = st.place(SEC_RELA_TEXT, ".rela.text", SHT_RELA, SHF_INFO_LINK, 8, rela_text.b);
+    rt.link = SEC_SYMTAB;
+    rt.info = SEC_TEXT;
+    rt.entsize = 24;
+    SectionHeader &rd = st.place(SEC_RELA_DATA, ".rela.data", SHT_RELA, SHF_INFO_LINK, 8, rela_data.b);
+    rd.link = SEC_SYMTAB;
+    rd.info = SEC_DATA;
+    rd.entsize = 24;
+
+    SectionHeader &sym = st.place(SEC_SYMTAB, ".symtab", SHT_SYMTAB, 0, 8, symtab.b);
+    sym.link = SEC_STRTAB;
+    sym.info = first_global;
+    sym.entsize = 24;
+    st.place(SEC_STRTAB, ".strtab", SHT_STRTAB, 0, 1, strtab.b);
+    st.place(SEC_SHSTRTAB, ".shstrtab", SHT_STRTAB, 0, 1, st.shstrtab.b);
+
+    uint64_t shoff = st.write_headers();
+    put_elf_header(st.file.b, ET_REL, 0, 0, shoff, SEC_COUNT, SEC_SHSTRTAB);
+    os.write(reinterpret_cast<const char *>(st.file.b.data()), static_cast<std::streamsize>(st.file.b.size()));
+}
+
+static void put_segment(ElfBuf &out, uint32_t type, uint32_t flags, uint64_t offset, uint64_t vaddr, uint64_t filesz,
+                        uint64_t memsz, uint64_t align)
+{
+    out.u32(type);
+    out.u32(flags);
+    out.u64(offset);
+    out.u64(vaddr);
+    out.u64(vaddr); // p_paddr
+    out.u64(filesz);
+    out.u64(memsz);
+    out.u64(align);
+}
+
+void write_elf_executable(std::ostream &os, const ObjectFile &obj, const std::string &entry)
+{
+    // Two PT_LOAD segments: headers + .text (R X) from file offset 0, then
+    // .data + .bss (RW) starting on the next page. Offsets and addresses stay
+    // congruent modulo the page size, as the loader requires.
+    const uint16_t phnum = 3;
+    uint64_t text_off = align_up(64 + 56 * phnum, obj.text.align);
+    uint64_t data_off = align_up(text_off + obj.text.size, PAGE_SIZE);
+    uint64_t base[3];
+    base[0] = EXE_BASE + text_off;
+    base[1] = EXE_BASE + data_off;
+    base[2] = align_up(base[1] + obj.data.size, obj.bss.align);
+    uint64_t end = base[2] + obj.bss.size;
+
+    uint64_t entry_addr = 0;
+    bool found = false;
+    for (auto &sym : obj.symbols)
+        if (sym.name == entry)
+        {
+            entry_addr = base[section_index(sym.section) - SEC_TEXT] + sym.value;
+            found = true;
+        }
+    if (!found)
+        throw std::runtime_error("linker: entry symbol '" + entry + "' not defined");
+
+    std::vector<uint8_t> text = obj.text.bytes, data = obj.data.bytes;
+    apply_relocations(text, base[0], obj.text, base);
+    apply_relocations(data, base[1], obj.data, base);
+
+    ElfBuf strtab, symtab;
+    strtab.u8(0);
+    uint32_t first_global = put_symbols(symtab, strtab, obj, base);
+
+    SectionTable st(EXE_SEC_COUNT);
+    st.file.b.resize(64);
+    put_segment(st.file, PT_LOAD, PF_R | PF_X, 0, EXE_BASE, text_off + text.size(), text_off + text.size(),
+                PAGE_SIZE);
+    put_segment(st.file, PT_LOAD, PF_R | PF_W, data_off, base[1], data.size(), end - base[1], PAGE_SIZE);
+    put_segment(st.file, PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 0, 16);
+
+    st.place(SEC_TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, obj.text.align, text).addr = base[0];
+    st.file.b.resize(data_off);
+    st.place(SEC_DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, obj.data.align, data).addr = base[1];
+    SectionHeader &bss = st.add(SEC_BSS, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, obj.bss.align);
+    bss.addr = base[2];
+    bss.offset = st.file.b.size();
+    bss.size = obj.bss.size;
+
+    SectionHeader &sym = st.place(EXE_SYMTAB, ".symtab", SHT_SYMTAB, 0, 8, symtab.b);
+    sym.link = EXE_STRTAB;
+    sym.info = first_global;
+    sym.entsize = 24;
+    st.place(EXE_STRTAB, ".strtab", SHT_STRTAB, 0, 1, strtab.b);
+    st.place(EXE_SHSTRTAB, ".shstrtab", SHT_STRTAB, 0, 1, st.shstrtab.b);
+
+    uint64_t shoff = st.write_headers();
+    put_elf_header(st.file.b, ET_EXEC, entry_addr, phnum, shoff, EXE_SEC_COUNT, EXE_SHSTRTAB);
+    os.write(reinterpret_cast<const char *>(st.file.b.data()), static_cast<std::streamsize>(st.file.b.size()));
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "assembler.h"
+#include <ostream>
+
+// Write `obj` as an ELF64 relocatable object (ET_REL) for x86-64.
+// Sections: .text .data .bss .rela.text .rela.data .symtab .strtab .shstrtab;
+// cross-section references become R_X86_64_PC32 against section symbols.
+void write_elf_object(std::ostream &os, const ObjectFile &obj);
+
+// Link `obj` on its own into a static x86-64 executable starting at `entry`.
+// There is nothing external to resolve, so this is just layout: .text in an
+// R+X PT_LOAD segment, .data/.bss in an RW one, relocations applied in place.
+void write_elf_executable(std::ostream &os, const ObjectFile &obj, const std::string &entry);
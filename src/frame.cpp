@@ -0,0 +1,339 @@
+#include "frame.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// ---------------- Variable sets ----------------
+// Names are numbered per function; sets are plain bit vectors.
+
+using VarSet = std::vector<uint64_t>;
+
+static void set_add(VarSet &s, int v) { s[v >> 6] |= uint64_t(1) << (v & 63); }
+static bool set_has(const VarSet &s, int v) { return (s[v >> 6] >> (v & 63)) & 1; }
+
+// call f(v) for every v in s, in increasing order
+template <typename F> static void for_each_var(const VarSet &s, F f)
+{
+    for (size_t w = 0; w < s.size(); ++w)
+        for (uint64_t bits = s[w]; bits; bits &= bits - 1)
+            f(static_cast<int>(w * 64 + __builtin_ctzll(bits)));
+}
+
+// call f(name) for every let in s, in source order, repeated names included
+template <typename F> static void for_each_let(const Stmt *s, F f)
+{
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+        for (auto &st : b->stmts)
+            for_each_let(st.get(), f);
+    else if (auto l = dynamic_cast<const LetStmt *>(s))
+        f(l->name);
+    else if (auto i = dynamic_cast<const IfStmt *>(s))
+    {
+        for_each_let(i->thenBranch.get(), f);
+        if (i->elseBranch)
+            for_each_let(i->elseBranch.get(), f);
+    }
+    else if (auto w = dynamic_cast<const WhileStmt *>(s))
+        for_each_let(w->body.get(), f);
+}
+
+// ---------------- Control flow graph ----------------
+// One node per let / expression statement / return / condition. Reads of a
+// node happen before its final write (`let x = e`, `x = e`); assignments
+// nested inside an expression are inner writes, and the values they clobber
+// must not be any of the node's reads either.
+
+struct FlowNode {
+    VarSet uses, kills;            // kills: unconditional writes
+    std::vector<int> inner_writes; // every write except `final_write`
+    int final_write = -1;
+    std::vector<int> succ;
+    VarSet live_in, live_out;
+};
+
+class FrameBuilder
+{
+public:
+    std::unordered_map<std::string, int> index;
+    std::vector<std::string> names; // params first, then lets in order
+    std::vector<FlowNode> nodes;
+    const std::set<std::string> *no_slot = nullptr;
+
+    std::set<std::string> params;
+    bool is_param(int v) const { return params.count(names[v]) > 0; }
+
+    int var(const std::string &name) const
+    {
+        auto it = index.find(name);
+        return it == index.end() ? -1 : it->second;
+    }
+
+    void declare(const std::string &name)
+    {
+        if (no_slot->count(name))
+            return;
+        if (index.emplace(name, static_cast<int>(names.size())).second)
+            names.push_back(name);
+    }
+
+    void declare_lets(const Stmt *s)
+    {
+        for_each_let(s, [&](const std::string &name) { declare(name); });
+    }
+
+    int new_node(std::vector<int> succ)
+    {
+        FlowNode n;
+        size_t words = (names.size() + 63) / 64;
+        n.uses.assign(words, 0);
+        n.kills.assign(words, 0);
+        n.succ = std::move(succ);
+        nodes.push_back(std::move(n));
+        return static_cast<int>(nodes.size() - 1);
+    }
+
+    // reads and writes of `e`; writes under an if-expression branch are conditional
+    void scan_expr(const Expr *e, int node, bool conditional)
+    {
+        struct Item
+        {
+            const Expr *e;     // null: record the write of `write`
+            bool conditional;
+            int write;
+        };
+        std::vector<Item> todo{{e, conditional, -1}};
+        while (!todo.empty())
+        {
+            Item it = todo.back();
+            todo.pop_back();
+            if (!it.e)
+            {
+                if (it.write >= 0)
+                {
+                    nodes[node].inner_writes.push_back(it.write);
+                    if (!it.conditional)
+                        set_add(nodes[node].kills, it.write);
+                }
+            }
+            else if (auto id = dynamic_cast<const Identifier *>(it.e))
+            {
+                int v = var(id->name);
+                if (v >= 0)
+                    set_add(nodes[node].uses, v);
+            }
+            else if (auto bin = dynamic_cast<const BinaryExpr *>(it.e))
+            {
+                // the write happens after both operands are read
+                auto target = bin->op == "=" ? dynamic_cast<const Identifier *>(bin->left.get()) : nullptr;
+                todo.push_back({nullptr, it.conditional, target ? var(target->name) : -1});
+                todo.push_back({bin->right.get(), it.conditional, -1});
+                if (!target)
+                    todo.push_back({bin->left.get(), it.conditional, -1});
+            }
+            else if (auto u = dynamic_cast<const UnaryExpr *>(it.e))
+                todo.push_back({u->right.get(), it.conditional, -1});
+            else if (auto ife = dynamic_cast<const IfExpr *>(it.e))
+            {
+                todo.push_back({ife->elseExpr.get(), true, -1});
+                todo.push_back({ife->thenExpr.get(), true, -1});
+                todo.push_back({ife->cond.get(), it.conditional, -1});
+            }
+            else if (auto c = dynamic_cast<const CallExpr *>(it.e))
+                for (size_t i = c->args.size(); i-- > 0;)
+                    todo.push_back({c->args[i].get(), it.conditional, -1});
+        }
+    }
+
+    // `x = e` at the top of a statement: reads of e all happen before the write
+    void scan_assignment(const std::string &name, const Expr *value, int node)
+    {
+        scan_expr(value, node, false);
+        int v = var(name);
+        if (v < 0)
+            return;
+        nodes[node].final_write = v;
+        set_add(nodes[node].kills, v);
+    }
+
+    // Build the graph for `s` flowing into `next` (-1: function exit); returns its entry node.
+    int build(const Stmt *s, int next)
+    {
+        if (!s)
+            return next;
+        if (auto b = dynamic_cast<const BlockStmt *>(s))
+        {
+            for (auto it = b->stmts.rbegin(); it != b->stmts.rend(); ++it)
+                next = build(it->get(), next);
+            return next;
+        }
+        if (auto l = dynamic_cast<const LetStmt *>(s))
+        {
+            if (!l->init)
+                return next; // the slot keeps whatever it held
+            int n = new_node(succ_of(next));
+            scan_assignment(l->name, l->init.get(), n);
+            return n;
+        }
+        if (auto e = dynamic_cast<const ExprStmt *>(s))
+        {
+            int n = new_node(succ_of(next));
+            auto bin = dynamic_cast<const BinaryExpr *>(e->expr.get());
+            auto target = bin && bin->op == "=" ? dynamic_cast<const Identifier *>(bin->left.get()) : nullptr;
+            if (target)
+                scan_assignment(target->name, bin->right.get(), n);
+            else
+                scan_expr(e->expr.get(), n, false);
+            return n;
+        }
+        if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        {
+            int n = new_node({});
+            scan_expr(r->value.get(), n, false);
+            return n;
+        }
+        if (auto i = dynamic_cast<const IfStmt *>(s))
+        {
+            int then_entry = build(i->thenBranch.get(), next);
+            int else_entry = i->elseBranch ? build(i->elseBranch.get(), next) : next;
+            std::vector<int> succ = succ_of(then_entry);
+            if (else_entry >= 0)
+                succ.push_back(else_entry);
+            int n = new_node(succ);
+            scan_expr(i->cond.get(), n, false);
+            return n;
+        }
+        if (auto w = dynamic_cast<const WhileStmt *>(s))
+        {
+            int n = new_node(succ_of(next));
+            scan_expr(w->cond.get(), n, false);
+            int body = build(w->body.get(), n);
+            nodes[n].succ.push_back(body);
+            return n;
+        }
+        return next;
+    }
+
+    static std::vector<int> succ_of(int next) { return next >= 0 ? std::vector<int>{next} : std::vector<int>{}; }
+
+    // backward dataflow to a fixed point: in = uses | (out & ~kills)
+    void solve()
+    {
+        size_t words = (names.size() + 63) / 64;
+        for (auto &n : nodes)
+        {
+            n.live_in.assign(words, 0);
+            n.live_out.assign(words, 0);
+        }
+        // nodes are created roughly in reverse program order, so walking them
+        // forward visits successors first and converges in a few passes
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (auto &n : nodes)
+            {
+                for (int s : n.succ)
+                    for (size_t w = 0; w < words; ++w)
+                        n.live_out[w] |= nodes[s].live_in[w];
+                for (size_t w = 0; w < words; ++w)
+                {
+                    uint64_t in = n.uses[w] | (n.live_out[w] & ~n.kills[w]);
+                    if (in != n.live_in[w])
+                    {
+                        n.live_in[w] = in;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+};
+
+// ---------------- Layout ----------------
+
+FrameLayout layout_frame(const FunctionDecl &f, bool coloring, const std::set<std::string> &no_slot)
+{
+    FrameLayout layout;
+
+    // one slot per parameter and per let, the last declaration of a name wins
+    int count = 0, all = 0;
+    auto place = [&](const std::string &name)
+    {
+        ++all;
+        if (!no_slot.count(name))
+            layout.offsets[name] = 8 * ++count;
+    };
+    for (auto &p : f.params)
+        place(p.first);
+    for_each_let(f.body.get(), place);
+    layout.size = 8 * count;
+    layout.uncolored_size = 8 * all;
+    if (!coloring)
+        return layout;
+
+    FrameBuilder b;
+    b.no_slot = &no_slot;
+    for (auto &p : f.params)
+    {
+        b.declare(p.first);
+        b.params.insert(p.first);
+    }
+    b.declare_lets(f.body.get());
+    size_t nvars = b.names.size();
+    if (nvars == 0)
+        return layout;
+    int entry = b.build(f.body.get(), -1);
+    b.solve();
+
+    // interference: a write clobbers the slot of everything live after it,
+    // and inner writes also clobber everything the node still reads
+    std::vector<VarSet> adj(nvars, VarSet((nvars + 63) / 64, 0));
+    auto interfere = [&](int a, int c)
+    {
+        if (a != c)
+        {
+            set_add(adj[a], c);
+            set_add(adj[c], a);
+        }
+    };
+    auto clobbers = [&](int w, const VarSet &live) { for_each_var(live, [&](int v) { interfere(w, v); }); };
+    for (auto &n : b.nodes)
+    {
+        if (n.final_write >= 0)
+            clobbers(n.final_write, n.live_out);
+        for (int w : n.inner_writes)
+        {
+            clobbers(w, n.live_out);
+            clobbers(w, n.uses);
+        }
+    }
+    // at entry the prologue stores every parameter, and variables read before
+    // any write (uninitialized lets) hold whatever the slot held: all of
+    // these are live together
+    std::vector<int> at_entry;
+    for (size_t v = 0; v < nvars; ++v)
+        if (b.is_param(static_cast<int>(v)) || (entry >= 0 && set_has(b.nodes[entry].live_in, static_cast<int>(v))))
+            at_entry.push_back(static_cast<int>(v));
+    for (size_t x = 0; x < at_entry.size(); ++x)
+        for (size_t y = x + 1; y < at_entry.size(); ++y)
+            interfere(at_entry[x], at_entry[y]);
+
+    // greedy coloring in declaration order: parameters keep their offsets
+    std::vector<int> color(nvars, -1);
+    int colors = 0;
+    for (size_t v = 0; v < nvars; ++v)
+    {
+        std::vector<bool> taken(colors + 1, false);
+        for_each_var(adj[v], [&](int u) {
+            if (color[u] >= 0)
+                taken[color[u]] = true;
+        });
+        int c = 0;
+        while (taken[c])
+            ++c;
+        color[v] = c;
+        colors = std::max(colors, c + 1);
+        layout.offsets[b.names[v]] = 8 * (c + 1);
+    }
+    layout.size = 8 * colors;
+    return layout;
+}
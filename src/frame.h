@@ -0,0 +1,23 @@
+#pragma once
+#include "ast.h"
+#include <set>
+#include <string>
+#include <unordered_map>
+
+// Stack frame layout for one function: an rbp offset for every parameter and
+// `let` name.
+//
+// Without coloring every parameter and every `let` gets its own 8-byte slot,
+// in order (a name declared twice ends up in its last slot). With coloring, a
+// liveness analysis over the function's statements builds an interference
+// graph of the names and greedily colors it, so names whose values are never
+// needed at the same time (lets in disjoint branches, sequential blocks, dead
+// parameters) share a slot.
+struct FrameLayout {
+    std::unordered_map<std::string, int> offsets; // name -> positive offset below rbp
+    int size = 0;                                 // bytes to reserve
+    int uncolored_size = 0;                       // bytes the one-slot-per-let layout needs
+};
+
+// Names in `no_slot` (parameters kept in registers) get no offset.
+FrameLayout layout_frame(const FunctionDecl &f, bool coloring, const std::set<std::string> &no_slot = {});
@@ -0,0 +1,282 @@
+#include "globals.h"
+#include "optimize.h"
+#include <algorithm>
+#include <map>
+
+const char *const init_function = "zinc$init";
+
+// ---------------- Lowering ----------------
+
+// lets of a top-level statement become assignments to the globals they name
+static void lower_lets(Stmt::Ptr &slot, std::vector<std::string> &names)
+{
+    Stmt *s = slot.get();
+    if (auto b = dynamic_cast<BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            lower_lets(st, names);
+    }
+    else if (auto l = dynamic_cast<LetStmt *>(s))
+    {
+        names.push_back(l->name);
+        if (l->init)
+            slot = std::make_unique<ExprStmt>(
+                std::make_unique<BinaryExpr>("=", std::make_unique<Identifier>(l->name), std::move(l->init)));
+        else
+            slot = std::make_unique<BlockStmt>(); // declares, sets nothing
+    }
+    else if (auto i = dynamic_cast<IfStmt *>(s))
+    {
+        for (auto &st : i->thenBranch->stmts)
+            lower_lets(st, names);
+        if (i->elseBranch)
+            for (auto &st : i->elseBranch->stmts)
+                lower_lets(st, names);
+    }
+    else if (auto w = dynamic_cast<WhileStmt *>(s))
+    {
+        for (auto &st : w->body->stmts)
+            lower_lets(st, names);
+    }
+}
+
+void lower_globals(Program &program)
+{
+    Program functions;
+    auto body = std::make_unique<BlockStmt>();
+    std::vector<std::string> names;
+    for (auto &stmt : program)
+    {
+        if (dynamic_cast<FunctionDecl *>(stmt.get()))
+            functions.push_back(std::move(stmt));
+        else
+        {
+            lower_lets(stmt, names);
+            body->stmts.push_back(std::move(stmt));
+        }
+    }
+
+    program.clear();
+    std::set<std::string> declared;
+    for (auto &name : names)
+        if (declared.insert(name).second)
+            program.push_back(std::make_unique<LetStmt>(name, "", nullptr));
+    for (auto &f : functions)
+        program.push_back(std::move(f));
+    if (!body->stmts.empty())
+        program.push_back(std::make_unique<FunctionDecl>(init_function, std::vector<std::pair<std::string, std::string>>{},
+                                                         "", std::move(body)));
+}
+
+// ---------------- Baking ----------------
+
+// Value of `e` when zinc$init has only run the assignments baked so far
+// (`values`; other globals are still 0), as the native code computes it.
+static bool constant_value(const Expr *e, const std::map<std::string, int64_t> &values,
+                           const std::set<std::string> &globals, int64_t &out)
+{
+    // operands' values in evaluation order; ok = false where not constant
+    struct Value
+    {
+        bool ok;
+        int64_t v;
+    };
+    std::vector<Value> stack;
+    auto enter = [&](const Expr *x)
+    {
+        if (auto n = dynamic_cast<const NumberLiteral *>(x))
+            stack.push_back({true, literal_value(n)});
+        else if (auto id = dynamic_cast<const Identifier *>(x))
+        {
+            auto it = values.find(id->name);
+            // not a global: a temporary of zinc$init
+            stack.push_back({globals.count(id->name) > 0, it == values.end() ? 0 : it->second});
+        }
+        else if (dynamic_cast<const UnaryExpr *>(x) || dynamic_cast<const IfExpr *>(x) ||
+                 (dynamic_cast<const BinaryExpr *>(x) && static_cast<const BinaryExpr *>(x)->op != "="))
+            return true;
+        else
+            stack.push_back({false, 0}); // assignments, calls, strings, booleans
+        return false;
+    };
+    auto leave = [&](const Expr *x)
+    {
+        Value r{false, 0};
+        if (auto u = dynamic_cast<const UnaryExpr *>(x))
+        {
+            Value a = stack.back();
+            stack.pop_back();
+            if (a.ok && u->op == "-")
+                r = {true, static_cast<int64_t>(0 - static_cast<uint64_t>(a.v))};
+            else if (a.ok && u->op == "!")
+                r = {true, a.v == 0};
+        }
+        else if (auto bin = dynamic_cast<const BinaryExpr *>(x))
+        {
+            Value b = stack.back();
+            stack.pop_back();
+            Value a = stack.back();
+            stack.pop_back();
+            r.ok = a.ok && b.ok && fold_binary(bin->op, a.v, b.v, r.v);
+        }
+        else
+        {
+            Value els = stack.back();
+            stack.pop_back();
+            Value then = stack.back();
+            stack.pop_back();
+            Value c = stack.back();
+            stack.pop_back();
+            if (c.ok)
+                r = c.v != 0 ? then : els;
+        }
+        stack.push_back(r);
+    };
+    walk_expr(e, enter, leave);
+    if (stack.empty() || !stack.back().ok)
+        return false;
+    out = stack.back().v;
+    return true;
+}
+
+static Program::iterator find_init(Program &program)
+{
+    return std::find_if(program.begin(), program.end(), [](const Stmt::Ptr &s)
+                        {
+                            auto f = dynamic_cast<const FunctionDecl *>(s.get());
+                            return f && f->name == init_function;
+                        });
+}
+
+void bake_globals(Program &program)
+{
+    auto at = find_init(program);
+    if (at == program.end())
+        return;
+    auto &stmts = static_cast<FunctionDecl *>(at->get())->body->stmts;
+    std::set<std::string> globals = global_names(program);
+
+    // a run of constant assignments at the start has the same effect as
+    // starting with those values; the first statement that is not one ends it
+    std::map<std::string, int64_t> values;
+    bool rest = false; // anything besides declarations of temporaries left
+    for (size_t i = 0; i < stmts.size();)
+    {
+        auto l = dynamic_cast<const LetStmt *>(stmts[i].get());
+        if (l && !l->init)
+        {
+            ++i;
+            continue;
+        }
+        auto e = dynamic_cast<const ExprStmt *>(stmts[i].get());
+        auto bin = e ? dynamic_cast<const BinaryExpr *>(e->expr.get()) : nullptr;
+        auto id = bin && bin->op == "=" ? dynamic_cast<const Identifier *>(bin->left.get()) : nullptr;
+        int64_t v;
+        if (!id || !globals.count(id->name) || !constant_value(bin->right.get(), values, globals, v))
+        {
+            rest = true;
+            break;
+        }
+        values[id->name] = v;
+        stmts.erase(stmts.begin() + i);
+    }
+
+    for (auto &stmt : program)
+        if (auto l = dynamic_cast<LetStmt *>(stmt.get()))
+        {
+            auto it = values.find(l->name);
+            if (it != values.end())
+                l->init = std::make_unique<NumberLiteral>(std::to_string(it->second));
+        }
+    if (!rest)
+        program.erase(find_init(program));
+}
+
+// ---------------- Names ----------------
+
+std::set<std::string> global_names(const Program &program)
+{
+    std::set<std::string> names;
+    for (auto &stmt : program)
+        if (auto l = dynamic_cast<const LetStmt *>(stmt.get()))
+            names.insert(l->name);
+    return names;
+}
+
+void collect_lets(const Stmt *s, std::set<std::string> &out)
+{
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            collect_lets(st.get(), out);
+    }
+    else if (auto l = dynamic_cast<const LetStmt *>(s))
+        out.insert(l->name);
+    else if (auto i = dynamic_cast<const IfStmt *>(s))
+    {
+        collect_lets(i->thenBranch.get(), out);
+        collect_lets(i->elseBranch.get(), out);
+    }
+    else if (auto w = dynamic_cast<const WhileStmt *>(s))
+        collect_lets(w->body.get(), out);
+}
+
+std::set<std::string> function_locals(const FunctionDecl &f)
+{
+    std::set<std::string> locals;
+    for (auto &p : f.params)
+        locals.insert(p.first);
+    collect_lets(f.body.get(), locals);
+    return locals;
+}
+
+std::set<std::string> visible_globals(const std::set<std::string> &globals, const FunctionDecl &f)
+{
+    std::set<std::string> locals = function_locals(f), visible;
+    for (auto &g : globals)
+        if (!locals.count(g))
+            visible.insert(g);
+    return visible;
+}
+
+static bool mentions(const Expr *e, const std::set<std::string> &names)
+{
+    bool found = false;
+    walk_expr(e, [&](const Expr *x)
+              {
+                  if (auto id = dynamic_cast<const Identifier *>(x))
+                      found = found || names.count(id->name) > 0;
+                  return !found;
+              });
+    return found;
+}
+
+static bool mentions(const Stmt *s, const std::set<std::string> &names)
+{
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            if (mentions(st.get(), names))
+                return true;
+        return false;
+    }
+    if (auto l = dynamic_cast<const LetStmt *>(s))
+        return l->init && mentions(l->init.get(), names);
+    if (auto e = dynamic_cast<const ExprStmt *>(s))
+        return mentions(e->expr.get(), names);
+    if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        return r->value && mentions(r->value.get(), names);
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+        return mentions(i->cond.get(), names) || mentions(i->thenBranch.get(), names) ||
+               (i->elseBranch && mentions(i->elseBranch.get(), names));
+    if (auto w = dynamic_cast<const WhileStmt *>(s))
+        return mentions(w->cond.get(), names) || mentions(w->body.get(), names);
+    return false;
+}
+
+bool uses_globals(const FunctionDecl &f, const std::set<std::string> &globals)
+{
+    return !globals.empty() && mentions(f.body.get(), visible_globals(globals, f));
+}
+
+std::string global_label(const std::string &name) { return "zinc_global_" + name; }
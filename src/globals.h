@@ -0,0 +1,41 @@
+#pragma once
+#include "ast.h"
+#include <set>
+#include <string>
+
+// Global variables.
+//
+// Every name a top-level `let` declares (also inside a top-level if, while
+// or block) is a global, visible in every function that has no parameter or
+// `let` of the same name. lower_globals rewrites the program as parsed so
+// that only functions and global declarations are left at the top level:
+//   - one `let name` per global, without a value, before the functions;
+//   - every other top-level statement, in order, moves into a synthetic
+//     function `zinc$init` (appended last), with its lets turned into
+//     assignments. _start and the VM run it before main.
+// After the optimization passes, bake_globals moves the leading assignments
+// of zinc$init whose values are constant (literals, arithmetic, earlier
+// constant globals: whatever CTFE folded too) into the declarations and
+// drops zinc$init if nothing else is left. Codegen puts a global with a
+// nonzero value in .data and every other one in .bss, and addresses it
+// RIP-relative as `[rel zinc_global_<name>]`.
+
+extern const char *const init_function; // "zinc$init"
+
+// move the top-level statements into zinc$init and declare the globals
+void lower_globals(Program &program);
+// give globals their compile-time values; drop zinc$init when it is empty
+void bake_globals(Program &program);
+
+// names declared by the top-level lets of a lowered program
+std::set<std::string> global_names(const Program &program);
+// names the lets of `s` declare, at any depth
+void collect_lets(const Stmt *s, std::set<std::string> &out);
+// parameters and lets of `f`: the names that shadow globals inside it
+std::set<std::string> function_locals(const FunctionDecl &f);
+// the globals `f` sees, i.e. `globals` minus its locals
+std::set<std::string> visible_globals(const std::set<std::string> &globals, const FunctionDecl &f);
+// true if `f` reads or writes a global it sees
+bool uses_globals(const FunctionDecl &f, const std::set<std::string> &globals);
+// label of a global's 8 bytes
+std::string global_label(const std::string &name);
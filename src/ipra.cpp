@@ -0,0 +1,216 @@
+#include "ipra.h"
+#include <algorithm>
+
+static const char *const reg_names[16] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                          "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+
+RegMask reg_bit(const std::string &name)
+{
+    for (int i = 0; i < 16; ++i)
+        if (name == reg_names[i])
+            return RegMask(1) << i;
+    return 0;
+}
+
+const char *const internal_arg_regs[11] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "r13", "r14", "r15"};
+
+static RegMask mask_of(std::initializer_list<const char *> names)
+{
+    RegMask m = 0;
+    for (auto n : names)
+        m |= reg_bit(n);
+    return m;
+}
+
+// what the runtime routines may change (runtime.h), and what generated code
+// uses as scratch in every expression
+static const RegMask runtime_clobbers = mask_of({"rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"});
+static const RegMask scratch = mask_of({"rax", "rbx"});
+
+static RegMask arg_regs(size_t n)
+{
+    RegMask m = 0;
+    for (size_t i = 0; i < n && i < 11; ++i)
+        m |= reg_bit(internal_arg_regs[i]);
+    return m;
+}
+
+// ---------------- Call graph ----------------
+
+static void collect_calls(const Expr *e, std::vector<std::string> &out)
+{
+    walk_expr(e, [&](const Expr *x)
+              {
+                  auto c = dynamic_cast<const CallExpr *>(x);
+                  auto id = c ? dynamic_cast<const Identifier *>(c->callee.get()) : nullptr;
+                  if (id)
+                      out.push_back(id->name);
+                  return true;
+              });
+}
+
+void collect_calls(const Stmt *s, std::vector<std::string> &out)
+{
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+        for (auto &st : b->stmts)
+            collect_calls(st.get(), out);
+    else if (auto l = dynamic_cast<const LetStmt *>(s))
+        collect_calls(l->init.get(), out);
+    else if (auto e = dynamic_cast<const ExprStmt *>(s))
+        collect_calls(e->expr.get(), out);
+    else if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        collect_calls(r->value.get(), out);
+    else if (auto i = dynamic_cast<const IfStmt *>(s))
+    {
+        collect_calls(i->cond.get(), out);
+        collect_calls(i->thenBranch.get(), out);
+        collect_calls(i->elseBranch.get(), out);
+    }
+    else if (auto w = dynamic_cast<const WhileStmt *>(s))
+    {
+        collect_calls(w->cond.get(), out);
+        collect_calls(w->body.get(), out);
+    }
+}
+
+// ---------------- Clobber sets ----------------
+
+RegisterUsage::RegisterUsage(const std::vector<const FunctionDecl *> &fns, bool ipra) : ipra(ipra)
+{
+    if (!ipra)
+        return;
+
+    // A function's clobber set is what its own code writes (scratch, the
+    // argument registers of its calls, idiv/shift operands, the runtime) plus
+    // the sets of its callees. body_writes() counts only callees already in
+    // `clobbers`, so start from the own part of every function and add the
+    // callees' sets, callees first, until nothing changes; only recursion
+    // needs more than one pass.
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = 0; i < fns.size(); ++i)
+        index[fns[i]->name] = i;
+    std::vector<std::vector<size_t>> callees(fns.size());
+    for (size_t i = 0; i < fns.size(); ++i)
+    {
+        std::vector<std::string> names;
+        collect_calls(fns[i]->body.get(), names);
+        for (auto &n : names)
+        {
+            auto it = index.find(n);
+            if (it != index.end())
+                callees[i].push_back(it->second);
+        }
+        std::sort(callees[i].begin(), callees[i].end());
+        callees[i].erase(std::unique(callees[i].begin(), callees[i].end()), callees[i].end());
+        clobbers[fns[i]->name] = 0;
+    }
+    for (size_t i = 0; i < fns.size(); ++i)
+        clobbers[fns[i]->name] = body_writes(*fns[i]) | arg_regs(fns[i]->params.size());
+
+    // post-order (callees before callers), iteratively so deep call chains
+    // do not recurse
+    std::vector<size_t> order;
+    std::vector<char> seen(fns.size(), 0);
+    for (size_t root = 0; root < fns.size(); ++root)
+    {
+        if (seen[root])
+            continue;
+        std::vector<std::pair<size_t, size_t>> stack{{root, 0}};
+        seen[root] = 1;
+        while (!stack.empty())
+        {
+            auto &top = stack.back();
+            if (top.second < callees[top.first].size())
+            {
+                size_t next = callees[top.first][top.second++];
+                if (!seen[next])
+                {
+                    seen[next] = 1;
+                    stack.push_back({next, 0});
+                }
+                continue;
+            }
+            order.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t f : order)
+        {
+            RegMask &m = clobbers[fns[f]->name];
+            RegMask grown = m;
+            for (size_t c : callees[f])
+                grown |= clobbers[fns[c]->name];
+            changed |= grown != m;
+            m = grown;
+        }
+    }
+    for (auto f : fns)
+        bodies[f] = body_writes(*f);
+}
+
+RegMask RegisterUsage::call_clobbers(const std::string &callee) const
+{
+    static const RegMask system_v = runtime_clobbers | scratch;
+    if (!ipra)
+        return system_v;
+    auto it = clobbers.find(callee);
+    // outside the unit: assume anything but the stack and r12 (kept by print)
+    return it != clobbers.end() ? it->second : ~mask_of({"rsp", "rbp", "r12"}) & 0xffff;
+}
+
+RegMask RegisterUsage::expr_writes(const Expr *e) const
+{
+    RegMask m = 0;
+    walk_expr(e, [&](const Expr *x)
+              {
+                  m |= scratch;
+                  if (auto b = dynamic_cast<const BinaryExpr *>(x))
+                  {
+                      if (b->op == "/" || b->op == "%")
+                          m |= reg_bit("rdx");
+                      else if (b->op == "<<" || b->op == ">>")
+                          m |= reg_bit("rcx");
+                  }
+                  else if (auto c = dynamic_cast<const CallExpr *>(x))
+                  {
+                      auto id = dynamic_cast<const Identifier *>(c->callee.get());
+                      if (id && (id->name == "print" || id->name == "scan"))
+                          m |= runtime_clobbers; // r12 is saved around print
+                      else
+                          m |= arg_regs(c->args.size()) | call_clobbers(id ? id->name : "");
+                  }
+                  return true;
+              });
+    return m;
+}
+
+static RegMask stmt_writes(const RegisterUsage &usage, const Stmt *s)
+{
+    RegMask m = 0;
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+        for (auto &st : b->stmts)
+            m |= stmt_writes(usage, st.get());
+    else if (auto l = dynamic_cast<const LetStmt *>(s))
+        m = usage.expr_writes(l->init.get());
+    else if (auto e = dynamic_cast<const ExprStmt *>(s))
+        m = usage.expr_writes(e->expr.get());
+    else if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        m = usage.expr_writes(r->value.get());
+    else if (auto i = dynamic_cast<const IfStmt *>(s))
+        m = usage.expr_writes(i->cond.get()) | stmt_writes(usage, i->thenBranch.get()) |
+            stmt_writes(usage, i->elseBranch.get());
+    else if (auto w = dynamic_cast<const WhileStmt *>(s))
+        m = usage.expr_writes(w->cond.get()) | stmt_writes(usage, w->body.get());
+    return m;
+}
+
+RegMask RegisterUsage::body_writes(const FunctionDecl &f) const
+{
+    auto it = bodies.find(&f);
+    if (it != bodies.end())
+        return it->second;
+    return scratch | stmt_writes(*this, f.body.get());
+}
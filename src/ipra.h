@@ -0,0 +1,55 @@
+#pragma once
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Interprocedural register allocation.
+//
+// Zinc functions are called only by generated code: by each other, by _start
+// (main) and by the entry stubs of --tiered units, and the last two save every
+// System V callee-saved register themselves. So calls between Zinc functions
+// use an internal convention instead of System V:
+//   - up to 11 arguments, in rdi, rsi, rdx, rcx, r8, r9 (System V's six, so
+//     an entry stub passes its arguments through unchanged), then r10, r11,
+//     r13, r14, r15;
+//   - a call changes only the registers the callee can write, directly or
+//     through its own callees, computed bottom-up over the call graph (with a
+//     fixpoint for recursion). Everything else survives the call.
+// Callers use the clobber sets to load arguments straight into their
+// registers unless a later argument would overwrite them, and callees keep a
+// parameter in its argument register when nothing in the body writes it.
+//
+// Without IPRA every call clobbers whatever System V allows (plus rbx, which
+// generated code never preserves) and at most six arguments are passed.
+
+using RegMask = uint32_t;
+
+// bit of a 64-bit register name ("rax" .. "r15"); 0 for anything else
+RegMask reg_bit(const std::string &name);
+
+// names of the functions `s` calls, in order, with repeats
+void collect_calls(const Stmt *s, std::vector<std::string> &out);
+
+extern const char *const internal_arg_regs[11];
+
+class RegisterUsage
+{
+public:
+    RegisterUsage(const std::vector<const FunctionDecl *> &fns, bool ipra);
+
+    // arguments a call may pass in registers
+    size_t max_args() const { return ipra ? 11 : 6; }
+    // registers a call to `callee` may change
+    RegMask call_clobbers(const std::string &callee) const;
+    // registers evaluating `e` may change
+    RegMask expr_writes(const Expr *e) const;
+    // registers the code of `f`'s body writes, parameters aside
+    RegMask body_writes(const FunctionDecl &f) const;
+
+private:
+    bool ipra;
+    std::unordered_map<std::string, RegMask> clobbers;
+    std::unordered_map<const FunctionDecl *, RegMask> bodies;
+};
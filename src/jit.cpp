@@ -0,0 +1,59 @@
+#include "jit.h"
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+JitModule::JitModule(const ObjectFile &obj) : symbols(obj.symbols)
+{
+    // one mapping: .text, then .data and .bss from the next page so the two
+    // halves can get different protections
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t data_off = align_up(obj.text.size, page);
+    uint64_t bss_off = align_up(data_off + obj.data.size, obj.bss.align);
+    total = align_up(bss_off + obj.bss.size, page);
+    if (total == 0)
+        throw std::runtime_error("jit: empty program");
+
+    mem = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::runtime_error("jit: mmap failed");
+    uint8_t *p = static_cast<uint8_t *>(mem);
+    uint64_t at = reinterpret_cast<uint64_t>(p);
+    base[0] = at;
+    base[1] = at + data_off;
+    base[2] = at + bss_off;
+
+    std::vector<uint8_t> text = obj.text.bytes, data = obj.data.bytes;
+    apply_relocations(text, base[0], obj.text, base);
+    apply_relocations(data, base[1], obj.data, base);
+    memcpy(p, text.data(), text.size());
+    memcpy(p + data_off, data.data(), data.size()); // .bss is already zero
+
+    if (mprotect(mem, data_off, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, total);
+        throw std::runtime_error("jit: mprotect failed");
+    }
+}
+
+JitModule::~JitModule() { munmap(mem, total); }
+
+void *JitModule::symbol(const std::string &name) const
+{
+    for (auto &sym : symbols)
+        if (sym.name == name)
+            return reinterpret_cast<void *>(base[static_cast<int>(sym.section)] + sym.value);
+    return nullptr;
+}
+
+void jit_run(const ObjectFile &obj, const std::string &entry)
+{
+    JitModule module(obj);
+    void *start = module.symbol(entry);
+    if (!start)
+        throw std::runtime_error("jit: entry symbol '" + entry + "' not defined");
+    reinterpret_cast<void (*)()>(start)();
+}
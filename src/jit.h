@@ -0,0 +1,26 @@
+#pragma once
+#include "assembler.h"
+#include <string>
+
+// An ObjectFile loaded into anonymous memory: relocated, .text executable,
+// .data/.bss writable. Unmapped when destroyed.
+struct JitModule {
+    explicit JitModule(const ObjectFile &obj);
+    ~JitModule();
+    JitModule(const JitModule &) = delete;
+    JitModule &operator=(const JitModule &) = delete;
+
+    // run-time address of a symbol, or nullptr if it is not defined
+    void *symbol(const std::string &name) const;
+
+private:
+    std::vector<ObjSymbol> symbols;
+    uint64_t base[3] = {};
+    void *mem = nullptr;
+    uint64_t total = 0;
+};
+
+// Load `obj` into anonymous executable memory and call `entry` in-process.
+// The code must be generated with RuntimeOptions::jit so _start returns
+// to us (with callee-saved registers intact) instead of calling exit.
+void jit_run(const ObjectFile &obj, const std::string &entry);
@@ -8,7 +8,15 @@
 #include "ast.h"
 #include "parser.h"
 #include "codegen.h" // ✅ include codegen
+#include "optimize.h"
+#include "globals.h"
+#include "profile.h"
+#include "assembler.h"
+#include "elf.h"
+#include "jit.h"
+#include "vm.h"
 #include <cstdlib>   // For system()
+#include <sys/stat.h> // chmod
 
 // prototype of lexString defined in lexer.cpp
 std::vector<Token> lexString(const std::string &s);
@@ -20,15 +28,164 @@ static bool ends_with(const std::string &s, const std::string &suffix)
     return s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
+static void usage()
+{
+    std::cerr << "Usage: zinc [options] <source-file.zinc>\n"
+              << "Options:\n"
+              << "  --no-peephole      skip the peephole pass over generated assembly\n"
+              << "  --peephole-stats   print how often each peephole rule fired\n"
+              << "  --no-slot-coloring give every let its own stack slot\n"
+              << "  --frame-stats      print each function's frame size before/after slot coloring\n"
+              << "  --keep-frame-pointers  give leaf functions an rbp frame too (for profilers)\n"
+              << "  --no-ipra          System V calls between functions (no clobber sets, <= 6 args)\n"
+              << "  --no-dfe           keep functions main cannot reach\n"
+              << "  --dfe-stats        print how many unreachable functions (and bytes) were dropped\n"
+              << "  --no-icf           keep functions with identical code separate\n"
+              << "  --icf-stats        print how many functions (and bytes) identical code folding saved\n"
+              << "  --no-ctfe          do not evaluate pure calls with constant arguments at compile time\n"
+              << "  --ctfe-fuel=N      evaluation steps allowed per call site (default 1000000)\n"
+              << "  --ctfe-stats       print how many calls were evaluated at compile time\n"
+              << "  --no-specialize    do not clone functions for constant call arguments\n"
+              << "  --specialize-budget=PCT  code growth allowed for clones, in % of the program (default 50)\n"
+              << "  --specialize-stats print how many clones were made\n"
+              << "  --no-cse           recompute repeated expressions instead of reusing their values\n"
+              << "  --cse-stats        print how many expressions each function reuses\n"
+              << "  --no-unroll        keep counted while loops rolled\n"
+              << "  --unroll-factor=N  copies of the body per partially unrolled loop (default: 8 or 4 by size)\n"
+              << "  --unroll-budget=PCT  code growth allowed for unrolling, in % of the program (default 50)\n"
+              << "  --unroll-stats     print how many loops were unrolled\n"
+              << "  --no-layout        keep functions in source order, branches as written (unless profiled)\n"
+              << "                     and nothing in .text.cold\n"
+              << "  --profile-generate[=FILE]  count calls, branches and loop iterations; the program writes\n"
+              << "                     them to FILE (default zinc.profile) at exit. Skips the AST optimizations\n"
+              << "  --profile-use[=FILE]  optimize with the counts of a --profile-generate run\n"
+              << "  --unbuffered       print writes each argument immediately (no output buffer)\n"
+              << "  --jobs=N           generate functions on N threads (default: one per core)\n"
+              << "  --backend=nasm     write out.asm and assemble it with nasm (default)\n"
+              << "  --backend=direct   encode and link in-process (no nasm, no ld)\n"
+              << "  --emit=asm         only write out.asm (NASM syntax) and stop\n"
+              << "  --emit=obj         only write the relocatable object out.o and stop\n"
+              << "  --emit=exe         only write the executable ./test and stop (do not run it)\n"
+              << "  --jit              encode in memory and run main inside the compiler (no files)\n"
+              << "  --run              interpret with the bytecode VM (no native code)\n"
+              << "  --tiered           like --run, but compile hot functions to native code in the background\n"
+              << "  --tier-threshold=N calls + loop iterations before a function is compiled (default 1000)\n"
+              << "  --tier-stats       print which functions ran natively to stderr at exit\n";
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    CodeGenOptions opts;
+    OptimizeOptions optimize; // --no-ctfe, --no-specialize, --no-cse, --no-unroll, --no-layout and their knobs
+    bool direct = false;   // --backend=direct
+    std::string emit;      // --emit=asm|obj|exe; empty = build and run
+    bool jit = false;      // --jit
+    bool run = false;      // --run
+    TierOptions tier;      // --tiered, --tier-threshold, --tier-stats
+    std::string profile_generate, profile_use; // --profile-generate[=FILE], --profile-use[=FILE]
+    std::string path;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--no-peephole")
+            opts.peephole = false;
+        else if (arg == "--peephole-stats")
+            opts.peephole_stats = true;
+        else if (arg == "--no-slot-coloring")
+            opts.slot_coloring = false;
+        else if (arg == "--frame-stats")
+            opts.frame_stats = true;
+        else if (arg == "--keep-frame-pointers")
+            opts.keep_frame_pointers = true;
+        else if (arg == "--no-ipra")
+            opts.ipra = false;
+        else if (arg == "--no-dfe")
+            opts.dead_functions = false;
+        else if (arg == "--dfe-stats")
+            opts.dfe_stats = true;
+        else if (arg == "--no-icf")
+            opts.fold_identical = false;
+        else if (arg == "--icf-stats")
+            opts.icf_stats = true;
+        else if (arg == "--no-ctfe")
+            optimize.ctfe = false;
+        else if (arg.rfind("--ctfe-fuel=", 0) == 0 && std::atoll(arg.c_str() + 12) > 0)
+            optimize.ctfe_fuel = static_cast<uint64_t>(std::atoll(arg.c_str() + 12));
+        else if (arg == "--ctfe-stats")
+            optimize.ctfe_stats = true;
+        else if (arg == "--no-specialize")
+            optimize.specialize = false;
+        else if (arg.rfind("--specialize-budget=", 0) == 0 && std::atoi(arg.c_str() + 20) >= 0)
+            optimize.specialize_budget = static_cast<unsigned>(std::atoi(arg.c_str() + 20));
+        else if (arg == "--specialize-stats")
+            optimize.specialize_stats = true;
+        else if (arg == "--no-cse")
+            optimize.cse = false;
+        else if (arg == "--cse-stats")
+            optimize.cse_stats = true;
+        else if (arg == "--no-unroll")
+            optimize.unroll = false;
+        else if (arg.rfind("--unroll-factor=", 0) == 0 && std::atoi(arg.c_str() + 16) >= 2 &&
+                 std::atoi(arg.c_str() + 16) <= 16)
+            optimize.unroll_factor = static_cast<unsigned>(std::atoi(arg.c_str() + 16));
+        else if (arg.rfind("--unroll-budget=", 0) == 0 && std::atoi(arg.c_str() + 16) >= 0)
+            optimize.unroll_budget = static_cast<unsigned>(std::atoi(arg.c_str() + 16));
+        else if (arg == "--unroll-stats")
+            optimize.unroll_stats = true;
+        else if (arg == "--no-layout")
+            optimize.layout = false;
+        else if (arg == "--profile-generate" || arg.rfind("--profile-generate=", 0) == 0)
+            profile_generate = arg.size() > 19 ? arg.substr(19) : "zinc.profile";
+        else if (arg == "--profile-use" || arg.rfind("--profile-use=", 0) == 0)
+            profile_use = arg.size() > 14 ? arg.substr(14) : "zinc.profile";
+        else if (arg == "--unbuffered")
+            opts.runtime.buffered_output = false;
+        else if (arg.rfind("--jobs=", 0) == 0 && std::atoi(arg.c_str() + 7) > 0)
+            opts.jobs = static_cast<unsigned>(std::atoi(arg.c_str() + 7));
+        else if (arg == "--backend=nasm" || arg == "--backend=direct")
+            direct = arg == "--backend=direct";
+        else if (arg == "--emit=asm" || arg == "--emit=obj" || arg == "--emit=exe")
+            emit = arg.substr(7);
+        else if (arg == "--jit")
+            jit = true;
+        else if (arg == "--run")
+            run = true;
+        else if (arg == "--tiered")
+            run = tier.enabled = true;
+        else if (arg.rfind("--tier-threshold=", 0) == 0 && std::atoi(arg.c_str() + 17) > 0)
+            tier.threshold = static_cast<uint32_t>(std::atoi(arg.c_str() + 17));
+        else if (arg == "--tier-stats")
+            tier.stats = true;
+        else if (arg.rfind("-", 0) == 0 || !path.empty())
+        {
+            usage();
+            return 1;
+        }
+        else
+            path = arg;
+    }
+    if (jit && !emit.empty())
+    {
+        std::cerr << "Error: --jit does not write files; drop --emit.\n";
+        return 1;
+    }
+    if (run && (jit || direct || !emit.empty()))
+    {
+        std::cerr << "Error: --run/--tiered interpret the program; they take no backend, --emit or --jit.\n";
+        return 1;
+    }
+    if (!profile_generate.empty() && (run || !profile_use.empty()))
+    {
+        std::cerr << "Error: --profile-generate instruments native code; it takes no --run/--tiered or --profile-use.\n";
+        return 1;
+    }
+    opts.runtime.jit = jit;
+    if (path.empty())
     {
-        std::cerr << "Usage: zinc <source-file.zinc>\n";
+        usage();
         return 1;
     }
 
-    std::string path = argv[1];
     if (!ends_with(path, ".zinc"))
     {
         std::cerr << "Error: input file must have a .zinc extension.\n";
@@ -59,6 +216,26 @@ int main(int argc, char **argv)
 
         Parser parser(tokens);
         Program program = parser.parseProgram();
+        lower_globals(program);
+        if (!profile_generate.empty())
+        {
+            // count the program as written, so --profile-use finds the same sites
+            opts.profile = number_profile_sites(program, profile_generate);
+            opts.runtime.profile = true;
+        }
+        else
+        {
+            if (!profile_use.empty())
+                optimize.profile = apply_profile(program, profile_use);
+            optimize_program(program, optimize);
+        }
+        bake_globals(program);
+
+        if (run)
+        {
+            vm_run(program, opts, tier);
+            return 0;
+        }
 
         // std::cout << "\n=== AST ===\n";
         // for (auto &s : program)
@@ -70,24 +247,61 @@ int main(int argc, char **argv)
         // ✅ Generate NASM code
         // std::cout << "\n=== Generating Assembly ===\n";
 
-        std::ofstream out("out.asm");
-        gen_program(out, program);
-        out.close();
-        // std::cout << "Assembly written to out.asm\n";
-        // std::cout << "Assembling with NASM...\n";
-        if (system("nasm -f elf64 out.asm -o out.o") != 0)
+        AsmStream code;
+        gen_program(code, program, opts);
+
+        if (jit)
         {
-            std::cerr << "Error: NASM failed.\n";
-            return 1;
+            jit_run(assemble(code.lines), "_start");
+            return 0;
         }
 
-        // ✅ Link with ld
-        // std::cout << "Linking with ld...\n";
-        if (system("ld out.o -o test") != 0)
+        if (direct && emit != "asm")
         {
-            std::cerr << "Error: ld failed.\n";
-            return 1;
+            // assemble and link in-process: no out.asm, no child processes
+            ObjectFile obj = assemble(code.lines);
+            if (emit == "obj")
+            {
+                std::ofstream out("out.o", std::ios::binary);
+                write_elf_object(out, obj);
+                return 0;
+            }
+            std::ofstream out("test", std::ios::binary | std::ios::trunc);
+            write_elf_executable(out, obj, "_start");
+            out.close();
+            if (!out || chmod("test", 0755) != 0)
+            {
+                std::cerr << "Error: cannot write ./test\n";
+                return 1;
+            }
+        }
+        else
+        {
+            std::ofstream out("out.asm");
+            code.write(out);
+            out.close();
+            // std::cout << "Assembly written to out.asm\n";
+            if (emit == "asm")
+                return 0;
+            // std::cout << "Assembling with NASM...\n";
+            if (system("nasm -f elf64 out.asm -o out.o") != 0)
+            {
+                std::cerr << "Error: NASM failed.\n";
+                return 1;
+            }
+            if (emit == "obj")
+                return 0;
+
+            // ✅ Link with ld
+            // std::cout << "Linking with ld...\n";
+            if (system("ld out.o -o test") != 0)
+            {
+                std::cerr << "Error: ld failed.\n";
+                return 1;
+            }
         }
+        if (emit == "exe")
+            return 0;
 
         // std::cout << "Running zinc_out...\n";
         if (system("./test") != 0)
@@ -0,0 +1,2205 @@
+#include "optimize.h"
+#include "globals.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// ---------------- Helpers ----------------
+
+// Collect every variable written inside an expression (targets of '=')
+void collect_assigned_expr(const Expr *expr, std::set<std::string> &out)
+{
+    walk_expr(expr, [&](const Expr *e)
+              {
+                  auto bin = dynamic_cast<const BinaryExpr *>(e);
+                  auto id = bin && bin->op == "=" ? dynamic_cast<const Identifier *>(bin->left.get()) : nullptr;
+                  if (id)
+                      out.insert(id->name);
+                  return true;
+              });
+}
+
+// True if every path through `s` ends in a return statement
+bool always_returns(const Stmt *s)
+{
+    if (dynamic_cast<const ReturnStmt *>(s))
+        return true;
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            if (always_returns(st.get()))
+                return true;
+        return false;
+    }
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+        return i->elseBranch && always_returns(i->thenBranch.get()) && always_returns(i->elseBranch.get());
+    return false;
+}
+
+// Collect every variable written inside a statement: assignments and lets
+// (a let inside a loop re-initializes its slot on every iteration)
+void collect_assigned(const Stmt *stmt, std::set<std::string> &out)
+{
+    if (!stmt)
+        return;
+
+    if (auto b = dynamic_cast<const BlockStmt *>(stmt))
+    {
+        for (auto &s : b->stmts)
+            collect_assigned(s.get(), out);
+    }
+    else if (auto l = dynamic_cast<const LetStmt *>(stmt))
+    {
+        out.insert(l->name);
+        collect_assigned_expr(l->init.get(), out);
+    }
+    else if (auto e = dynamic_cast<const ExprStmt *>(stmt))
+        collect_assigned_expr(e->expr.get(), out);
+    else if (auto r = dynamic_cast<const ReturnStmt *>(stmt))
+        collect_assigned_expr(r->value.get(), out);
+    else if (auto i = dynamic_cast<const IfStmt *>(stmt))
+    {
+        collect_assigned_expr(i->cond.get(), out);
+        collect_assigned(i->thenBranch.get(), out);
+        collect_assigned(i->elseBranch.get(), out);
+    }
+    else if (auto w = dynamic_cast<const WhileStmt *>(stmt))
+    {
+        collect_assigned_expr(w->cond.get(), out);
+        collect_assigned(w->body.get(), out);
+    }
+}
+
+// Structural key of an expression; equal keys mean equal computations
+std::string expr_key(const Expr *expr)
+{
+    // written front to back; the stack holds subexpressions ({e, nullptr})
+    // and the punctuation between them ({nullptr, text})
+    std::string k;
+    std::vector<std::pair<const Expr *, const char *>> todo{{expr, nullptr}};
+    while (!todo.empty())
+    {
+        const Expr *e = todo.back().first;
+        const char *text = todo.back().second;
+        todo.pop_back();
+        if (text)
+            k += text;
+        else if (!e)
+            k += "_";
+        else if (auto n = dynamic_cast<const NumberLiteral *>(e))
+            k += n->value;
+        else if (auto id = dynamic_cast<const Identifier *>(e))
+            k += "$" + id->name;
+        else if (auto b = dynamic_cast<const BoolLiteral *>(e))
+            k += b->value ? "true" : "false";
+        else if (auto sl = dynamic_cast<const StringLiteral *>(e))
+            k += "\"" + sl->value + "\"";
+        else if (auto u = dynamic_cast<const UnaryExpr *>(e))
+        {
+            k += "(" + u->op + " ";
+            todo.insert(todo.end(), {{nullptr, ")"}, {u->right.get(), nullptr}});
+        }
+        else if (auto bin = dynamic_cast<const BinaryExpr *>(e))
+        {
+            k += "(" + bin->op + " ";
+            todo.insert(todo.end(), {{nullptr, ")"}, {bin->right.get(), nullptr}, {nullptr, " "}, {bin->left.get(), nullptr}});
+        }
+        else if (auto ife = dynamic_cast<const IfExpr *>(e))
+        {
+            k += "(if ";
+            todo.insert(todo.end(), {{nullptr, ")"}, {ife->elseExpr.get(), nullptr}, {nullptr, " "},
+                                     {ife->thenExpr.get(), nullptr}, {nullptr, " "}, {ife->cond.get(), nullptr}});
+        }
+        else if (auto c = dynamic_cast<const CallExpr *>(e))
+        {
+            k += "(call ";
+            todo.push_back({nullptr, ")"});
+            for (size_t i = c->args.size(); i-- > 0;)
+                todo.insert(todo.end(), {{c->args[i].get(), nullptr}, {nullptr, " "}});
+            todo.push_back({c->callee.get(), nullptr});
+        }
+        else
+            k += "?";
+    }
+    return k;
+}
+
+// ---------------- Loop-Invariant Code Motion ----------------
+//
+// Every while loop is a natural loop: the condition is the single header and
+// the end of the body is the only back edge, so the loop body is exactly the
+// AST subtree and the preheader is the position right before the WhileStmt
+// in its enclosing block.
+
+struct LicmLoop
+{
+    std::set<std::string> assigned; // written somewhere in the loop
+    const std::set<std::string> *globals; // any call may write them (globals.h)
+    std::vector<std::pair<std::string, std::string>> hoisted; // (expr key, temp name)
+    std::vector<Stmt::Ptr> preheader;
+};
+
+static int licm_count = 0;
+
+// Invariant and safe to evaluate speculatively: no side effects, no traps,
+// and every variable read keeps its value for the whole loop (so no globals).
+// Collects the invariant subexpressions of `e` in one bottom-up pass and
+// returns whether `e` itself is one.
+static bool collect_invariant(const Expr *e, const LicmLoop &loop, std::unordered_set<const Expr *> &out)
+{
+    std::vector<char> done; // invariance of the finished operands, in order
+    auto leave = [&](const Expr *x)
+    {
+        auto operands = [&](size_t n)
+        {
+            bool all = true;
+            for (size_t i = done.size() - n; i < done.size(); ++i)
+                all = all && done[i];
+            done.resize(done.size() - n);
+            return all;
+        };
+        bool inv = false;
+        if (dynamic_cast<const NumberLiteral *>(x) || dynamic_cast<const BoolLiteral *>(x))
+            inv = true;
+        else if (auto id = dynamic_cast<const Identifier *>(x))
+            inv = loop.assigned.count(id->name) == 0 && loop.globals->count(id->name) == 0;
+        else if (dynamic_cast<const UnaryExpr *>(x))
+            inv = operands(1);
+        else if (auto bin = dynamic_cast<const BinaryExpr *>(x))
+            // '=' writes; '/' and '%' may fault if the loop never runs
+            inv = operands(2) && bin->op != "=" && bin->op != "/" && bin->op != "%";
+        else if (dynamic_cast<const IfExpr *>(x))
+            inv = operands(3);
+        else if (auto c = dynamic_cast<const CallExpr *>(x))
+            operands(c->args.size()); // calls (print/scan and user functions) are never hoisted
+        if (inv)
+            out.insert(x);
+        done.push_back(inv);
+    };
+    walk_expr(e, [](const Expr *) { return true; }, leave);
+    return !done.empty() && done.back();
+}
+
+static bool is_invariant(const Expr *e, const LicmLoop &loop)
+{
+    std::unordered_set<const Expr *> invariant;
+    return collect_invariant(e, loop, invariant);
+}
+
+// Only hoist something that actually computes; a lone load or literal
+// costs the same as reading the temporary
+static bool worth_hoisting(const Expr *e)
+{
+    return dynamic_cast<const BinaryExpr *>(e) || dynamic_cast<const UnaryExpr *>(e) ||
+           dynamic_cast<const IfExpr *>(e);
+}
+
+// Hoist the largest invariant computations of `root`, outermost first
+static void hoist_expr(Expr::Ptr &root, LicmLoop &loop)
+{
+    std::unordered_set<const Expr *> invariant;
+    collect_invariant(root.get(), loop, invariant);
+    std::vector<Expr::Ptr *> todo;
+    if (root)
+        todo.push_back(&root);
+    while (!todo.empty())
+    {
+        Expr::Ptr &slot = *todo.back();
+        todo.pop_back();
+        Expr *e = slot.get();
+        if (worth_hoisting(e) && invariant.count(e))
+        {
+            std::string key = expr_key(e);
+            std::string temp;
+            for (auto &h : loop.hoisted)
+                if (h.first == key)
+                    temp = h.second;
+            if (temp.empty())
+            {
+                temp = "$licm" + std::to_string(licm_count++);
+                loop.hoisted.push_back({key, temp});
+                loop.preheader.push_back(std::make_unique<LetStmt>(temp, "", std::move(slot)));
+            }
+            slot = std::make_unique<Identifier>(temp);
+            continue;
+        }
+
+        // the assignment target itself is not a computation
+        auto bin = dynamic_cast<BinaryExpr *>(e);
+        if (bin && bin->op == "=")
+            todo.push_back(&bin->right);
+        else
+            push_operand_slots(todo, e);
+    }
+}
+
+static void hoist_stmt(Stmt *s, LicmLoop &loop)
+{
+    if (auto b = dynamic_cast<BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            hoist_stmt(st.get(), loop);
+    }
+    else if (auto l = dynamic_cast<LetStmt *>(s))
+        hoist_expr(l->init, loop);
+    else if (auto e = dynamic_cast<ExprStmt *>(s))
+        hoist_expr(e->expr, loop);
+    else if (auto r = dynamic_cast<ReturnStmt *>(s))
+        hoist_expr(r->value, loop);
+    else if (auto i = dynamic_cast<IfStmt *>(s))
+    {
+        hoist_expr(i->cond, loop);
+        hoist_stmt(i->thenBranch.get(), loop);
+        if (i->elseBranch)
+            hoist_stmt(i->elseBranch.get(), loop);
+    }
+    else if (auto w = dynamic_cast<WhileStmt *>(s))
+    {
+        hoist_expr(w->cond, loop);
+        hoist_stmt(w->body.get(), loop);
+    }
+}
+
+static void licm_block(BlockStmt *blk, const std::set<std::string> &globals)
+{
+    for (size_t i = 0; i < blk->stmts.size(); ++i)
+    {
+        Stmt *s = blk->stmts[i].get();
+        if (auto b = dynamic_cast<BlockStmt *>(s))
+            licm_block(b, globals);
+        else if (auto iff = dynamic_cast<IfStmt *>(s))
+        {
+            licm_block(iff->thenBranch.get(), globals);
+            if (iff->elseBranch)
+                licm_block(iff->elseBranch.get(), globals);
+        }
+        else if (auto w = dynamic_cast<WhileStmt *>(s))
+        {
+            // inner loops first, so their preheaders become part of this loop
+            licm_block(w->body.get(), globals);
+
+            LicmLoop loop;
+            loop.globals = &globals;
+            collect_assigned_expr(w->cond.get(), loop.assigned);
+            collect_assigned(w->body.get(), loop.assigned);
+
+            // preheader temps of inner loops are written exactly once; when
+            // their value is invariant here too, move the whole let out
+            auto &body = w->body->stmts;
+            for (size_t k = 0; k < body.size();)
+            {
+                auto l = dynamic_cast<LetStmt *>(body[k].get());
+                if (l && l->name.rfind("$licm", 0) == 0 && is_invariant(l->init.get(), loop))
+                {
+                    loop.assigned.erase(l->name);
+                    loop.preheader.push_back(std::move(body[k]));
+                    body.erase(body.begin() + k);
+                    continue;
+                }
+                ++k;
+            }
+
+            hoist_stmt(w, loop);
+
+            if (!loop.preheader.empty())
+            {
+                size_t n = loop.preheader.size();
+                blk->stmts.insert(blk->stmts.begin() + i,
+                                  std::make_move_iterator(loop.preheader.begin()),
+                                  std::make_move_iterator(loop.preheader.end()));
+                i += n;
+            }
+        }
+    }
+}
+
+void hoist_loop_invariants(Program &program)
+{
+    std::set<std::string> globals = global_names(program);
+    for (auto &stmt : program)
+    {
+        if (auto f = dynamic_cast<FunctionDecl *>(stmt.get()))
+            licm_block(f->body.get(), visible_globals(globals, *f));
+    }
+}
+
+// Value of `l op r` as the native code computes it (64-bit wrapping
+// arithmetic, logical >>, shift counts mod 64, && and || on 0/1); false for
+// '=', unknown operators and divisions that trap (by zero, INT64_MIN / -1).
+bool fold_binary(const std::string &op, int64_t sl, int64_t sr, int64_t &out)
+{
+    uint64_t l = static_cast<uint64_t>(sl), r = static_cast<uint64_t>(sr);
+    if (op == "+")
+        out = static_cast<int64_t>(l + r);
+    else if (op == "-")
+        out = static_cast<int64_t>(l - r);
+    else if (op == "*")
+        out = static_cast<int64_t>(l * r);
+    else if (op == "/" || op == "%")
+    {
+        if (sr == 0 || (sr == -1 && sl == INT64_MIN))
+            return false; // idiv traps
+        out = op == "/" ? sl / sr : sl % sr;
+    }
+    else if (op == "==")
+        out = sl == sr;
+    else if (op == "!=")
+        out = sl != sr;
+    else if (op == "<")
+        out = sl < sr;
+    else if (op == "<=")
+        out = sl <= sr;
+    else if (op == ">")
+        out = sl > sr;
+    else if (op == ">=")
+        out = sl >= sr;
+    else if (op == "&&")
+        out = l != 0 && r != 0;
+    else if (op == "||")
+        out = l != 0 || r != 0;
+    else if (op == "&")
+        out = static_cast<int64_t>(l & r);
+    else if (op == "|")
+        out = static_cast<int64_t>(l | r);
+    else if (op == "^")
+        out = static_cast<int64_t>(l ^ r);
+    else if (op == "<<")
+        out = static_cast<int64_t>(l << (r & 63));
+    else if (op == ">>")
+        out = static_cast<int64_t>(l >> (r & 63));
+    else
+        return false;
+    return true;
+}
+
+// integer literal as NASM assembles it
+int64_t literal_value(const NumberLiteral *n)
+{
+    return static_cast<int64_t>(strtoull(n->value.c_str(), nullptr, 10));
+}
+
+// ---------------- Compile-Time Function Evaluation ----------------
+//
+// A function is pure when nothing it does can be observed except through its
+// return value: no print or scan (directly or in a callee) and only integer
+// code the native backend compiles faithfully (no unary operators, booleans or
+// strings, no `let` without a value) and no globals. A call to a pure
+// function whose arguments are constant is run here, by an interpreter with the native
+// semantics (64-bit wrapping arithmetic, logical >>, shift counts mod 64, both
+// sides of && and || evaluated), and replaced by its result.
+//
+// Evaluation gives up, leaving the call alone, whenever the native code would
+// not produce a value: division by zero or INT64_MIN / -1 (both trap), reading
+// a variable before it is written, falling off the end of the function, more
+// than `fuel` steps or 1000 nested calls. Results of completed calls are
+// memoized, so small recursive definitions (fib) cost one step per argument.
+
+struct CtfeFail
+{
+};
+
+class CtfeEvaluator
+{
+public:
+    CtfeEvaluator(const Program &program, uint64_t fuel) : fuel_per_call(fuel)
+    {
+        for (auto &stmt : program)
+            if (auto f = dynamic_cast<const FunctionDecl *>(stmt.get()))
+                functions[f->name] = f;
+
+        // purity: start from "every function without globals is pure" and
+        // drop the ones that fail the local check or call an impure function
+        // until nothing changes
+        std::set<std::string> globals = global_names(program);
+        for (auto &f : functions)
+            if (!uses_globals(*f.second, globals))
+                pure.insert(f.first);
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (auto &f : functions)
+                if (pure.count(f.first) && !pure_stmt(f.second->body.get()))
+                {
+                    pure.erase(f.first);
+                    changed = true;
+                }
+        }
+    }
+
+    // value of `call` if it is a call to a pure function with constant arguments
+    bool try_fold(const CallExpr *call, int64_t &value)
+    {
+        if (!constant(call))
+            return false;
+        fuel = fuel_per_call;
+        depth = 0;
+        try
+        {
+            std::unordered_map<std::string, int64_t> no_locals;
+            value = eval(call, no_locals);
+            return true;
+        }
+        catch (const CtfeFail &)
+        {
+            return false;
+        }
+    }
+
+    int folded = 0;
+
+private:
+    std::unordered_map<std::string, const FunctionDecl *> functions;
+    std::set<std::string> pure;
+    std::unordered_map<std::string, int64_t> memo; // expr_key of a constant call -> result
+    uint64_t fuel_per_call, fuel = 0;
+    int depth = 0;
+
+    bool pure_call(const CallExpr *c) const
+    {
+        auto id = dynamic_cast<const Identifier *>(c->callee.get());
+        return id && pure.count(id->name) && functions.at(id->name)->params.size() == c->args.size();
+    }
+
+    // computes the same value wherever it appears, and writes nothing
+    bool constant(const Expr *e) const
+    {
+        bool ok = true;
+        walk_expr(e, [&](const Expr *x)
+                  {
+                      if (auto bin = dynamic_cast<const BinaryExpr *>(x))
+                          ok = ok && bin->op != "=";
+                      else if (auto c = dynamic_cast<const CallExpr *>(x))
+                          ok = ok && pure_call(c);
+                      else
+                          ok = ok && (dynamic_cast<const NumberLiteral *>(x) || dynamic_cast<const IfExpr *>(x));
+                      return ok;
+                  });
+        return ok;
+    }
+
+    bool pure_expr(const Expr *e) const
+    {
+        bool ok = true;
+        walk_expr(e, [&](const Expr *x)
+                  {
+                      if (auto bin = dynamic_cast<const BinaryExpr *>(x))
+                          ok = ok && (bin->op != "=" || dynamic_cast<const Identifier *>(bin->left.get()));
+                      else if (auto c = dynamic_cast<const CallExpr *>(x))
+                          ok = ok && pure_call(c);
+                      else // not unary, bool, string
+                          ok = ok && (dynamic_cast<const NumberLiteral *>(x) || dynamic_cast<const Identifier *>(x) ||
+                                      dynamic_cast<const IfExpr *>(x));
+                      return ok;
+                  });
+        return ok;
+    }
+
+    bool pure_stmt(const Stmt *s) const
+    {
+        if (!s)
+            return true;
+        if (auto b = dynamic_cast<const BlockStmt *>(s))
+        {
+            for (auto &st : b->stmts)
+                if (!pure_stmt(st.get()))
+                    return false;
+            return true;
+        }
+        if (auto l = dynamic_cast<const LetStmt *>(s))
+            return l->init && pure_expr(l->init.get());
+        if (auto e = dynamic_cast<const ExprStmt *>(s))
+            return pure_expr(e->expr.get());
+        if (auto r = dynamic_cast<const ReturnStmt *>(s))
+            return r->value && pure_expr(r->value.get());
+        if (auto i = dynamic_cast<const IfStmt *>(s))
+            return pure_expr(i->cond.get()) && pure_stmt(i->thenBranch.get()) && pure_stmt(i->elseBranch.get());
+        if (auto w = dynamic_cast<const WhileStmt *>(s))
+            return pure_expr(w->cond.get()) && pure_stmt(w->body.get());
+        return false;
+    }
+
+    void step()
+    {
+        if (fuel == 0)
+            throw CtfeFail{};
+        --fuel;
+    }
+
+    using Locals = std::unordered_map<std::string, int64_t>;
+
+    // Operators wait on an explicit stack for their operands; only the
+    // function bodies of calls recurse (at most 1000 deep).
+    int64_t eval(const Expr *root, Locals &locals)
+    {
+        struct Pending
+        {
+            const Expr *e;
+            size_t next; // operands started so far
+        };
+        std::vector<Pending> pending;
+        std::vector<int64_t> values; // of finished operands, in order
+        const Expr *e = root;        // to start next; null: continue pending.back()
+        while (true)
+        {
+            if (e)
+            {
+                step();
+                if (auto n = dynamic_cast<const NumberLiteral *>(e))
+                    values.push_back(literal_value(n));
+                else if (auto id = dynamic_cast<const Identifier *>(e))
+                {
+                    auto it = locals.find(id->name);
+                    if (it == locals.end())
+                        throw CtfeFail{};
+                    values.push_back(it->second);
+                }
+                else if (dynamic_cast<const BinaryExpr *>(e) || dynamic_cast<const IfExpr *>(e) ||
+                         dynamic_cast<const CallExpr *>(e))
+                    pending.push_back({e, 0});
+                else
+                    throw CtfeFail{};
+                e = nullptr;
+            }
+            if (pending.empty())
+                return values.back();
+
+            Pending &p = pending.back();
+            size_t i = p.next++;
+            if (auto bin = dynamic_cast<const BinaryExpr *>(p.e))
+            {
+                if (bin->op == "=")
+                {
+                    if (i == 0)
+                    {
+                        e = bin->right.get();
+                        continue;
+                    }
+                    auto id = static_cast<const Identifier *>(bin->left.get());
+                    locals[id->name] = values.back();
+                }
+                else
+                {
+                    if (i < 2)
+                    {
+                        e = i == 0 ? bin->left.get() : bin->right.get();
+                        continue;
+                    }
+                    int64_t r = values.back(), v;
+                    values.pop_back();
+                    if (!fold_binary(bin->op, values.back(), r, v))
+                        throw CtfeFail{};
+                    values.back() = v;
+                }
+            }
+            else if (auto ife = dynamic_cast<const IfExpr *>(p.e))
+            {
+                if (i == 0)
+                {
+                    e = ife->cond.get();
+                    continue;
+                }
+                if (i == 1)
+                {
+                    int64_t c = values.back();
+                    values.pop_back();
+                    e = c != 0 ? ife->thenExpr.get() : ife->elseExpr.get();
+                    continue;
+                }
+                // the branch's value is the result
+            }
+            else
+            {
+                auto c = static_cast<const CallExpr *>(p.e);
+                if (i < c->args.size())
+                {
+                    e = c->args[i].get();
+                    continue;
+                }
+                auto id = dynamic_cast<const Identifier *>(c->callee.get());
+                const FunctionDecl *f = functions.at(id->name);
+                Locals frame;
+                std::string key = id->name;
+                size_t first = values.size() - c->args.size();
+                for (size_t a = 0; a < c->args.size(); ++a)
+                {
+                    int64_t v = values[first + a];
+                    frame[f->params[a].first] = v;
+                    key += " " + std::to_string(v);
+                }
+                values.resize(first);
+                auto hit = memo.find(key);
+                if (hit != memo.end())
+                    values.push_back(hit->second);
+                else
+                {
+                    if (++depth > 1000)
+                        throw CtfeFail{};
+                    int64_t result;
+                    if (!exec(f->body.get(), frame, result))
+                        throw CtfeFail{}; // fell off the end: rax is whatever was left there
+                    --depth;
+                    memo[key] = result;
+                    values.push_back(result);
+                }
+            }
+            pending.pop_back();
+        }
+    }
+
+    // true when a return was executed, with its value in `result`
+    bool exec(const Stmt *s, Locals &locals, int64_t &result)
+    {
+        if (!s)
+            return false;
+        step();
+        if (auto b = dynamic_cast<const BlockStmt *>(s))
+        {
+            for (auto &st : b->stmts)
+                if (exec(st.get(), locals, result))
+                    return true;
+            return false;
+        }
+        if (auto l = dynamic_cast<const LetStmt *>(s))
+        {
+            locals[l->name] = eval(l->init.get(), locals);
+            return false;
+        }
+        if (auto e = dynamic_cast<const ExprStmt *>(s))
+        {
+            eval(e->expr.get(), locals);
+            return false;
+        }
+        if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        {
+            result = eval(r->value.get(), locals);
+            return true;
+        }
+        if (auto i = dynamic_cast<const IfStmt *>(s))
+            return eval(i->cond.get(), locals) != 0 ? exec(i->thenBranch.get(), locals, result)
+                                                    : exec(i->elseBranch.get(), locals, result);
+        if (auto w = dynamic_cast<const WhileStmt *>(s))
+        {
+            while (eval(w->cond.get(), locals) != 0)
+                if (exec(w->body.get(), locals, result))
+                    return true;
+            return false;
+        }
+        throw CtfeFail{};
+    }
+};
+
+// Replace foldable calls in `root`, outermost first; when a call cannot be
+// folded its arguments may still contain calls that can.
+static void fold_expr(Expr::Ptr &root, CtfeEvaluator &ev)
+{
+    std::vector<Expr::Ptr *> todo;
+    if (root)
+        todo.push_back(&root);
+    while (!todo.empty())
+    {
+        Expr::Ptr &slot = *todo.back();
+        todo.pop_back();
+        int64_t value;
+        auto c = dynamic_cast<CallExpr *>(slot.get());
+        if (c && ev.try_fold(c, value))
+        {
+            slot = std::make_unique<NumberLiteral>(std::to_string(value));
+            ev.folded++;
+            continue;
+        }
+        push_operand_slots(todo, slot.get());
+    }
+}
+
+static void fold_stmt(Stmt *s, CtfeEvaluator &ev)
+{
+    if (auto f = dynamic_cast<FunctionDecl *>(s))
+        fold_stmt(f->body.get(), ev);
+    else if (auto b = dynamic_cast<BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            fold_stmt(st.get(), ev);
+    }
+    else if (auto l = dynamic_cast<LetStmt *>(s))
+        fold_expr(l->init, ev);
+    else if (auto e = dynamic_cast<ExprStmt *>(s))
+        fold_expr(e->expr, ev);
+    else if (auto r = dynamic_cast<ReturnStmt *>(s))
+        fold_expr(r->value, ev);
+    else if (auto i = dynamic_cast<IfStmt *>(s))
+    {
+        fold_expr(i->cond, ev);
+        fold_stmt(i->thenBranch.get(), ev);
+        if (i->elseBranch)
+            fold_stmt(i->elseBranch.get(), ev);
+    }
+    else if (auto w = dynamic_cast<WhileStmt *>(s))
+    {
+        fold_expr(w->cond, ev);
+        fold_stmt(w->body.get(), ev);
+    }
+}
+
+int evaluate_constant_calls(Program &program, uint64_t fuel)
+{
+    CtfeEvaluator ev(program, fuel);
+    for (auto &stmt : program)
+        fold_stmt(stmt.get(), ev);
+    return ev.folded;
+}
+
+// ---------------- Call-Site Specialization ----------------
+//
+// A call that passes a literal for a parameter the callee never writes can
+// go to a clone of the callee in which that parameter is the literal. Clones
+// are keyed by (callee, literal per position), so every call site with the
+// same constants shares one. Inside a clone the substituted literals are
+// folded: constant operators and conditions are evaluated, multiplications
+// by a power of two become shifts and identities (x + 0, x * 1, ...) vanish.
+//
+// Signatures are ranked by their call sites, weighted by loop nesting (x8 per
+// enclosing while) or, with a profile, by how often the sites ran (sites
+// that never ran get no clone), and cloned while the clones' total size stays within the
+// growth budget, at most 4 clones per function. Three rounds let constants
+// flow through one clone into the calls it makes.
+
+static size_t count_nodes(const Expr *e)
+{
+    size_t n = 0;
+    walk_expr(e, [&](const Expr *) { return ++n > 0; });
+    return n;
+}
+
+static size_t count_nodes(const Stmt *s)
+{
+    if (!s)
+        return 0;
+    if (auto f = dynamic_cast<const FunctionDecl *>(s))
+        return 1 + count_nodes(f->body.get());
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        size_t n = 1;
+        for (auto &st : b->stmts)
+            n += count_nodes(st.get());
+        return n;
+    }
+    if (auto l = dynamic_cast<const LetStmt *>(s))
+        return 1 + count_nodes(l->init.get());
+    if (auto e = dynamic_cast<const ExprStmt *>(s))
+        return 1 + count_nodes(e->expr.get());
+    if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        return 1 + count_nodes(r->value.get());
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+        return 1 + count_nodes(i->cond.get()) + count_nodes(i->thenBranch.get()) + count_nodes(i->elseBranch.get());
+    if (auto w = dynamic_cast<const WhileStmt *>(s))
+        return 1 + count_nodes(w->cond.get()) + count_nodes(w->body.get());
+    return 1;
+}
+
+using Substitution = std::unordered_map<std::string, std::string>; // parameter -> literal
+
+static Expr::Ptr clone_expr(const Expr *e, const Substitution &subst)
+{
+    std::vector<Expr::Ptr> done; // copies of the finished operands, in order
+    auto take = [&](size_t n)
+    {
+        std::vector<Expr::Ptr> operands(std::make_move_iterator(done.end() - n), std::make_move_iterator(done.end()));
+        done.resize(done.size() - n);
+        return operands;
+    };
+    auto leave = [&](const Expr *x)
+    {
+        Expr::Ptr copy;
+        if (auto n = dynamic_cast<const NumberLiteral *>(x))
+            copy = std::make_unique<NumberLiteral>(n->value);
+        else if (auto id = dynamic_cast<const Identifier *>(x))
+        {
+            auto it = subst.find(id->name);
+            if (it != subst.end())
+                copy = std::make_unique<NumberLiteral>(it->second);
+            else
+                copy = std::make_unique<Identifier>(id->name);
+        }
+        else if (auto sl = dynamic_cast<const StringLiteral *>(x))
+            copy = std::make_unique<StringLiteral>(sl->value);
+        else if (auto b = dynamic_cast<const BoolLiteral *>(x))
+            copy = std::make_unique<BoolLiteral>(b->value);
+        else if (auto u = dynamic_cast<const UnaryExpr *>(x))
+            copy = std::make_unique<UnaryExpr>(u->op, std::move(take(1)[0]));
+        else if (auto bin = dynamic_cast<const BinaryExpr *>(x))
+        {
+            auto ops = take(2);
+            copy = std::make_unique<BinaryExpr>(bin->op, std::move(ops[0]), std::move(ops[1]));
+        }
+        else if (auto ife = dynamic_cast<const IfExpr *>(x))
+        {
+            auto ops = take(3);
+            auto c = std::make_unique<IfExpr>(std::move(ops[0]), std::move(ops[1]), std::move(ops[2]));
+            c->profile = ife->profile;
+            copy = std::move(c);
+        }
+        else
+        {
+            auto call = static_cast<const CallExpr *>(x);
+            auto c = std::make_unique<CallExpr>(clone_expr(call->callee.get(), {}), take(call->args.size()));
+            c->profile = call->profile;
+            copy = std::move(c);
+        }
+        done.push_back(std::move(copy));
+    };
+    walk_expr(e, [](const Expr *) { return true; }, leave);
+    return done.empty() ? nullptr : std::move(done.back());
+}
+
+static std::unique_ptr<BlockStmt> clone_block(const BlockStmt *b, const Substitution &subst);
+
+static Stmt::Ptr clone_stmt(const Stmt *s, const Substitution &subst)
+{
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+        return clone_block(b, subst);
+    if (auto l = dynamic_cast<const LetStmt *>(s))
+        return std::make_unique<LetStmt>(l->name, l->typeName, clone_expr(l->init.get(), subst));
+    if (auto e = dynamic_cast<const ExprStmt *>(s))
+        return std::make_unique<ExprStmt>(clone_expr(e->expr.get(), subst));
+    if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        return std::make_unique<ReturnStmt>(clone_expr(r->value.get(), subst));
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+    {
+        auto copy = std::make_unique<IfStmt>(clone_expr(i->cond.get(), subst), clone_block(i->thenBranch.get(), subst),
+                                             clone_block(i->elseBranch.get(), subst));
+        copy->profile = i->profile;
+        return copy;
+    }
+    auto w = static_cast<const WhileStmt *>(s);
+    auto copy = std::make_unique<WhileStmt>(clone_expr(w->cond.get(), subst), clone_block(w->body.get(), subst));
+    copy->profile = w->profile;
+    return copy;
+}
+
+static std::unique_ptr<BlockStmt> clone_block(const BlockStmt *b, const Substitution &subst)
+{
+    if (!b)
+        return nullptr;
+    auto out = std::make_unique<BlockStmt>();
+    for (auto &s : b->stmts)
+        out->stmts.push_back(clone_stmt(s.get(), subst));
+    return out;
+}
+
+static const NumberLiteral *as_literal(const Expr::Ptr &e) { return dynamic_cast<const NumberLiteral *>(e.get()); }
+
+static Expr::Ptr make_literal(int64_t v) { return std::make_unique<NumberLiteral>(std::to_string(v)); }
+
+// constant folding and strength reduction of `slot`, whose operands are done
+static void fold_node(Expr::Ptr &slot)
+{
+    Expr *e = slot.get();
+    if (auto bin = dynamic_cast<BinaryExpr *>(e))
+    {
+        auto l = as_literal(bin->left), r = as_literal(bin->right);
+        int64_t v;
+        if (l && r && fold_binary(bin->op, literal_value(l), literal_value(r), v))
+        {
+            slot = make_literal(v);
+            return;
+        }
+        const std::string &op = bin->op;
+        bool commutes = op == "+" || op == "*" || op == "|" || op == "^";
+        if (l && !r && commutes)
+        {
+            std::swap(bin->left, bin->right);
+            std::swap(l, r);
+        }
+        if (!r || l)
+            return;
+        int64_t k = literal_value(r);
+        if ((k == 0 && (op == "+" || op == "-" || op == "|" || op == "^" || op == "<<" || op == ">>")) ||
+            (k == 1 && (op == "*" || op == "/")))
+            slot = std::move(bin->left);
+        else if (op == "*" && k > 1 && (k & (k - 1)) == 0)
+        {
+            bin->op = "<<";
+            bin->right = make_literal(__builtin_ctzll(static_cast<uint64_t>(k)));
+        }
+    }
+    else if (auto ife = dynamic_cast<IfExpr *>(e))
+    {
+        if (auto c = as_literal(ife->cond))
+            slot = std::move(literal_value(c) != 0 ? ife->thenExpr : ife->elseExpr);
+    }
+}
+
+// constant folding and strength reduction, bottom-up
+static void fold_constants(Expr::Ptr &root)
+{
+    std::vector<std::pair<Expr::Ptr *, bool>> todo{{&root, false}}; // true: operands done
+    std::vector<Expr::Ptr *> operands;
+    while (!todo.empty())
+    {
+        Expr::Ptr *slot = todo.back().first;
+        bool done = todo.back().second;
+        todo.pop_back();
+        if (done)
+        {
+            fold_node(*slot);
+            continue;
+        }
+        todo.push_back({slot, true});
+        operands.clear();
+        auto bin = dynamic_cast<BinaryExpr *>(slot->get());
+        if (bin && bin->op == "=")
+            operands.push_back(&bin->right); // not the target
+        else
+            push_operand_slots(operands, slot->get());
+        for (auto op : operands)
+            todo.push_back({op, false});
+    }
+}
+
+// Replaces `slot` with `kept` (an empty block if null). A let in the code
+// that goes away may be the only one of a name the rest of the function still
+// assigns or reads, so each name only the dropped code declares stays as a let
+// without a value, which declares the variable and sets nothing.
+static void drop_stmt(Stmt::Ptr &slot, Stmt::Ptr kept = nullptr)
+{
+    std::set<std::string> lost, still;
+    collect_lets(slot.get(), lost);
+    collect_lets(kept.get(), still);
+    std::vector<Stmt::Ptr> lets;
+    for (auto &name : lost)
+        if (!still.count(name))
+            lets.push_back(std::make_unique<LetStmt>(name, "", nullptr));
+    auto block = dynamic_cast<BlockStmt *>(kept.get());
+    if (!kept || (!block && !lets.empty()))
+    {
+        auto wrap = std::make_unique<BlockStmt>();
+        if (kept)
+            wrap->stmts.push_back(std::move(kept));
+        block = wrap.get();
+        kept = std::move(wrap);
+    }
+    for (auto &l : lets)
+        block->stmts.push_back(std::move(l));
+    slot = std::move(kept);
+}
+
+static void fold_constants(Stmt::Ptr &slot);
+
+static void fold_block(BlockStmt *b)
+{
+    if (b)
+        for (auto &s : b->stmts)
+            fold_constants(s);
+}
+
+static void fold_constants(Stmt::Ptr &slot)
+{
+    Stmt *s = slot.get();
+    if (auto b = dynamic_cast<BlockStmt *>(s))
+        fold_block(b);
+    else if (auto l = dynamic_cast<LetStmt *>(s))
+    {
+        if (l->init)
+            fold_constants(l->init);
+    }
+    else if (auto e = dynamic_cast<ExprStmt *>(s))
+        fold_constants(e->expr);
+    else if (auto r = dynamic_cast<ReturnStmt *>(s))
+    {
+        if (r->value)
+            fold_constants(r->value);
+    }
+    else if (auto i = dynamic_cast<IfStmt *>(s))
+    {
+        fold_constants(i->cond);
+        fold_block(i->thenBranch.get());
+        fold_block(i->elseBranch.get());
+        if (auto c = as_literal(i->cond))
+        {
+            std::unique_ptr<BlockStmt> taken = std::move(literal_value(c) != 0 ? i->thenBranch : i->elseBranch);
+            drop_stmt(slot, std::move(taken));
+        }
+    }
+    else if (auto w = dynamic_cast<WhileStmt *>(s))
+    {
+        fold_constants(w->cond);
+        fold_block(w->body.get());
+        auto c = as_literal(w->cond);
+        if (c && literal_value(c) == 0)
+            drop_stmt(slot);
+    }
+}
+
+struct SpecSignature
+{
+    FunctionDecl *callee = nullptr;
+    std::vector<std::string> constants; // per parameter: literal, or "" when passed at run time
+    uint64_t weight = 0;
+    size_t first_seen = 0;
+    std::string clone; // name of the clone, once made
+};
+
+class Specializer
+{
+public:
+    Specializer(Program &program, size_t budget, bool profiled)
+        : program(program), budget(budget), profiled(profiled)
+    {
+    }
+
+    int run()
+    {
+        int made = 0;
+        for (int round = 0; round < 3; ++round)
+        {
+            functions.clear();
+            signatures.clear();
+            for (auto &stmt : program)
+                if (auto f = dynamic_cast<FunctionDecl *>(stmt.get()))
+                {
+                    functions[f->name] = f;
+                    collect_assigned(f->body.get(), assigned[f->name]);
+                }
+            for (auto &stmt : program)
+                scan_stmt(stmt.get(), 1);
+
+            std::vector<SpecSignature *> ranked;
+            for (auto &sig : signatures)
+                ranked.push_back(&sig.second);
+            std::sort(ranked.begin(), ranked.end(), [](const SpecSignature *a, const SpecSignature *b)
+                      { return a->weight != b->weight ? a->weight > b->weight : a->first_seen < b->first_seen; });
+            int round_made = 0;
+            for (auto sig : ranked)
+            {
+                size_t size = count_nodes(sig->callee);
+                if (clones[sig->callee->name] >= 4 || used + size > budget || (profiled && sig->weight == 0))
+                    continue;
+                make_clone(*sig);
+                used += size;
+                round_made++;
+            }
+            if (round_made == 0)
+                break;
+            for (auto &stmt : program)
+                redirect_stmt(stmt.get());
+            made += round_made;
+        }
+        return made;
+    }
+
+private:
+    Program &program;
+    size_t budget, used = 0;
+    bool profiled; // weights are the call counts of --profile-use
+    std::unordered_map<std::string, FunctionDecl *> functions;
+    std::unordered_map<std::string, std::set<std::string>> assigned; // written names per function
+    std::unordered_map<std::string, int> clones;                     // clones made per original
+    std::unordered_map<std::string, SpecSignature> signatures;       // by key()
+    std::unordered_map<std::string, SpecSignature> made;             // every clone so far, by key()
+
+    // signature of a call, or "" when it passes no usable constant
+    std::string key(const CallExpr *c, FunctionDecl *&callee, std::vector<std::string> &constants)
+    {
+        auto id = dynamic_cast<const Identifier *>(c->callee.get());
+        if (!id)
+            return "";
+        auto it = functions.find(id->name);
+        if (it == functions.end() || it->second->params.size() != c->args.size())
+            return "";
+        callee = it->second;
+        constants.assign(c->args.size(), "");
+        std::string k = id->name + "(";
+        bool any = false;
+        for (size_t i = 0; i < c->args.size(); ++i)
+        {
+            auto lit = as_literal(c->args[i]);
+            if (lit && !assigned[id->name].count(callee->params[i].first))
+            {
+                constants[i] = std::to_string(literal_value(lit));
+                any = true;
+            }
+            k += constants[i] + ",";
+        }
+        return any ? k + ")" : "";
+    }
+
+    void scan_expr(const Expr *e, uint64_t weight)
+    {
+        walk_expr(e, [&](const Expr *x)
+                  {
+                      auto c = dynamic_cast<const CallExpr *>(x);
+                      if (!c)
+                          return true;
+                      FunctionDecl *callee;
+                      std::vector<std::string> constants;
+                      std::string k = key(c, callee, constants);
+                      if (!k.empty() && !made.count(k))
+                      {
+                          auto ins = signatures.emplace(k, SpecSignature{});
+                          SpecSignature &sig = ins.first->second;
+                          if (ins.second)
+                          {
+                              sig.callee = callee;
+                              sig.constants = constants;
+                              sig.first_seen = signatures.size();
+                          }
+                          sig.weight += profiled ? c->profile.count : weight;
+                      }
+                      return true;
+                  });
+    }
+
+    void scan_stmt(const Stmt *s, uint64_t weight)
+    {
+        if (!s)
+            return;
+        if (auto f = dynamic_cast<const FunctionDecl *>(s))
+            scan_stmt(f->body.get(), weight);
+        else if (auto b = dynamic_cast<const BlockStmt *>(s))
+        {
+            for (auto &st : b->stmts)
+                scan_stmt(st.get(), weight);
+        }
+        else if (auto l = dynamic_cast<const LetStmt *>(s))
+            scan_expr(l->init.get(), weight);
+        else if (auto e = dynamic_cast<const ExprStmt *>(s))
+            scan_expr(e->expr.get(), weight);
+        else if (auto r = dynamic_cast<const ReturnStmt *>(s))
+            scan_expr(r->value.get(), weight);
+        else if (auto i = dynamic_cast<const IfStmt *>(s))
+        {
+            scan_expr(i->cond.get(), weight);
+            scan_stmt(i->thenBranch.get(), weight);
+            scan_stmt(i->elseBranch.get(), weight);
+        }
+        else if (auto w = dynamic_cast<const WhileStmt *>(s))
+        {
+            uint64_t inner = std::min<uint64_t>(weight * 8, uint64_t(1) << 40);
+            scan_expr(w->cond.get(), inner);
+            scan_stmt(w->body.get(), inner);
+        }
+    }
+
+    void make_clone(SpecSignature &sig)
+    {
+        const FunctionDecl *f = sig.callee;
+        Substitution subst;
+        std::vector<std::pair<std::string, std::string>> params;
+        for (size_t i = 0; i < f->params.size(); ++i)
+        {
+            if (sig.constants[i].empty())
+                params.push_back(f->params[i]);
+            else
+                subst[f->params[i].first] = sig.constants[i];
+        }
+        sig.clone = f->name + "$" + std::to_string(clones[f->name]++);
+        auto clone = std::make_unique<FunctionDecl>(sig.clone, std::move(params), f->returnType,
+                                                    clone_block(f->body.get(), subst));
+        fold_block(clone->body.get());
+        if (profiled) // the calls move from the original to the clone
+        {
+            clone->profile.count = sig.weight;
+            sig.callee->profile.count -= std::min(sig.callee->profile.count, sig.weight);
+        }
+
+        std::string k = f->name + "(";
+        for (auto &c : sig.constants)
+            k += c + ",";
+        made[k + ")"] = sig;
+
+        // right after the original, so the output keeps source order
+        for (size_t i = 0; i < program.size(); ++i)
+            if (program[i].get() == f)
+            {
+                program.insert(program.begin() + i + 1 + (clones[f->name] - 1), std::move(clone));
+                break;
+            }
+    }
+
+    // calls are redirected after their arguments
+    void redirect_expr(Expr *e)
+    {
+        walk_expr(e, [](Expr *) { return true; }, [&](Expr *x)
+                  {
+                      auto c = dynamic_cast<CallExpr *>(x);
+                      if (!c)
+                          return;
+                      FunctionDecl *callee;
+                      std::vector<std::string> constants;
+                      auto it = made.find(key(c, callee, constants));
+                      if (it == made.end())
+                          return;
+                      std::vector<Expr::Ptr> args;
+                      for (size_t i = 0; i < c->args.size(); ++i)
+                          if (it->second.constants[i].empty())
+                              args.push_back(std::move(c->args[i]));
+                      c->args = std::move(args);
+                      c->callee = std::make_unique<Identifier>(it->second.clone);
+                  });
+    }
+
+    void redirect_stmt(Stmt *s)
+    {
+        if (!s)
+            return;
+        if (auto f = dynamic_cast<FunctionDecl *>(s))
+            redirect_stmt(f->body.get());
+        else if (auto b = dynamic_cast<BlockStmt *>(s))
+        {
+            for (auto &st : b->stmts)
+                redirect_stmt(st.get());
+        }
+        else if (auto l = dynamic_cast<LetStmt *>(s))
+            redirect_expr(l->init.get());
+        else if (auto e = dynamic_cast<ExprStmt *>(s))
+            redirect_expr(e->expr.get());
+        else if (auto r = dynamic_cast<ReturnStmt *>(s))
+            redirect_expr(r->value.get());
+        else if (auto i = dynamic_cast<IfStmt *>(s))
+        {
+            redirect_expr(i->cond.get());
+            redirect_stmt(i->thenBranch.get());
+            redirect_stmt(i->elseBranch.get());
+        }
+        else if (auto w = dynamic_cast<WhileStmt *>(s))
+        {
+            redirect_expr(w->cond.get());
+            redirect_stmt(w->body.get());
+        }
+    }
+};
+
+int specialize_calls(Program &program, unsigned budget_percent, bool profiled)
+{
+    size_t total = 0;
+    for (auto &stmt : program)
+        total += count_nodes(stmt.get());
+    // small programs get room for a few clones whatever their size
+    size_t budget = budget_percent == 0 ? 0 : std::max<size_t>(256, total * budget_percent / 100);
+    return Specializer(program, budget, profiled).run();
+}
+
+// ---------------- Common Subexpression Elimination ----------------
+//
+// Value numbering over each function's statements in execution order. An
+// expression's value number is a structural key with the operands of
+// commutative operators sorted, so a*b and b*a share one. A table maps the
+// keys available at the current point to the place they were computed.
+// When an expression is found in the table, that first occurrence becomes
+// ($cseN = e) and this one reads $cseN. Both stay where they were, so the
+// evaluation order (and any trap) is exactly the original one.
+//
+// Assigning to a variable kills the entries that read it. Calls cannot write
+// a caller's locals, so they only kill entries that read names which are not
+// locals of the function: globals. Control flow follows the AST:
+// - inside an if, each branch starts from the table after the condition;
+//   after the if, that table minus whatever either branch assigns;
+// - a while first drops the entries whose operands the loop assigns, and
+//   after the loop the table is the one left by the condition, which runs
+//   last.
+// Only expressions of pure arithmetic on locals and literals are candidates,
+// and only when they are worth a temporary: two cheap operators, or one
+// multiply, divide or remainder.
+
+struct CseEntry
+{
+    Expr::Ptr *def;            // first occurrence, wrapped on first reuse
+    std::string temp;          // empty until reused
+    std::shared_ptr<const std::set<std::string>> reads;
+};
+
+// value number of a candidate, its cost and the names it reads; ok = false
+// if the expression is not pure arithmetic
+struct CseValue
+{
+    bool ok = false;
+    int number = 0;
+    int cost = 0;
+    std::shared_ptr<const std::set<std::string>> reads;
+};
+
+using CseTable = std::unordered_map<int, size_t>; // value number -> index into entries
+
+class CseFunction
+{
+public:
+    CseFunction(FunctionDecl &f, const std::set<std::string> &globals) : f(f)
+    {
+        for (auto &p : f.params)
+            locals.insert(p.first);
+        std::set<std::string> written;
+        collect_assigned(f.body.get(), written);
+        std::set<std::string> visible = visible_globals(globals, f);
+        for (auto &name : written)
+            if (!visible.count(name))
+                locals.insert(name);
+    }
+
+    int run()
+    {
+        CseTable table;
+        block(f.body.get(), table);
+        // declare the temporaries; each is assigned before any read
+        std::vector<Stmt::Ptr> decls;
+        for (auto &e : entries)
+            if (!e.temp.empty())
+                decls.push_back(std::make_unique<LetStmt>(e.temp, "", nullptr));
+        f.body->stmts.insert(f.body->stmts.begin(), std::make_move_iterator(decls.begin()),
+                             std::make_move_iterator(decls.end()));
+        return eliminated;
+    }
+
+private:
+    FunctionDecl &f;
+    std::set<std::string> locals;
+    std::vector<CseEntry> entries;
+    int eliminated = 0;
+    static int temp_count;
+
+    // Equal candidates get equal numbers: a literal or name is numbered by
+    // its text, an operator by its operands' numbers (sorted if it commutes).
+    // Values are computed once per node, so a chain of n operators costs O(n)
+    // rather than rebuilding a key string at every level; nodes replaced by
+    // a temporary are kept in `replaced` so their addresses stay unique.
+    std::unordered_map<std::string, int> numbers;
+    std::unordered_map<const Expr *, CseValue> values;
+    std::vector<Expr::Ptr> replaced;
+
+    int number(const std::string &key) { return numbers.emplace(key, static_cast<int>(numbers.size())).first->second; }
+
+    const CseValue &value(const Expr *root)
+    {
+        auto enter = [&](const Expr *x)
+        {
+            if (values.count(x))
+                return false;
+            auto bin = dynamic_cast<const BinaryExpr *>(x);
+            if (bin && bin->op != "=")
+                return true;
+            CseValue &v = values[x];
+            if (auto n = dynamic_cast<const NumberLiteral *>(x))
+            {
+                v = {true, number(std::to_string(literal_value(n))), 0, std::make_shared<std::set<std::string>>()};
+            }
+            else if (auto id = dynamic_cast<const Identifier *>(x))
+            {
+                v = {true, number("$" + id->name), 0,
+                     std::make_shared<std::set<std::string>>(std::set<std::string>{id->name})};
+            }
+            return false;
+        };
+        auto leave = [&](const Expr *x)
+        {
+            auto bin = static_cast<const BinaryExpr *>(x);
+            const CseValue &l = values[bin->left.get()], &r = values[bin->right.get()];
+            CseValue v;
+            if (l.ok && r.ok)
+            {
+                const std::string &op = bin->op;
+                bool commutes = op == "+" || op == "*" || op == "&" || op == "|" || op == "^" || op == "==" ||
+                                op == "!=" || op == "&&" || op == "||";
+                int a = l.number, b = r.number;
+                if (commutes && b < a)
+                    std::swap(a, b);
+                v.ok = true;
+                v.number = number("(" + op + " " + std::to_string(a) + " " + std::to_string(b) + ")");
+                v.cost = l.cost + r.cost + (op == "/" || op == "%" ? 20 : op == "*" ? 3 : 1);
+                if (std::includes(l.reads->begin(), l.reads->end(), r.reads->begin(), r.reads->end()))
+                    v.reads = l.reads;
+                else if (std::includes(r.reads->begin(), r.reads->end(), l.reads->begin(), l.reads->end()))
+                    v.reads = r.reads;
+                else
+                {
+                    auto both = std::make_shared<std::set<std::string>>(*l.reads);
+                    both->insert(r.reads->begin(), r.reads->end());
+                    v.reads = both;
+                }
+            }
+            values[x] = v;
+        };
+        walk_expr(root, enter, leave);
+        return values[root];
+    }
+
+    void kill(CseTable &table, const std::string &name)
+    {
+        for (auto it = table.begin(); it != table.end();)
+            it = entries[it->second].reads->count(name) ? table.erase(it) : std::next(it);
+    }
+
+    void kill_all(CseTable &table, const std::set<std::string> &names)
+    {
+        for (auto &n : names)
+            kill(table, n);
+    }
+
+    // operands before the node they belong to, each from an explicit stack;
+    // only the branches of an if recurse
+    void expr(Expr::Ptr &root, CseTable &table)
+    {
+        std::vector<std::pair<Expr::Ptr *, bool>> todo{{&root, false}}; // true: operands done
+        std::vector<Expr::Ptr *> operands;
+        while (!todo.empty())
+        {
+            Expr::Ptr &slot = *todo.back().first;
+            bool done = todo.back().second;
+            todo.pop_back();
+            Expr *e = slot.get();
+            if (!e)
+                continue;
+            auto bin = dynamic_cast<BinaryExpr *>(e);
+
+            if (done)
+            {
+                if (bin && bin->op == "=")
+                {
+                    if (auto id = dynamic_cast<Identifier *>(bin->left.get()))
+                        kill(table, id->name);
+                }
+                else if (bin)
+                {
+                    const CseValue &v = values[e];
+                    if (v.ok && v.cost >= 2)
+                    {
+                        table[v.number] = entries.size();
+                        entries.push_back({&slot, "", v.reads});
+                    }
+                }
+                else if (dynamic_cast<CallExpr *>(e))
+                {
+                    for (auto it = table.begin(); it != table.end();)
+                    {
+                        bool global = false;
+                        for (auto &name : *entries[it->second].reads)
+                            global |= !locals.count(name);
+                        it = global ? table.erase(it) : std::next(it);
+                    }
+                }
+                continue;
+            }
+
+            if (bin)
+            {
+                const CseValue &v = value(e);
+                auto hit = v.ok && v.cost >= 2 ? table.find(v.number) : table.end();
+                if (hit != table.end())
+                {
+                    CseEntry &entry = entries[hit->second];
+                    if (entry.temp.empty())
+                    {
+                        entry.temp = "$cse" + std::to_string(temp_count++);
+                        *entry.def = std::make_unique<BinaryExpr>("=", std::make_unique<Identifier>(entry.temp),
+                                                                  std::move(*entry.def));
+                    }
+                    replaced.push_back(std::move(slot));
+                    slot = std::make_unique<Identifier>(entry.temp);
+                    eliminated++;
+                    continue;
+                }
+            }
+            if (auto ife = dynamic_cast<IfExpr *>(e))
+            {
+                expr(ife->cond, table);
+                CseTable then_table = table, else_table = table;
+                expr(ife->thenExpr, then_table);
+                expr(ife->elseExpr, else_table);
+                std::set<std::string> written;
+                collect_assigned_expr(ife->thenExpr.get(), written);
+                collect_assigned_expr(ife->elseExpr.get(), written);
+                kill_all(table, written);
+                continue;
+            }
+            todo.push_back({&slot, true});
+            operands.clear();
+            if (bin && bin->op == "=")
+                operands.push_back(&bin->right);
+            else
+                push_operand_slots(operands, e);
+            for (auto op : operands)
+                todo.push_back({op, false});
+        }
+    }
+
+    void block(BlockStmt *b, CseTable &table)
+    {
+        if (b)
+            for (auto &s : b->stmts)
+                stmt(s.get(), table);
+    }
+
+    void stmt(Stmt *s, CseTable &table)
+    {
+        if (auto b = dynamic_cast<BlockStmt *>(s))
+            block(b, table);
+        else if (auto l = dynamic_cast<LetStmt *>(s))
+        {
+            if (l->init)
+                expr(l->init, table);
+            kill(table, l->name);
+        }
+        else if (auto e = dynamic_cast<ExprStmt *>(s))
+            expr(e->expr, table);
+        else if (auto r = dynamic_cast<ReturnStmt *>(s))
+        {
+            if (r->value)
+                expr(r->value, table);
+        }
+        else if (auto i = dynamic_cast<IfStmt *>(s))
+        {
+            expr(i->cond, table);
+            CseTable then_table = table, else_table = table;
+            block(i->thenBranch.get(), then_table);
+            block(i->elseBranch.get(), else_table);
+            std::set<std::string> written;
+            collect_assigned(i->thenBranch.get(), written);
+            collect_assigned(i->elseBranch.get(), written);
+            kill_all(table, written);
+        }
+        else if (auto w = dynamic_cast<WhileStmt *>(s))
+        {
+            std::set<std::string> written;
+            collect_assigned_expr(w->cond.get(), written);
+            collect_assigned(w->body.get(), written);
+            kill_all(table, written);
+            expr(w->cond, table);
+            CseTable body_table = table;
+            block(w->body.get(), body_table);
+        }
+    }
+};
+
+int CseFunction::temp_count = 0;
+
+std::vector<std::pair<std::string, int>> eliminate_common_subexpressions(Program &program)
+{
+    std::vector<std::pair<std::string, int>> counts;
+    std::set<std::string> globals = global_names(program);
+    for (auto &stmt : program)
+        if (auto f = dynamic_cast<FunctionDecl *>(stmt.get()))
+            counts.push_back({f->name, CseFunction(*f, globals).run()});
+    return counts;
+}
+
+// ---------------- Loop Unrolling ----------------
+//
+// A while loop is counted when its condition compares an induction variable
+// i with a literal or a local the loop never writes, using < or <= when the
+// body ends in `i = i + c` and > or >= when it ends in `i = i - c` (c a
+// positive literal), and nothing else in the loop writes i. Repeating the
+// body k times per test runs the same iterations as long as the test checks
+// that the last copy will run too: `i < n` becomes `i < n - (k-1)*c`, with
+// the new bound computed once before the loop and used only if it did not
+// wrap. A remainder loop with the original test runs what is left.
+//
+// When i is set to a literal right before the loop and the bound is a
+// literal, the trip count is known. Up to 16 iterations are unrolled fully:
+// the loop becomes straight-line copies of the body with i replaced by its
+// value in each, then folded. Otherwise the remainder loop is dropped when k
+// divides the trip count.
+//
+// Only innermost loops are unrolled (after their own inner loops have been
+// unrolled fully), by 8 when the body is small and by 4 otherwise, and all
+// copies together may grow the program by the budget. With a profile, loops
+// that never iterated are left alone and a loop is unrolled by k only if it
+// averaged at least k iterations per entry.
+
+struct CountedLoop
+{
+    std::string var;             // induction variable
+    int64_t step = 0;            // added per iteration, negative when counting down
+    std::string op;              // the loop runs while `var op bound`
+    const Expr *bound = nullptr; // NumberLiteral or Identifier
+};
+
+static bool has_loop(const Stmt *s)
+{
+    if (dynamic_cast<const WhileStmt *>(s))
+        return true;
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            if (has_loop(st.get()))
+                return true;
+        return false;
+    }
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+        return has_loop(i->thenBranch.get()) || (i->elseBranch && has_loop(i->elseBranch.get()));
+    return false;
+}
+
+static bool match_counted(const WhileStmt *w, const std::set<std::string> &locals, CountedLoop &loop)
+{
+    auto cond = dynamic_cast<const BinaryExpr *>(w->cond.get());
+    auto &body = w->body->stmts;
+    if (!cond || body.empty())
+        return false;
+    static const std::unordered_map<std::string, std::string> mirrored = {
+        {"<", ">"}, {"<=", ">="}, {">", "<"}, {">=", "<="}};
+    auto m = mirrored.find(cond->op);
+    if (m == mirrored.end())
+        return false;
+    const Expr *var = cond->left.get(), *bound = cond->right.get();
+    loop.op = cond->op;
+    if (!dynamic_cast<const Identifier *>(var))
+    {
+        std::swap(var, bound);
+        loop.op = m->second;
+    }
+    auto id = dynamic_cast<const Identifier *>(var);
+    auto limit = dynamic_cast<const Identifier *>(bound);
+    if (!id || !locals.count(id->name) || (!limit && !dynamic_cast<const NumberLiteral *>(bound)) ||
+        (limit && (!locals.count(limit->name) || limit->name == id->name)))
+        return false;
+    loop.var = id->name;
+    loop.bound = bound;
+
+    // the body ends in var = var + c, var = c + var or var = var - c
+    auto inc = dynamic_cast<const ExprStmt *>(body.back().get());
+    auto set = inc ? dynamic_cast<const BinaryExpr *>(inc->expr.get()) : nullptr;
+    auto target = set && set->op == "=" ? dynamic_cast<const Identifier *>(set->left.get()) : nullptr;
+    auto step = target && target->name == loop.var ? dynamic_cast<const BinaryExpr *>(set->right.get()) : nullptr;
+    if (!step || (step->op != "+" && step->op != "-"))
+        return false;
+    const Expr *l = step->left.get(), *r = step->right.get();
+    if (step->op == "+" && dynamic_cast<const NumberLiteral *>(l))
+        std::swap(l, r);
+    auto self = dynamic_cast<const Identifier *>(l);
+    auto c = dynamic_cast<const NumberLiteral *>(r);
+    if (!self || self->name != loop.var || !c)
+        return false;
+    int64_t k = literal_value(c);
+    if (k <= 0 || k > (1 << 20))
+        return false;
+    loop.step = step->op == "+" ? k : -k;
+    if ((loop.step > 0) != (loop.op[0] == '<'))
+        return false;
+
+    // nothing else writes the variable or the bound
+    std::set<std::string> written;
+    for (size_t n = 0; n + 1 < body.size(); ++n)
+        collect_assigned(body[n].get(), written);
+    return !written.count(loop.var) && !(limit && written.count(limit->name));
+}
+
+// literal the statement right before the loop gives the variable, if any
+static bool initial_value(const Stmt *prev, const std::string &var, int64_t &out)
+{
+    const Expr *init = nullptr;
+    if (auto l = dynamic_cast<const LetStmt *>(prev))
+        init = l->name == var ? l->init.get() : nullptr;
+    else if (auto e = dynamic_cast<const ExprStmt *>(prev))
+    {
+        auto set = dynamic_cast<const BinaryExpr *>(e->expr.get());
+        auto target = set && set->op == "=" ? dynamic_cast<const Identifier *>(set->left.get()) : nullptr;
+        init = target && target->name == var ? set->right.get() : nullptr;
+    }
+    auto lit = dynamic_cast<const NumberLiteral *>(init);
+    if (lit)
+        out = literal_value(lit);
+    return lit != nullptr;
+}
+
+// iterations of the loop from `start` to a literal bound; -1 when the
+// variable would wrap around before the test fails
+static int64_t trip_count(const CountedLoop &loop, int64_t start, int64_t bound)
+{
+    __int128 step = loop.step;
+    __int128 dist = step > 0 ? static_cast<__int128>(bound) - start : static_cast<__int128>(start) - bound;
+    __int128 stride = step > 0 ? step : -step;
+    bool inclusive = loop.op.size() == 2;
+    if (dist < 0 || (dist == 0 && !inclusive))
+        return 0;
+    __int128 n = inclusive ? dist / stride + 1 : (dist + stride - 1) / stride;
+    __int128 end = start + n * step; // first value that fails the test
+    if (end > INT64_MAX || end < INT64_MIN)
+        return -1;
+    return static_cast<int64_t>(n);
+}
+
+class Unroller
+{
+public:
+    Unroller(size_t budget, unsigned factor, bool profiled) : budget(budget), factor(factor), profiled(profiled) {}
+
+    int full = 0, partial = 0;
+
+    // a global is never the induction variable or the bound: calls in the
+    // body may write it
+    void run(FunctionDecl &f, const std::set<std::string> &globals)
+    {
+        locals.clear();
+        for (auto &p : f.params)
+            locals.insert(p.first);
+        std::set<std::string> written;
+        collect_assigned(f.body.get(), written);
+        std::set<std::string> visible = visible_globals(globals, f);
+        for (auto &name : written)
+            if (!visible.count(name))
+                locals.insert(name);
+        unroll_block(f.body.get());
+    }
+
+private:
+    static const int64_t max_full_trips = 16;
+    static const size_t small_body = 20; // nodes; smaller bodies are unrolled by 8
+    static int temp_count;
+
+    size_t budget;
+    unsigned factor; // 0: 8 or 4 by body size
+    bool profiled;   // loop counts of --profile-use are available
+    std::set<std::string> locals;
+
+    void unroll_block(BlockStmt *blk)
+    {
+        for (size_t i = 0; i < blk->stmts.size(); ++i)
+        {
+            Stmt *s = blk->stmts[i].get();
+            if (auto b = dynamic_cast<BlockStmt *>(s))
+                unroll_block(b);
+            else if (auto iff = dynamic_cast<IfStmt *>(s))
+            {
+                unroll_block(iff->thenBranch.get());
+                if (iff->elseBranch)
+                    unroll_block(iff->elseBranch.get());
+            }
+            else if (auto w = dynamic_cast<WhileStmt *>(s))
+            {
+                unroll_block(w->body.get());
+                CountedLoop loop;
+                if (!has_loop(w->body.get()) && !(profiled && w->profile.taken == 0) &&
+                    match_counted(w, locals, loop))
+                    unroll(blk->stmts[i], i > 0 ? blk->stmts[i - 1].get() : nullptr, loop);
+            }
+        }
+    }
+
+    // the first `count` statements of the body with `subst` applied; copies
+    // after the first assign the body's lets instead of declaring them again
+    static void append_copy(const BlockStmt *body, size_t count, const Substitution &subst, bool first,
+                            std::vector<Stmt::Ptr> &out)
+    {
+        for (size_t n = 0; n < count; ++n)
+        {
+            auto l = dynamic_cast<const LetStmt *>(body->stmts[n].get());
+            if (l && !first)
+            {
+                if (l->init)
+                    out.push_back(std::make_unique<ExprStmt>(std::make_unique<BinaryExpr>(
+                        "=", std::make_unique<Identifier>(l->name), clone_expr(l->init.get(), subst))));
+                continue;
+            }
+            out.push_back(clone_stmt(body->stmts[n].get(), subst));
+        }
+    }
+
+    void unroll(Stmt::Ptr &slot, const Stmt *prev, const CountedLoop &loop)
+    {
+        auto w = static_cast<WhileStmt *>(slot.get());
+        const BlockStmt *body = w->body.get();
+        size_t size = count_nodes(body);
+        auto bound = dynamic_cast<const NumberLiteral *>(loop.bound);
+        int64_t start = 0, trips = -1;
+        if (bound && initial_value(prev, loop.var, start))
+            trips = trip_count(loop, start, literal_value(bound));
+
+        auto out = std::make_unique<BlockStmt>();
+        if (trips >= 0 && trips <= max_full_trips && size * trips <= budget + size)
+        {
+            // straight-line copies without the increment, then the final value
+            for (int64_t n = 0; n < trips; ++n)
+                append_copy(body, body->stmts.size() - 1, {{loop.var, std::to_string(start + n * loop.step)}},
+                            n == 0, out->stmts);
+            out->stmts.push_back(std::make_unique<ExprStmt>(std::make_unique<BinaryExpr>(
+                "=", std::make_unique<Identifier>(loop.var), make_literal(start + trips * loop.step))));
+            fold_block(out.get());
+            budget -= std::min(budget, size * std::max<int64_t>(trips - 1, 0));
+            ++full;
+            drop_stmt(slot, std::move(out)); // no copy at all when trips == 0
+            return;
+        }
+
+        auto remainder = [&](unsigned k) { return trips < 0 || trips % k != 0; };
+        auto growth = [&](unsigned k) { return size * (remainder(k) ? k : k - 1); };
+        auto fits = [&](unsigned k)
+        {
+            return growth(k) <= budget && (trips < 0 || trips >= k) &&
+                   (!profiled || w->profile.taken >= k * std::max<uint64_t>(w->profile.count, 1));
+        };
+        unsigned k = factor ? factor : size <= small_body ? 8 : 4;
+        if (!factor && k == 8 && !fits(8))
+            k = 4;
+        if (!fits(k))
+            return;
+
+        // the test of the unrolled loop holds only if the last copy's would
+        int64_t reach = (static_cast<int64_t>(k) - 1) * loop.step;
+        std::string along = loop.step > 0 ? "-" : "+", wraps = loop.step > 0 ? "<" : ">";
+        Expr::Ptr limit;
+        std::unique_ptr<IfStmt> guard;
+        if (bound)
+        {
+            int64_t b = literal_value(bound), v;
+            fold_binary("-", b, reach, v);
+            if (loop.step > 0 ? v >= b : v <= b)
+                return;
+            limit = make_literal(v);
+        }
+        else
+        {
+            std::string temp = "$unroll" + std::to_string(temp_count++);
+            const std::string &n = static_cast<const Identifier *>(loop.bound)->name;
+            out->stmts.push_back(std::make_unique<LetStmt>(
+                temp, "", std::make_unique<BinaryExpr>(along, std::make_unique<Identifier>(n),
+                                                       make_literal(reach > 0 ? reach : -reach))));
+            limit = std::make_unique<Identifier>(temp);
+            guard = std::make_unique<IfStmt>(std::make_unique<BinaryExpr>(wraps, std::make_unique<Identifier>(temp),
+                                                                          std::make_unique<Identifier>(n)),
+                                             std::make_unique<BlockStmt>(), nullptr);
+        }
+
+        auto copies = std::make_unique<BlockStmt>();
+        for (unsigned n = 0; n < k; ++n)
+            append_copy(body, body->stmts.size(), {}, n == 0, copies->stmts);
+        auto fast = std::make_unique<WhileStmt>(
+            std::make_unique<BinaryExpr>(loop.op, std::make_unique<Identifier>(loop.var), std::move(limit)),
+            std::move(copies));
+        fast->profile.count = w->profile.count;
+        fast->profile.taken = w->profile.taken / k;
+        if (guard)
+        {
+            guard->thenBranch->stmts.push_back(std::move(fast));
+            out->stmts.push_back(std::move(guard));
+        }
+        else
+            out->stmts.push_back(std::move(fast));
+        budget -= growth(k);
+        if (remainder(k))
+            out->stmts.push_back(std::move(slot));
+        ++partial;
+        slot = std::move(out);
+    }
+};
+
+int Unroller::temp_count = 0;
+
+std::pair<int, int> unroll_loops(Program &program, unsigned factor, unsigned budget_percent, bool profiled)
+{
+    size_t total = 0;
+    for (auto &stmt : program)
+        total += count_nodes(stmt.get());
+    // a few KB of copies are worth it in any program
+    size_t budget = budget_percent == 0 ? 0 : std::max<size_t>(1024, total * budget_percent / 100);
+    Unroller unroller(budget, factor, profiled);
+    std::set<std::string> globals = global_names(program);
+    for (auto &stmt : program)
+        if (auto f = dynamic_cast<FunctionDecl *>(stmt.get()))
+            unroller.run(*f, globals);
+    return {unroller.full, unroller.partial};
+}
+
+// ---------------- Code Layout ----------------
+//
+// Decides where code goes; codegen reads the result from the ProfileSites.
+// Without a profile, if and while sites get estimated counts from Ball-Larus
+// style heuristics: a loop iterates about eight times, a test for equality
+// or for "less than zero" fails, and a branch that returns is the less
+// likely one when the other does not. The likely side then falls through and
+// loops are tested at the bottom. With a profile, functions that never ran
+// and the unlikely side of a branch that ran at most 1 in 64 tests are
+// marked cold and moved to .text.cold.
+//
+// Functions are ordered Pettis-Hansen style: call graph edges, weighted by
+// call counts or by x8 per enclosing loop, are taken heaviest first and join
+// the chains of their two functions, choosing the concatenation that puts
+// the caller and callee closest; the chains are then emitted hottest first,
+// ties in source order. Callers and their hot callees end up on the same
+// pages and cache lines.
+
+static const uint64_t estimate_tests = 100; // estimated counts are per this many tests
+
+// opcode heuristic: percent of tests expected to succeed, -1 if it does not apply
+static int estimate_condition(const Expr *cond)
+{
+    auto bin = dynamic_cast<const BinaryExpr *>(cond);
+    if (!bin)
+        return -1;
+    auto zero = [](const Expr::Ptr &e)
+    {
+        auto n = dynamic_cast<const NumberLiteral *>(e.get());
+        return n && literal_value(n) == 0;
+    };
+    const std::string &op = bin->op;
+    if (op == "==")
+        return 16;
+    if (op == "!=")
+        return 84;
+    if (((op == "<" || op == "<=") && zero(bin->right)) || ((op == ">" || op == ">=") && zero(bin->left)))
+        return 16;
+    if (((op == ">" || op == ">=") && zero(bin->right)) || ((op == "<" || op == "<=") && zero(bin->left)))
+        return 84;
+    return -1;
+}
+
+static void estimate(ProfileSite &p, int percent)
+{
+    if (percent < 0)
+        return;
+    p.count = estimate_tests;
+    p.taken = estimate_tests * percent / 100;
+}
+
+// a side that runs at most 1 in 64 tests is cold
+static bool rarely(uint64_t runs, uint64_t tests) { return tests > 0 && runs * 64 <= tests; }
+
+// the side codegen moves out of line (taken less or more than half the tests)
+static void mark_cold(ProfileSite &p, bool has_else)
+{
+    uint64_t skipped = p.count - std::min(p.taken, p.count);
+    p.cold = p.taken * 2 < p.count ? rarely(p.taken, p.count)
+                                   : p.taken * 2 > p.count && has_else && rarely(skipped, p.count);
+}
+
+static void layout_stmt(Stmt *s, bool profiled);
+
+static void layout_expr(Expr *e, bool profiled)
+{
+    walk_expr(e, [](Expr *) { return true; }, [&](Expr *x)
+              {
+                  auto ife = dynamic_cast<IfExpr *>(x);
+                  if (!ife)
+                      return;
+                  if (profiled)
+                      mark_cold(ife->profile, true);
+                  else
+                      estimate(ife->profile, estimate_condition(ife->cond.get()));
+              });
+}
+
+static void layout_stmt(Stmt *s, bool profiled)
+{
+    if (!s)
+        return;
+    if (auto f = dynamic_cast<FunctionDecl *>(s))
+    {
+        f->profile.cold = profiled && f->profile.count == 0;
+        layout_stmt(f->body.get(), profiled);
+    }
+    else if (auto b = dynamic_cast<BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            layout_stmt(st.get(), profiled);
+    }
+    else if (auto l = dynamic_cast<LetStmt *>(s))
+        layout_expr(l->init.get(), profiled);
+    else if (auto e = dynamic_cast<ExprStmt *>(s))
+        layout_expr(e->expr.get(), profiled);
+    else if (auto r = dynamic_cast<ReturnStmt *>(s))
+        layout_expr(r->value.get(), profiled);
+    else if (auto i = dynamic_cast<IfStmt *>(s))
+    {
+        layout_expr(i->cond.get(), profiled);
+        layout_stmt(i->thenBranch.get(), profiled);
+        layout_stmt(i->elseBranch.get(), profiled);
+        if (profiled)
+        {
+            mark_cold(i->profile, i->elseBranch != nullptr);
+            return;
+        }
+        int percent = estimate_condition(i->cond.get());
+        bool then_returns = always_returns(i->thenBranch.get());
+        bool else_returns = i->elseBranch && always_returns(i->elseBranch.get());
+        if (percent < 0 && then_returns != else_returns)
+            percent = then_returns ? 28 : 72;
+        estimate(i->profile, percent);
+    }
+    else if (auto w = dynamic_cast<WhileStmt *>(s))
+    {
+        layout_expr(w->cond.get(), profiled);
+        layout_stmt(w->body.get(), profiled);
+        if (!profiled)
+        {
+            w->profile.count = estimate_tests;
+            w->profile.taken = estimate_tests * 8;
+        }
+    }
+}
+
+// (callee, weight) of every call in a function body
+static void collect_calls(const Expr *e, uint64_t weight, bool profiled,
+                          std::vector<std::pair<std::string, uint64_t>> &out)
+{
+    walk_expr(e, [&](const Expr *x)
+              {
+                  auto c = dynamic_cast<const CallExpr *>(x);
+                  auto id = c ? dynamic_cast<const Identifier *>(c->callee.get()) : nullptr;
+                  if (id)
+                      out.push_back({id->name, profiled ? c->profile.count : weight});
+                  return true;
+              });
+}
+
+static void collect_calls(const Stmt *s, uint64_t weight, bool profiled,
+                          std::vector<std::pair<std::string, uint64_t>> &out)
+{
+    if (!s)
+        return;
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            collect_calls(st.get(), weight, profiled, out);
+    }
+    else if (auto l = dynamic_cast<const LetStmt *>(s))
+        collect_calls(l->init.get(), weight, profiled, out);
+    else if (auto e = dynamic_cast<const ExprStmt *>(s))
+        collect_calls(e->expr.get(), weight, profiled, out);
+    else if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        collect_calls(r->value.get(), weight, profiled, out);
+    else if (auto i = dynamic_cast<const IfStmt *>(s))
+    {
+        collect_calls(i->cond.get(), weight, profiled, out);
+        collect_calls(i->thenBranch.get(), weight, profiled, out);
+        collect_calls(i->elseBranch.get(), weight, profiled, out);
+    }
+    else if (auto w = dynamic_cast<const WhileStmt *>(s))
+    {
+        uint64_t inner = std::min<uint64_t>(weight * 8, uint64_t(1) << 40);
+        collect_calls(w->cond.get(), inner, profiled, out);
+        collect_calls(w->body.get(), inner, profiled, out);
+    }
+}
+
+static void order_functions(Program &program, bool profiled)
+{
+    std::vector<size_t> positions;
+    std::vector<Stmt::Ptr> functions;
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = 0; i < program.size(); ++i)
+        if (auto f = dynamic_cast<FunctionDecl *>(program[i].get()))
+        {
+            index[f->name] = functions.size();
+            positions.push_back(i);
+            functions.push_back(std::move(program[i]));
+        }
+    auto decl = [&](size_t i) { return static_cast<const FunctionDecl *>(functions[i].get()); };
+
+    // undirected edges; the map keeps ties in source order
+    std::map<std::pair<size_t, size_t>, uint64_t> edges;
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        // an original whose calls all went to clones keeps stale site counts
+        if (profiled && decl(i)->profile.count == 0)
+            continue;
+        std::vector<std::pair<std::string, uint64_t>> calls;
+        collect_calls(decl(i)->body.get(), 1, profiled, calls);
+        for (auto &c : calls)
+        {
+            auto it = index.find(c.first);
+            if (it != index.end() && it->second != i && c.second > 0)
+                edges[{std::min(i, it->second), std::max(i, it->second)}] += c.second;
+        }
+    }
+    std::vector<std::pair<std::pair<size_t, size_t>, uint64_t>> heaviest(edges.begin(), edges.end());
+    std::stable_sort(heaviest.begin(), heaviest.end(),
+                     [](const std::pair<std::pair<size_t, size_t>, uint64_t> &a,
+                        const std::pair<std::pair<size_t, size_t>, uint64_t> &b) { return a.second > b.second; });
+
+    std::vector<std::vector<size_t>> chains(functions.size());
+    std::vector<size_t> chain_of(functions.size());
+    std::vector<uint64_t> heat(functions.size()); // edge weight inside the chain, or its hottest entry count
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        chains[i] = {i};
+        chain_of[i] = i;
+        heat[i] = profiled ? decl(i)->profile.count : 0;
+    }
+    for (auto &e : heaviest)
+    {
+        size_t ca = chain_of[e.first.first], cb = chain_of[e.first.second];
+        if (ca == cb)
+            continue;
+        std::vector<size_t> &a = chains[ca], &b = chains[cb];
+        size_t pa = std::find(a.begin(), a.end(), e.first.first) - a.begin();
+        size_t pb = std::find(b.begin(), b.end(), e.first.second) - b.begin();
+        // functions between the two ends in a+b, a+rev(b), rev(a)+b, rev(a)+rev(b)
+        size_t tail_a = a.size() - 1 - pa, tail_b = b.size() - 1 - pb;
+        size_t gaps[4] = {tail_a + pb, tail_a + tail_b, pa + pb, pa + tail_b};
+        int best = static_cast<int>(std::min_element(gaps, gaps + 4) - gaps);
+        if (best >= 2)
+            std::reverse(a.begin(), a.end());
+        if (best % 2)
+            std::reverse(b.begin(), b.end());
+        for (size_t f : b)
+            chain_of[f] = ca;
+        a.insert(a.end(), b.begin(), b.end());
+        b.clear();
+        heat[ca] = profiled ? std::max(heat[ca], heat[cb]) : heat[ca] + heat[cb] + e.second;
+    }
+
+    std::vector<size_t> order; // chain ids by their first function in source order
+    for (size_t i = 0; i < functions.size(); ++i)
+        if (std::find(order.begin(), order.end(), chain_of[i]) == order.end())
+            order.push_back(chain_of[i]);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return heat[a] > heat[b]; });
+
+    std::vector<Stmt::Ptr> ordered;
+    for (size_t c : order)
+        for (size_t f : chains[c])
+            ordered.push_back(std::move(functions[f]));
+    for (size_t i = 0; i < positions.size(); ++i)
+        program[positions[i]] = std::move(ordered[i]);
+}
+
+void layout_program(Program &program, bool profiled)
+{
+    for (auto &s : program)
+        layout_stmt(s.get(), profiled);
+    order_functions(program, profiled);
+}
+
+// ---------------- Driver ----------------
+void optimize_program(Program &program, const OptimizeOptions &opts)
+{
+    int folded = 0, clones = 0;
+    if (opts.ctfe)
+        folded = evaluate_constant_calls(program, opts.ctfe_fuel);
+    if (opts.specialize)
+        clones = specialize_calls(program, opts.specialize_budget, opts.profile);
+    if (opts.ctfe && clones > 0) // clones may call pure functions with constants now
+        folded += evaluate_constant_calls(program, opts.ctfe_fuel);
+    if (opts.ctfe && opts.ctfe_stats)
+        std::cerr << "ctfe: " << folded << " calls evaluated at compile time\n";
+    if (opts.specialize && opts.specialize_stats)
+        std::cerr << "specialize: " << clones << " clones\n";
+    hoist_loop_invariants(program);
+    if (opts.unroll)
+    {
+        auto unrolled = unroll_loops(program, opts.unroll_factor, opts.unroll_budget, opts.profile);
+        if (opts.unroll_stats)
+            std::cerr << "unroll: " << unrolled.first << " loops unrolled fully, " << unrolled.second
+                      << " partially\n";
+    }
+    if (opts.cse)
+    {
+        auto counts = eliminate_common_subexpressions(program);
+        if (opts.cse_stats)
+        {
+            int total = 0;
+            std::cerr << "cse: expressions reused per function:\n";
+            for (auto &c : counts)
+                if (c.second > 0)
+                {
+                    std::cerr << "  " << c.first << ": " << c.second << "\n";
+                    total += c.second;
+                }
+            std::cerr << "  total: " << total << "\n";
+        }
+    }
+    if (opts.layout)
+        layout_program(program, opts.profile);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "ast.h"
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// AST-level optimization passes. They run after parsing and before codegen,
+// rewriting the program in place. Temporaries introduced by the passes are
+// named with a leading '$' so they can never clash with user identifiers.
+
+struct OptimizeOptions {
+    bool ctfe = true;            // evaluate pure calls with constant arguments
+    uint64_t ctfe_fuel = 1000000; // evaluation steps allowed per call site
+    bool ctfe_stats = false;     // print how many calls were folded to stderr
+    bool specialize = true;      // clone functions for constant arguments
+    unsigned specialize_budget = 50; // clones may add this % to the program's AST size
+    bool specialize_stats = false; // print how many clones were made to stderr
+    bool cse = true;             // reuse values of repeated expressions
+    bool cse_stats = false;      // print eliminated expressions per function to stderr
+    bool unroll = true;          // unroll counted while loops
+    unsigned unroll_factor = 0;  // copies per partially unrolled loop; 0 = 8 or 4 by body size
+    unsigned unroll_budget = 50; // unrolled copies may add this % to the program's AST size
+    bool unroll_stats = false;   // print how many loops were unrolled to stderr
+    bool layout = true;          // branch estimates, .text.cold and call-graph function order
+    bool profile = false;        // the AST carries --profile-use counts (ProfileSite, profile.h)
+};
+
+// Run all passes in order. With `opts.profile`, specialization, unrolling and
+// code layout follow the measured counts.
+void optimize_program(Program &program, const OptimizeOptions &opts = {});
+
+// Compile-time function evaluation: calls to pure functions (no print/scan,
+// directly or through callees) with constant arguments are evaluated and
+// replaced by their value, unless evaluation would trap, read an unset
+// variable, fall off the end of a function or take more than `fuel` steps.
+// Returns the number of calls replaced.
+int evaluate_constant_calls(Program &program, uint64_t fuel);
+
+// Call-site specialization: calls passing literals for parameters the callee
+// never writes are redirected to a clone `f$N` with those parameters replaced
+// by the literals and the result constant-folded. Clones go to the most
+// frequent signatures first (loop-weighted, or by measured call counts when
+// `profiled`) and may grow the program by `budget_percent` of its AST nodes.
+// Returns the number of clones made.
+int specialize_calls(Program &program, unsigned budget_percent, bool profiled = false);
+
+// Common subexpression elimination by value numbering: a repeated arithmetic
+// expression whose operands have not been assigned since it was computed
+// reads the earlier value from a `$cse` temporary. Returns (function, number
+// of expressions reused) for every function, in program order.
+std::vector<std::pair<std::string, int>> eliminate_common_subexpressions(Program &program);
+
+// Loop unrolling: innermost while loops with an induction variable stepped
+// by a literal at the end of the body and a literal or loop-invariant bound
+// are unrolled fully (known trip count of at most 16) or by `factor`
+// (0: 8 or 4) with a remainder loop, while the copies stay within
+// `budget_percent` of the program's AST nodes. When `profiled`, cold loops
+// and loops averaging fewer than k iterations per entry are skipped. Returns
+// (fully, partially) unrolled loops.
+std::pair<int, int> unroll_loops(Program &program, unsigned factor, unsigned budget_percent, bool profiled = false);
+
+// Code layout: without a profile, estimates the counts of every if and
+// while from static heuristics; with one (`profiled`), marks never-run
+// functions and rarely taken branches cold. Then orders the functions by
+// call-graph affinity (Pettis-Hansen), hottest chains first. Codegen places
+// the code accordingly (ProfileSite, ast.h).
+void layout_program(Program &program, bool profiled);
+
+// Loop-invariant code motion: pure subexpressions of a while loop that only
+// read variables never written inside the loop are computed once in a
+// preheader `let` placed right before the loop.
+void hoist_loop_invariants(Program &program);
+
+// Shared helpers
+bool always_returns(const Stmt *s); // every path ends in a return statement
+void collect_assigned(const Stmt *stmt, std::set<std::string> &out);
+void collect_assigned_expr(const Expr *expr, std::set<std::string> &out);
+std::string expr_key(const Expr *expr);
+// value of `l op r` as the native code computes it; false for '=' and trapping divisions
+bool fold_binary(const std::string &op, int64_t l, int64_t r, int64_t &out);
+// integer literal as NASM assembles it
+int64_t literal_value(const NumberLiteral *n);
@@ -154,203 +154,130 @@ std::unique_ptr<BlockStmt> Parser::parseBlock() {
 
 
 
-// Expressions (precedence climbing / cascading)
-Expr::Ptr Parser::parseExpression() {
-    
-    return parseAssignment();
-}
-
-Expr::Ptr Parser::parseAssignment() {
-    Expr::Ptr left = parseOr();
-    if (match(TokenType::Assign)) {
-        Identifier *id = dynamic_cast<Identifier*>(left.get());
-        if (!id) throw std::runtime_error("Invalid assignment target at line " + std::to_string(previous().line));
-        Expr::Ptr right = parseAssignment();
-        return std::make_unique<BinaryExpr>("=", std::move(left), std::move(right));
-    }
-    return left;
-}
-
-Expr::Ptr Parser::parseOr() {
-    Expr::Ptr left = parseAnd();
-    while (match(TokenType::OrOr)) {
-        Expr::Ptr right = parseAnd();
-        left = std::make_unique<BinaryExpr>("||", std::move(left), std::move(right));
-    }
-    return left;
-}
-
-Expr::Ptr Parser::parseAnd() {
-    Expr::Ptr left = parseBitOr();   // <<== CHANGE: call parseBitOr instead of parseEquality
-    while (match(TokenType::AndAnd)) {
-        Expr::Ptr right = parseBitOr();
-        left = std::make_unique<BinaryExpr>("&&", std::move(left), std::move(right));
+// Expressions (operator precedence with explicit stacks)
+//
+// One loop instead of a function per precedence level: operands wait on one
+// stack, operators and open parentheses on another, so a generated chain of a
+// million operators or parentheses costs heap, not native stack. Only
+// if-expressions, which hold blocks, recurse.
+
+// precedence of the binary operator `t`, lowest first; 0 if it is none
+static int binaryPrecedence(TokenType t, std::string &op) {
+    switch (t) {
+    case TokenType::Assign: op = "="; return 1; // right-associative
+    case TokenType::OrOr: op = "||"; return 2;
+    case TokenType::AndAnd: op = "&&"; return 3;
+    case TokenType::BitOr: op = "|"; return 4;
+    case TokenType::BitXor: op = "^"; return 5;
+    case TokenType::BitAnd: op = "&"; return 6;
+    case TokenType::Equal: op = "=="; return 7;
+    case TokenType::NotEqual: op = "!="; return 7;
+    case TokenType::Less: op = "<"; return 8;
+    case TokenType::LessEqual: op = "<="; return 8;
+    case TokenType::Greater: op = ">"; return 8;
+    case TokenType::GreaterEqual: op = ">="; return 8;
+    case TokenType::ShiftLeft: op = "<<"; return 9;
+    case TokenType::ShiftRight: op = ">>"; return 9;
+    case TokenType::Plus: op = "+"; return 10;
+    case TokenType::Minus: op = "-"; return 10;
+    case TokenType::Star: op = "*"; return 11;
+    case TokenType::Slash: op = "/"; return 11;
+    case TokenType::MOD: op = "%"; return 11;
+    default: return 0;
     }
-    return left;
 }
 
-Expr::Ptr Parser::parseBitOr() {
-    Expr::Ptr left = parseBitXor();
-    while (match(TokenType::BitOr)) {
-        Expr::Ptr right = parseBitXor();
-        left = std::make_unique<BinaryExpr>("|", std::move(left), std::move(right));
-    }
-    return left;
-}
+static const int unaryPrecedence = 12; // '!' and '-' bind tighter than any binary operator
 
-Expr::Ptr Parser::parseBitXor() {
-    Expr::Ptr left = parseBitAnd();
-    while (match(TokenType::BitXor)) {
-        Expr::Ptr right = parseBitAnd();
-        left = std::make_unique<BinaryExpr>("^", std::move(left), std::move(right));
-    }
-    return left;
-}
-
-Expr::Ptr Parser::parseBitAnd() {
-    Expr::Ptr left = parseEquality();
-    while (match(TokenType::BitAnd)) {
-        Expr::Ptr right = parseEquality();
-        left = std::make_unique<BinaryExpr>("&", std::move(left), std::move(right));
-    }
-    return left;
-}
-
-Expr::Ptr Parser::parseShift() {
-    Expr::Ptr left = parseTerm();
-    while (true) {
-        if (match(TokenType::ShiftLeft)) {
-            Expr::Ptr right = parseTerm();
-            left = std::make_unique<BinaryExpr>("<<", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::ShiftRight)) {
-            Expr::Ptr right = parseTerm();
-            left = std::make_unique<BinaryExpr>(">>", std::move(left), std::move(right));
-            continue;
-        }
-        break;
-    }
-    return left;
-}
-
-
-Expr::Ptr Parser::parseEquality() {
-    Expr::Ptr left = parseComparison();
-    while (true) {
-        if (match(TokenType::Equal)) {
-            Expr::Ptr right = parseComparison();
-            left = std::make_unique<BinaryExpr>("==", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::NotEqual)) {
-            Expr::Ptr right = parseComparison();
-            left = std::make_unique<BinaryExpr>("!=", std::move(left), std::move(right));
-            continue;
-        }
-        break;
-    }
-    return left;
-}
+// an operator waiting for its right operand, or the '(' of a group or call
+struct PendingOp {
+    enum Kind { Binary, Unary, Group, Call } kind;
+    std::string op;
+    int prec;                    // 0 for '('
+    Expr::Ptr callee;            // Call
+    std::vector<Expr::Ptr> args; // Call: the arguments parsed so far
+};
 
-Expr::Ptr Parser::parseComparison() {
-    Expr::Ptr left = parseShift(); // instead of parseTerm()
-    while (true) {
-        if (match(TokenType::Less)) {
-            Expr::Ptr right = parseShift();
-            left = std::make_unique<BinaryExpr>("<", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::LessEqual)) {
-            Expr::Ptr right = parseShift();
-            left = std::make_unique<BinaryExpr>("<=", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::Greater)) {
-            Expr::Ptr right = parseShift();
-            left = std::make_unique<BinaryExpr>(">", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::GreaterEqual)) {
-            Expr::Ptr right = parseShift();
-            left = std::make_unique<BinaryExpr>(">=", std::move(left), std::move(right));
-            continue;
+Expr::Ptr Parser::parseExpression() {
+    std::vector<Expr::Ptr> operands;
+    std::vector<PendingOp> ops;
+
+    // build the pending operators above the innermost '(' that bind at least
+    // as tightly as an operator of precedence `prec` (only more tightly for
+    // '=', which groups to the right)
+    auto reduce = [&](int prec) {
+        while (!ops.empty() && ops.back().prec > 0 &&
+               (ops.back().prec > prec || (ops.back().prec == prec && prec != 1))) {
+            PendingOp top = std::move(ops.back());
+            ops.pop_back();
+            Expr::Ptr right = std::move(operands.back());
+            operands.pop_back();
+            if (top.kind == PendingOp::Unary) {
+                operands.push_back(std::make_unique<UnaryExpr>(top.op, std::move(right)));
+            } else {
+                Expr::Ptr left = std::move(operands.back());
+                operands.back() = std::make_unique<BinaryExpr>(top.op, std::move(left), std::move(right));
+            }
         }
-        break;
-    }
-    return left;
-}
+    };
 
-Expr::Ptr Parser::parseTerm() {
-    Expr::Ptr left = parseFactor();
     while (true) {
-        if (match(TokenType::Plus)) {
-            Expr::Ptr right = parseFactor();
-            left = std::make_unique<BinaryExpr>("+", std::move(left), std::move(right));
+        // an operand, after any prefix operators and '('s
+        if (match(TokenType::Bang)) {
+            ops.push_back({PendingOp::Unary, "!", unaryPrecedence});
             continue;
         }
         if (match(TokenType::Minus)) {
-            Expr::Ptr right = parseFactor();
-            left = std::make_unique<BinaryExpr>("-", std::move(left), std::move(right));
-            continue;
-        }
-        break;
-    }
-    return left;
-}
-
-Expr::Ptr Parser::parseFactor() {
-    Expr::Ptr left = parseUnary();
-    while (true) {
-        if (match(TokenType::Star)) {
-            Expr::Ptr right = parseUnary();
-            left = std::make_unique<BinaryExpr>("*", std::move(left), std::move(right));
-            continue;
-        }
-        if (match(TokenType::Slash)) {
-            Expr::Ptr right = parseUnary();
-            left = std::make_unique<BinaryExpr>("/", std::move(left), std::move(right));
+            ops.push_back({PendingOp::Unary, "-", unaryPrecedence});
             continue;
         }
-        if (match(TokenType::MOD)) {
-            Expr::Ptr right = parseUnary();
-            left = std::make_unique<BinaryExpr>("%", std::move(left), std::move(right));
+        if (match(TokenType::LParen)) {
+            ops.push_back({PendingOp::Group, "(", 0});
             continue;
         }
-        break;
-    }
-    return left;
-}
+        operands.push_back(parsePrimary());
+
+        // then calls and closing parentheses, up to a binary operator, a
+        // call's ',' or the end of the expression
+        while (true) {
+            if (match(TokenType::LParen)) {
+                Expr::Ptr callee = std::move(operands.back());
+                operands.pop_back();
+                if (match(TokenType::RParen)) {
+                    operands.push_back(std::make_unique<CallExpr>(std::move(callee), std::vector<Expr::Ptr>{}));
+                    continue;
+                }
+                ops.push_back({PendingOp::Call, "", 0, std::move(callee)});
+                break;
+            }
 
-Expr::Ptr Parser::parseUnary() {
-    if (match(TokenType::Bang)) {
-        Expr::Ptr right = parseUnary();
-        return std::make_unique<UnaryExpr>("!", std::move(right));
-    }
-    if (match(TokenType::Minus)) {
-        Expr::Ptr right = parseUnary();
-        return std::make_unique<UnaryExpr>("-", std::move(right));
-    }
-    return parseCall();
-}
+            std::string op;
+            int prec = binaryPrecedence(peek().type, op);
+            if (prec > 0) {
+                reduce(prec);
+                advance();
+                if (prec == 1 && !dynamic_cast<Identifier*>(operands.back().get()))
+                    throw std::runtime_error("Invalid assignment target at line " + std::to_string(previous().line));
+                ops.push_back({PendingOp::Binary, op, prec});
+                break;
+            }
 
-Expr::Ptr Parser::parseCall() {
-    Expr::Ptr expr = parsePrimary();
-    while (true) {
-        if (match(TokenType::LParen)) {
-            std::vector<Expr::Ptr> args;
-            if (!check(TokenType::RParen)) {
-                do {
-                    args.push_back(parseExpression());
-                } while (match(TokenType::Comma));
+            reduce(0);
+            if (ops.empty()) return std::move(operands.back());
+            if (ops.back().kind == PendingOp::Call) {
+                ops.back().args.push_back(std::move(operands.back()));
+                operands.pop_back();
+                if (match(TokenType::Comma)) break;
+                expect(TokenType::RParen, "closing ')' in call");
+                PendingOp call = std::move(ops.back());
+                ops.pop_back();
+                operands.push_back(std::make_unique<CallExpr>(std::move(call.callee), std::move(call.args)));
+            } else {
+                expect(TokenType::RParen, "closing ')'");
+                ops.pop_back();
             }
-            expect(TokenType::RParen, "closing ')' in call");
-            expr = std::make_unique<CallExpr>(std::move(expr), std::move(args));
-            continue;
         }
-        break;
     }
-    return expr;
 }
 
 Expr::Ptr Parser::parseBlockExpression() {
@@ -403,11 +330,5 @@ Expr::Ptr Parser::parsePrimary() {
     if (match(TokenType::Identifier)) {
         return std::make_unique<Identifier>(previous().value);
     }
-    if (match(TokenType::LParen)) {
-        Expr::Ptr e = parseExpression();
-        expect(TokenType::RParen, "closing ')'");
-        return e;
-    }
-
     throw std::runtime_error("Unexpected token in expression at line " + std::to_string(peek().line));
 }
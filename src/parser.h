@@ -33,23 +33,9 @@ private:
     Stmt::Ptr parseWhile();
     Stmt::Ptr parseReturn();
 
-    // expressions (precedence climbing)
+    // expressions (operator precedence with explicit stacks; parser.cpp)
     Expr::Ptr parseExpression();
-    Expr::Ptr parseAssignment();
-    Expr::Ptr parseOr();
-    Expr::Ptr parseAnd();
-    Expr::Ptr parseEquality();
-    Expr::Ptr parseComparison();
-    Expr::Ptr parseTerm();
-    Expr::Ptr parseFactor();
-    Expr::Ptr parseUnary();
-    Expr::Ptr parseCall();
     Expr::Ptr parsePrimary();
-    Expr::Ptr parseShift();
-    Expr::Ptr parseBitAnd();
-    Expr::Ptr parseBitXor();
-    // parseBitXor
-    Expr::Ptr parseBitOr();
     Expr::Ptr parseBlockExpression();
 
     // helpers
@@ -0,0 +1,626 @@
+#include "peephole.h"
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ---------------- Registers ----------------
+enum Reg { RAX, RBX, RCX, RDX, RSI, RDI, RBP, RSP, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+struct RegName {
+    const char *name;
+    int reg;
+    bool full; // writing it replaces the whole 64-bit register
+};
+
+static const RegName reg_names[] = {
+    {"rax", RAX, true}, {"eax", RAX, true}, {"ax", RAX, false}, {"al", RAX, false}, {"ah", RAX, false},
+    {"rbx", RBX, true}, {"ebx", RBX, true}, {"bx", RBX, false}, {"bl", RBX, false}, {"bh", RBX, false},
+    {"rcx", RCX, true}, {"ecx", RCX, true}, {"cx", RCX, false}, {"cl", RCX, false}, {"ch", RCX, false},
+    {"rdx", RDX, true}, {"edx", RDX, true}, {"dx", RDX, false}, {"dl", RDX, false}, {"dh", RDX, false},
+    {"rsi", RSI, true}, {"esi", RSI, true}, {"si", RSI, false}, {"sil", RSI, false},
+    {"rdi", RDI, true}, {"edi", RDI, true}, {"di", RDI, false}, {"dil", RDI, false},
+    {"rbp", RBP, true}, {"ebp", RBP, true}, {"bp", RBP, false}, {"bpl", RBP, false},
+    {"rsp", RSP, true}, {"esp", RSP, true}, {"sp", RSP, false}, {"spl", RSP, false},
+    {"r8", R8, true}, {"r8d", R8, true}, {"r8w", R8, false}, {"r8b", R8, false},
+    {"r9", R9, true}, {"r9d", R9, true}, {"r9w", R9, false}, {"r9b", R9, false},
+    {"r10", R10, true}, {"r10d", R10, true}, {"r10w", R10, false}, {"r10b", R10, false},
+    {"r11", R11, true}, {"r11d", R11, true}, {"r11w", R11, false}, {"r11b", R11, false},
+    {"r12", R12, true}, {"r12d", R12, true}, {"r12w", R12, false}, {"r12b", R12, false},
+    {"r13", R13, true}, {"r13d", R13, true}, {"r13w", R13, false}, {"r13b", R13, false},
+    {"r14", R14, true}, {"r14d", R14, true}, {"r14w", R14, false}, {"r14b", R14, false},
+    {"r15", R15, true}, {"r15d", R15, true}, {"r15w", R15, false}, {"r15b", R15, false},
+};
+
+static const RegName *find_reg(const std::string &tok)
+{
+    for (auto &r : reg_names)
+        if (tok == r.name)
+            return &r;
+    return nullptr;
+}
+
+static bool is_reg64(const std::string &op)
+{
+    auto r = find_reg(op);
+    return r && r->full && op[0] == 'r' && op.back() != 'd';
+}
+
+static bool is_mem(const std::string &op) { return op.find('[') != std::string::npos; }
+
+static bool is_imm32(const std::string &op)
+{
+    if (op.size() == 3 && op[0] == '\'' && op[2] == '\'')
+        return true;
+    if (op.empty())
+        return false;
+    char *end = nullptr;
+    long long v = strtoll(op.c_str(), &end, 0);
+    return *end == '\0' && v >= -2147483648LL && v <= 2147483647LL;
+}
+
+// bitmask of every register named in an operand (address registers for memory)
+static unsigned regs_in(const std::string &op)
+{
+    unsigned m = 0;
+    std::string tok;
+    for (size_t i = 0; i <= op.size(); ++i)
+    {
+        char c = i < op.size() ? op[i] : ' ';
+        if (isalnum(static_cast<unsigned char>(c)))
+        {
+            tok += c;
+            continue;
+        }
+        if (auto r = find_reg(tok))
+            m |= 1u << r->reg;
+        tok.clear();
+    }
+    return m;
+}
+
+// ---------------- Instruction effects ----------------
+struct Effects {
+    unsigned reads = 0;
+    unsigned writes = 0;   // registers fully overwritten
+    bool unknown = false;  // not modelled: assume it reads everything
+};
+
+static void dest_write(Effects &e, const std::string &op)
+{
+    if (is_mem(op))
+    {
+        e.reads |= regs_in(op);
+        return;
+    }
+    auto r = find_reg(op);
+    if (!r)
+        return;
+    if (r->full)
+        e.writes |= 1u << r->reg;
+    else
+        e.reads |= 1u << r->reg; // partial write keeps the rest of the register
+}
+
+static Effects effects(const AsmLine &l)
+{
+    Effects e;
+    const std::string &op = l.op;
+    const auto &a = l.args;
+
+    if ((op == "mov" || op == "movzx" || op == "movsx" || op == "movsxd" || op == "lea") && a.size() == 2)
+    {
+        e.reads |= regs_in(a[1]);
+        dest_write(e, a[0]);
+    }
+    else if (op == "pop" && a.size() == 1)
+        dest_write(e, a[0]);
+    else if (op == "push" && a.size() == 1)
+        e.reads |= regs_in(a[0]);
+    else if (op.rfind("set", 0) == 0 && a.size() == 1)
+        e.reads |= regs_in(a[0]);
+    else if ((op == "xor" || op == "sub") && a.size() == 2 && a[0] == a[1] && !is_mem(a[0]))
+        dest_write(e, a[0]);
+    else if ((op == "add" || op == "sub" || op == "and" || op == "or" || op == "xor" || op == "imul" ||
+              op == "shl" || op == "shr" || op == "sar") &&
+             a.size() == 2)
+        e.reads |= regs_in(a[0]) | regs_in(a[1]);
+    else if (op == "imul" && a.size() == 3)
+    {
+        e.reads |= regs_in(a[1]);
+        dest_write(e, a[0]);
+    }
+    else if ((op == "cmp" || op == "test") && a.size() == 2)
+        e.reads |= regs_in(a[0]) | regs_in(a[1]);
+    else if ((op == "inc" || op == "dec" || op == "neg" || op == "not") && a.size() == 1)
+        e.reads |= regs_in(a[0]);
+    else if (op == "cqo")
+    {
+        e.reads |= 1u << RAX;
+        e.writes |= 1u << RDX;
+    }
+    else if ((op == "div" || op == "idiv" || op == "mul") && a.size() == 1)
+    {
+        e.reads |= (1u << RAX) | (1u << RDX) | regs_in(a[0]);
+        e.writes |= (1u << RAX) | (1u << RDX);
+    }
+    else if (op == "leave" || op == "nop")
+    {
+    }
+    else
+        e.unknown = true;
+    return e;
+}
+
+// ---------------- Liveness queries ----------------
+struct PeepholeCtx {
+    std::vector<AsmLine> &code;
+    std::unordered_map<std::string, size_t> labels;
+    // per pass, for rule_dead_push_pop: the pop that balances each push
+    // (code.size() if none), and how many lines before each index a push
+    // cannot be dropped across
+    std::vector<size_t> pop_of;
+    std::vector<size_t> barriers;
+};
+
+static bool is_removed(const AsmLine &l) { return l.kind == AsmLine::Kind::Instr && l.op.empty(); }
+
+static void remove_line(AsmLine &l)
+{
+    l.op.clear();
+    l.args.clear();
+}
+
+static size_t next_live(const std::vector<AsmLine> &code, size_t i)
+{
+    for (++i; i < code.size(); ++i)
+        if (!is_removed(code[i]))
+            return i;
+    return code.size();
+}
+
+static bool is_op(const std::vector<AsmLine> &code, size_t i, const char *op, size_t nargs)
+{
+    return i < code.size() && code[i].kind == AsmLine::Kind::Instr && code[i].op == op &&
+           code[i].args.size() == nargs;
+}
+
+// true if `reg` is overwritten before being read on every path starting at i.
+// `seen` holds jump targets already being explored; reaching one again adds no
+// new path, so it counts as dead there.
+static bool reg_dead_from(const PeepholeCtx &c, size_t i, int reg, int &budget, std::vector<size_t> &seen)
+{
+    const unsigned bit = 1u << reg;
+    for (; i < c.code.size(); ++i)
+    {
+        if (--budget < 0)
+            return false;
+        const AsmLine &l = c.code[i];
+        if (l.kind == AsmLine::Kind::Label || is_removed(l))
+            continue;
+        if (l.kind == AsmLine::Kind::Directive)
+            return false;
+
+        if (l.op == "jmp" || (l.op[0] == 'j' && l.args.size() == 1))
+        {
+            auto it = c.labels.find(l.args.empty() ? "" : l.args[0]);
+            if (it == c.labels.end())
+                return false;
+            bool visited = false;
+            for (size_t s : seen)
+                visited |= s == it->second;
+            if (!visited)
+            {
+                seen.push_back(it->second);
+                if (!reg_dead_from(c, it->second, reg, budget, seen))
+                    return false;
+            }
+            if (l.op == "jmp")
+                return true;
+            continue; // conditional: the fall-through path must agree
+        }
+        if (l.op == "ret") // return value and the registers callers expect preserved
+            return reg != RAX && reg != RBX && reg != RBP && reg != RSP && reg < R12;
+        if (l.op == "call")
+        {
+            // arguments are read (all eleven registers of the internal
+            // convention, ipra.h); only rax is certainly written
+            unsigned in = (1u << RDI) | (1u << RSI) | (1u << RDX) | (1u << RCX) | (1u << R8) | (1u << R9) |
+                          (1u << R10) | (1u << R11) | (1u << R13) | (1u << R14) | (1u << R15);
+            if (in & bit)
+                return false;
+            if (bit == (1u << RAX))
+                return true;
+            continue;
+        }
+        if (l.op == "syscall")
+        {
+            unsigned in = (1u << RAX) | (1u << RDI) | (1u << RSI) | (1u << RDX) | (1u << R10) | (1u << R8) |
+                          (1u << R9);
+            if (in & bit)
+                return false;
+            if (bit & ((1u << RCX) | (1u << R11)))
+                return true;
+            continue;
+        }
+
+        Effects e = effects(l);
+        if (e.unknown || (e.reads & bit))
+            return false;
+        if (e.writes & bit)
+            return true;
+    }
+    return false;
+}
+
+static bool reg_dead_after(const PeepholeCtx &c, size_t i, int reg)
+{
+    int budget = 512;
+    std::vector<size_t> seen;
+    return reg_dead_from(c, i + 1, reg, budget, seen);
+}
+
+// ---------------- Rules ----------------
+// Each rule looks at the live instruction at index i (and the ones following
+// it) and rewrites in place, returning true when it fired.
+
+// push R ; pop R  ->  (nothing)
+static bool rule_push_pop_same(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i);
+    if (!is_op(c.code, i, "push", 1) || !is_op(c.code, j, "pop", 1) || c.code[i].args[0] != c.code[j].args[0])
+        return false;
+    remove_line(c.code[i]);
+    remove_line(c.code[j]);
+    return true;
+}
+
+// push A ; pop B  ->  mov B,A
+static bool rule_push_pop_move(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i);
+    if (!is_op(c.code, i, "push", 1) || !is_op(c.code, j, "pop", 1))
+        return false;
+    const std::string &a = c.code[i].args[0], &b = c.code[j].args[0];
+    if (!is_reg64(a) || !is_reg64(b) || a == "rsp" || b == "rsp")
+        return false;
+    c.code[i] = parse_asm_line("mov " + b + "," + a);
+    remove_line(c.code[j]);
+    return true;
+}
+
+// push rax ; mov rax,X ; mov R,rax ; pop rax  ->  mov R,X
+static bool rule_load_through_rax(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i), k = next_live(c.code, j), m = next_live(c.code, k);
+    if (!is_op(c.code, i, "push", 1) || c.code[i].args[0] != "rax")
+        return false;
+    if (!is_op(c.code, j, "mov", 2) || c.code[j].args[0] != "rax")
+        return false;
+    if (!is_op(c.code, k, "mov", 2) || c.code[k].args[1] != "rax" || !is_reg64(c.code[k].args[0]))
+        return false;
+    if (!is_op(c.code, m, "pop", 1) || c.code[m].args[0] != "rax")
+        return false;
+    const std::string &x = c.code[j].args[1], &r = c.code[k].args[0];
+    if (r == "rax" || r == "rsp" || (regs_in(x) & ((1u << RAX) | (1u << RSP))))
+        return false;
+    c.code[i] = parse_asm_line("mov " + r + "," + x);
+    remove_line(c.code[j]);
+    remove_line(c.code[k]);
+    remove_line(c.code[m]);
+    return true;
+}
+
+// mov M,R ; mov R2,M  ->  mov M,R ; mov R2,R   (or drop the reload when R2 == R)
+static bool rule_store_reload(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i);
+    if (!is_op(c.code, i, "mov", 2) || !is_op(c.code, j, "mov", 2))
+        return false;
+    const auto &st = c.code[i].args, &ld = c.code[j].args;
+    if (!is_mem(st[0]) || !is_reg64(st[1]) || ld[1] != st[0] || !is_reg64(ld[0]))
+        return false;
+    if (ld[0] == st[1])
+        remove_line(c.code[j]);
+    else
+        c.code[j] = parse_asm_line("mov " + ld[0] + "," + st[1]);
+    return true;
+}
+
+// mov rbx,X ; OP R,rbx  ->  OP R,X   (rbx dead afterwards)
+static bool rule_fold_operand(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i);
+    if (!is_op(c.code, i, "mov", 2) || j >= c.code.size() || c.code[j].kind != AsmLine::Kind::Instr ||
+        c.code[j].args.size() != 2)
+        return false;
+    const std::string &tmp = c.code[i].args[0], &x = c.code[i].args[1];
+    const std::string &op = c.code[j].op;
+    if (op != "add" && op != "sub" && op != "and" && op != "or" && op != "xor" && op != "cmp" && op != "test" &&
+        op != "imul")
+        return false;
+    if (!is_reg64(tmp) || c.code[j].args[1] != tmp || !is_reg64(c.code[j].args[0]) || c.code[j].args[0] == tmp)
+        return false;
+    if (!is_imm32(x) && !(is_mem(x) && x.find("byte") == std::string::npos) && !is_reg64(x))
+        return false;
+    if (op == "test" && is_mem(x))
+        return false;
+    auto r = find_reg(tmp);
+    if (!reg_dead_after(c, j, r->reg))
+        return false;
+    c.code[j].args[1] = x;
+    remove_line(c.code[i]);
+    return true;
+}
+
+// mov rbx,K ; mov cl,bl ; shl/shr R,cl  ->  shl/shr R,K mod 64   (rbx, rcx dead afterwards)
+static bool rule_shift_immediate(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i), k = next_live(c.code, j);
+    if (!is_op(c.code, i, "mov", 2) || !is_op(c.code, j, "mov", 2) || k >= c.code.size() ||
+        (!is_op(c.code, k, "shl", 2) && !is_op(c.code, k, "shr", 2)))
+        return false;
+    const std::string &tmp = c.code[i].args[0], &x = c.code[i].args[1];
+    if (tmp != "rbx" || !is_imm32(x) || x[0] == '\'' || c.code[j].args[0] != "cl" || c.code[j].args[1] != "bl" ||
+        c.code[k].args[1] != "cl" || !is_reg64(c.code[k].args[0]))
+        return false;
+    if (!reg_dead_after(c, k, RBX) || !reg_dead_after(c, k, RCX))
+        return false;
+    long long count = std::strtoll(x.c_str(), nullptr, 0) & 63;
+    c.code[k] = parse_asm_line(c.code[k].op + " " + c.code[k].args[0] + "," + std::to_string(count));
+    remove_line(c.code[i]);
+    remove_line(c.code[j]);
+    return true;
+}
+
+// cmp R,0  ->  test R,R
+static bool rule_cmp_zero(PeepholeCtx &c, size_t i)
+{
+    if (!is_op(c.code, i, "cmp", 2) || !is_reg64(c.code[i].args[0]) || c.code[i].args[1] != "0")
+        return false;
+    c.code[i].op = "test";
+    c.code[i].args[1] = c.code[i].args[0];
+    return true;
+}
+
+static std::string invert_cc(const std::string &cc)
+{
+    static const char *pairs[][2] = {{"e", "ne"}, {"z", "nz"}, {"l", "ge"}, {"g", "le"},
+                                     {"b", "ae"}, {"a", "be"}, {"s", "ns"}};
+    for (auto &p : pairs)
+    {
+        if (cc == p[0])
+            return p[1];
+        if (cc == p[1])
+            return p[0];
+    }
+    return "";
+}
+
+// setCC al ; movzx rax,al ; test rax,rax ; je L  ->  jNCC L   (rax dead on both paths)
+static bool rule_setcc_branch(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i), k = next_live(c.code, j), m = next_live(c.code, k);
+    if (i >= c.code.size() || c.code[i].kind != AsmLine::Kind::Instr || c.code[i].op.rfind("set", 0) != 0 ||
+        c.code[i].args.size() != 1 || c.code[i].args[0] != "al")
+        return false;
+    if (!is_op(c.code, j, "movzx", 2) || c.code[j].args[0] != "rax" || c.code[j].args[1] != "al")
+        return false;
+    if (!is_op(c.code, k, "test", 2) || c.code[k].args[0] != "rax" || c.code[k].args[1] != "rax")
+        return false;
+    if (m >= c.code.size() || c.code[m].kind != AsmLine::Kind::Instr || c.code[m].args.size() != 1)
+        return false;
+
+    std::string cc = c.code[i].op.substr(3);
+    std::string jop = c.code[m].op;
+    if (jop == "je" || jop == "jz")
+        cc = invert_cc(cc);
+    else if (jop != "jne" && jop != "jnz")
+        return false;
+    if (cc.empty())
+        return false;
+
+    auto target = c.labels.find(c.code[m].args[0]);
+    int budget = 512;
+    std::vector<size_t> seen;
+    if (target == c.labels.end() || !reg_dead_from(c, target->second, RAX, budget, seen) ||
+        !reg_dead_after(c, m, RAX))
+        return false;
+
+    c.code[i] = parse_asm_line("j" + cc + " " + c.code[m].args[0]);
+    remove_line(c.code[j]);
+    remove_line(c.code[k]);
+    remove_line(c.code[m]);
+    return true;
+}
+
+// mov R,X (R never read afterwards)  ->  (nothing)
+static bool rule_dead_move(PeepholeCtx &c, size_t i)
+{
+    if (i >= c.code.size() || c.code[i].kind != AsmLine::Kind::Instr || c.code[i].args.size() != 2)
+        return false;
+    const std::string &op = c.code[i].op;
+    if (op != "mov" && op != "movzx" && op != "lea")
+        return false;
+    auto r = find_reg(c.code[i].args[0]);
+    if (!r || !r->full || r->reg == RSP || r->reg == RBP || r->reg >= R12)
+        return false;
+    if (!reg_dead_after(c, i, r->reg))
+        return false;
+    remove_line(c.code[i]);
+    return true;
+}
+
+// a line no push/pop pair may be dropped across: control flow, or a use of rsp
+static bool push_pop_barrier(const AsmLine &l)
+{
+    if (l.kind != AsmLine::Kind::Instr || l.op[0] == 'j' || l.op == "ret" || l.op == "leave")
+        return true;
+    for (auto &a : l.args)
+        if (regs_in(a) & (1u << RSP))
+            return true;
+    return false;
+}
+
+// matching pops and barrier counts of the pass; one scan, so that deeply
+// nested pushes (long right-nested expressions) cost linear time
+static void match_push_pop(PeepholeCtx &c)
+{
+    c.pop_of.assign(c.code.size(), c.code.size());
+    c.barriers.assign(c.code.size() + 1, 0);
+    std::vector<size_t> open;
+    for (size_t i = 0; i < c.code.size(); ++i)
+    {
+        const AsmLine &l = c.code[i];
+        c.barriers[i + 1] = c.barriers[i] + push_pop_barrier(l);
+        if (l.kind != AsmLine::Kind::Instr)
+            continue;
+        if (l.op == "push")
+            open.push_back(i);
+        else if (l.op == "pop" && !open.empty())
+        {
+            c.pop_of[open.back()] = i;
+            open.pop_back();
+        }
+    }
+}
+
+// push R ; <balanced code> ; pop R  ->  <balanced code>   (R dead after the pop)
+// Rules only rewrite a few lines after the one they fire at and drop pushes
+// with their pops, so the pairs matched at the start of the pass still hold.
+static bool rule_dead_push_pop(PeepholeCtx &c, size_t i)
+{
+    if (!is_op(c.code, i, "push", 1) || !is_reg64(c.code[i].args[0]))
+        return false;
+    const std::string &r = c.code[i].args[0];
+    size_t j = c.pop_of[i];
+    if (!is_op(c.code, j, "pop", 1) || c.barriers[j + 1] != c.barriers[i + 1])
+        return false;
+    if (c.code[j].args[0] != r || !reg_dead_after(c, j, find_reg(r)->reg))
+        return false;
+    remove_line(c.code[i]);
+    remove_line(c.code[j]);
+    return true;
+}
+
+// mov T,S ; mov X,T  ->  mov X,S   (T dead afterwards)
+static bool rule_copy_forward(PeepholeCtx &c, size_t i)
+{
+    size_t j = next_live(c.code, i);
+    if (!is_op(c.code, i, "mov", 2) || !is_op(c.code, j, "mov", 2))
+        return false;
+    const std::string &t = c.code[i].args[0], &src = c.code[i].args[1];
+    if (!is_reg64(t) || !is_reg64(src) || t == "rsp" || t == "rbp" || c.code[j].args[1] != t ||
+        (regs_in(c.code[j].args[0]) & (1u << find_reg(t)->reg)))
+        return false;
+    if (c.code[j].args[0] != t && !reg_dead_after(c, j, find_reg(t)->reg))
+        return false;
+    c.code[j].args[1] = src;
+    remove_line(c.code[i]);
+    return true;
+}
+
+// jmp/ret ; <anything up to the next label>  ->  jmp/ret
+static bool rule_unreachable(PeepholeCtx &c, size_t i)
+{
+    if (!is_op(c.code, i, "jmp", 1) && !is_op(c.code, i, "ret", 0))
+        return false;
+    bool fired = false;
+    for (size_t j = next_live(c.code, i); j < c.code.size() && c.code[j].kind == AsmLine::Kind::Instr;
+         j = next_live(c.code, j))
+    {
+        remove_line(c.code[j]);
+        fired = true;
+    }
+    return fired;
+}
+
+struct PeepholeRule {
+    const char *name;
+    bool (*apply)(PeepholeCtx &c, size_t i);
+};
+
+static const PeepholeRule rules[] = {
+    {"push-pop-same", rule_push_pop_same},
+    {"push-pop-move", rule_push_pop_move},
+    {"load-through-rax", rule_load_through_rax},
+    {"store-reload", rule_store_reload},
+    {"fold-operand", rule_fold_operand},
+    {"shift-immediate", rule_shift_immediate},
+    {"cmp-zero-to-test", rule_cmp_zero},
+    {"setcc-branch", rule_setcc_branch},
+    {"dead-move", rule_dead_move},
+    {"dead-push-pop", rule_dead_push_pop},
+    {"copy-forward", rule_copy_forward},
+    {"unreachable", rule_unreachable},
+};
+static const size_t rule_count = sizeof(rules) / sizeof(rules[0]);
+
+// ---------------- Driver ----------------
+void peephole_optimize(std::vector<AsmLine> &code, PeepholeStats &stats)
+{
+    stats.hits.resize(rule_count, 0);
+    PeepholeCtx c{code, {}};
+
+    bool changed = true;
+    for (int pass = 0; changed && pass < 8; ++pass)
+    {
+        changed = false;
+        c.labels.clear();
+        for (size_t i = 0; i < code.size(); ++i)
+            if (code[i].kind == AsmLine::Kind::Label)
+                c.labels[code[i].op] = i;
+        match_push_pop(c);
+
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (code[i].kind != AsmLine::Kind::Instr || is_removed(code[i]))
+                continue;
+            for (size_t r = 0; r < rule_count; ++r)
+            {
+                if (rules[r].apply(c, i))
+                {
+                    stats.hits[r]++;
+                    changed = true;
+                    if (is_removed(code[i]))
+                        break;
+                }
+            }
+        }
+
+        // compact (keeps label indices valid for the next pass)
+        size_t w = 0;
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (is_removed(code[i]))
+                continue;
+            if (w != i)
+                code[w] = std::move(code[i]);
+            w++;
+        }
+        code.resize(w);
+    }
+}
+
+void PeepholeStats::merge(const PeepholeStats &other)
+{
+    if (hits.size() < other.hits.size())
+        hits.resize(other.hits.size(), 0);
+    for (size_t i = 0; i < other.hits.size(); ++i)
+        hits[i] += other.hits[i];
+}
+
+void PeepholeStats::dump(std::ostream &os) const
+{
+    os << "peephole rule hits:\n";
+    long total = 0;
+    for (size_t r = 0; r < rule_count; ++r)
+    {
+        long n = r < hits.size() ? hits[r] : 0;
+        total += n;
+        os << "  " << std::left << std::setw(20) << rules[r].name << n << "\n";
+    }
+    os << "  " << std::left << std::setw(20) << "total" << total << "\n";
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "asm.h"
+#include <ostream>
+#include <vector>
+
+// Per-rule hit counters, indexed like the rule table in peephole.cpp
+struct PeepholeStats {
+    std::vector<long> hits;
+
+    void merge(const PeepholeStats &other);
+    void dump(std::ostream &os) const;
+};
+
+// Rewrite the instruction list in place until no rule fires.
+// Labels and directives are block boundaries; rules that delete a register
+// write first prove the register dead along every path that follows.
+void peephole_optimize(std::vector<AsmLine> &code, PeepholeStats &stats);
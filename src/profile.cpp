@@ -0,0 +1,149 @@
+#include "profile.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+static const char profile_magic[8] = {'Z', 'I', 'N', 'C', 'P', 'R', 'F', '1'};
+
+// ---------------- Sites ----------------
+// Visits the sites in a fixed order. Functions and calls take one counter;
+// ifs and loops take two (count, taken). Only code inside functions runs.
+
+class SiteNumbering
+{
+public:
+    struct Site
+    {
+        ProfileSite *profile;
+        int width;
+    };
+
+    std::vector<Site> sites; // in numbering order
+    int counters = 0;
+    uint64_t checksum = 1469598103934665603ull; // FNV-1a over kinds and names
+
+    explicit SiteNumbering(Program &program)
+    {
+        for (auto &stmt : program)
+            if (auto f = dynamic_cast<FunctionDecl *>(stmt.get()))
+            {
+                site(f->profile, 'f', f->name, 1);
+                statement(f->body.get());
+            }
+        checksum >>= 1; // 63 bits: a positive dq in the assembly
+    }
+
+private:
+    void site(ProfileSite &s, char kind, const std::string &name, int width)
+    {
+        s.site = counters;
+        counters += width;
+        sites.push_back({&s, width});
+        mix(static_cast<unsigned char>(kind));
+        for (char c : name)
+            mix(static_cast<unsigned char>(c));
+        mix(0);
+    }
+
+    void mix(unsigned char b)
+    {
+        checksum ^= b;
+        checksum *= 1099511628211ull;
+    }
+
+    void expression(Expr *e)
+    {
+        walk_expr(e, [&](Expr *x)
+                  {
+                      if (auto ife = dynamic_cast<IfExpr *>(x))
+                          site(ife->profile, '?', "", 2);
+                      else if (auto c = dynamic_cast<CallExpr *>(x))
+                      {
+                          auto id = dynamic_cast<Identifier *>(c->callee.get());
+                          if (id && id->name != "print" && id->name != "scan")
+                              site(c->profile, 'c', id->name, 1);
+                      }
+                      return true;
+                  });
+    }
+
+    void statement(Stmt *s)
+    {
+        if (auto b = dynamic_cast<BlockStmt *>(s))
+        {
+            for (auto &st : b->stmts)
+                statement(st.get());
+        }
+        else if (auto l = dynamic_cast<LetStmt *>(s))
+            expression(l->init.get());
+        else if (auto e = dynamic_cast<ExprStmt *>(s))
+            expression(e->expr.get());
+        else if (auto r = dynamic_cast<ReturnStmt *>(s))
+            expression(r->value.get());
+        else if (auto i = dynamic_cast<IfStmt *>(s))
+        {
+            site(i->profile, 'i', "", 2);
+            expression(i->cond.get());
+            statement(i->thenBranch.get());
+            statement(i->elseBranch.get());
+        }
+        else if (auto w = dynamic_cast<WhileStmt *>(s))
+        {
+            site(w->profile, 'w', "", 2);
+            expression(w->cond.get());
+            statement(w->body.get());
+        }
+    }
+};
+
+ProfileInstrumentation number_profile_sites(Program &program, const std::string &path)
+{
+    SiteNumbering n(program);
+    return {path, n.checksum, n.counters};
+}
+
+// ---------------- Reading ----------------
+
+bool apply_profile(Program &program, const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot open profile '" + path + "'");
+    auto word = [&]()
+    {
+        unsigned char b[8];
+        if (!in.read(reinterpret_cast<char *>(b), 8))
+            throw std::runtime_error("profile '" + path + "' is truncated");
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = v << 8 | b[i];
+        return v;
+    };
+    char magic[8];
+    if (!in.read(magic, 8) || !std::equal(magic, magic + 8, profile_magic))
+        throw std::runtime_error("'" + path + "' is not a zinc profile");
+    uint64_t checksum = word(), count = word();
+
+    SiteNumbering n(program);
+    for (auto &s : n.sites)
+        s.profile->site = -1; // counted, not instrumented
+    if (checksum != n.checksum || count != static_cast<uint64_t>(n.counters))
+    {
+        std::cerr << "warning: profile '" << path << "' was written for a different program; ignored\n";
+        return false;
+    }
+    std::vector<uint64_t> counters(count);
+    for (auto &c : counters)
+        c = word();
+    size_t at = 0;
+    for (auto &s : n.sites)
+    {
+        s.profile->count = counters[at];
+        if (s.width == 2)
+            s.profile->taken = counters[at + 1];
+        at += s.width;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "ast.h"
+#include <cstdint>
+#include <string>
+
+// Profile-guided optimization.
+//
+// --profile-generate numbers the counter sites of the program as parsed:
+// every function entry, call to a user function, if (tests, then-branch
+// runs) and while (entries, iterations). Codegen bumps one 64-bit counter
+// per site in zinc_profile (.data) and _start writes the block to a file
+// before exiting, overwriting it.
+//
+// --profile-use numbers the same program the same way and stores the counts
+// in each node's ProfileSite (ast.h) before the optimization passes run.
+// Specialization, unrolling, function order and branch layout read them.
+//
+// File format, little-endian 64-bit words:
+//   [0] "ZINCPRF1"   [1] checksum of the sites   [2] number of counters N
+//   [3 .. 3+N) the counters, by site index
+
+struct ProfileInstrumentation {
+    std::string path;      // file _start writes at exit; empty = no counters
+    uint64_t checksum = 0; // of the site sequence, to reject stale profiles
+    int counters = 0;
+};
+
+// Give every site of `program` its counter index.
+ProfileInstrumentation number_profile_sites(Program &program, const std::string &path);
+
+// Read the counts written by a --profile-generate build into the sites of
+// `program`. Throws if the file cannot be read; returns false and leaves the
+// program alone if it was written for a different program.
+bool apply_profile(Program &program, const std::string &path);
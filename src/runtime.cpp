@@ -0,0 +1,453 @@
+#include "runtime.h"
+#include "globals.h"
+#include <sstream>
+
+// ---------------- Routines ----------------
+enum class RuntimeMode { Always, Buffered, Unbuffered, Host };
+
+struct RuntimeRoutine {
+    const char *name;
+    RuntimeMode mode;
+    const char *deps; // space separated routines it calls
+    const char *text; // NASM source for .text
+    const char *bss;  // buffers it needs in .bss (may be empty)
+};
+
+static const RuntimeRoutine routines[] = {
+    // write(1, rsi, rdx) until everything is out (pipes may take partial writes)
+    {"zinc_write_all", RuntimeMode::Always, "",
+     "zinc_write_all:\n"
+     ".write_all_loop:\n"
+     "    test rdx,rdx\n"
+     "    jle .write_all_done\n"
+     "    mov rax,1\n"
+     "    mov rdi,1\n"
+     "    syscall\n"
+     "    test rax,rax\n"
+     "    jle .write_all_done\n"
+     "    add rsi,rax\n"
+     "    sub rdx,rax\n"
+     "    jmp .write_all_loop\n"
+     ".write_all_done:\n"
+     "    ret\n",
+     ""},
+
+    {"zinc_flush", RuntimeMode::Always, "zinc_write_all",
+     "zinc_flush:\n"
+     "    lea rsi,[rel out_buf]\n"
+     "    mov rdx,[rel out_len]\n"
+     "    call zinc_write_all\n"
+     "    mov qword [rel out_len],0\n"
+     "    ret\n",
+     "out_buf: resb 65536\n"
+     "out_len: resq 1\n"
+     "out_tty: resq 1\n"
+     "tty_probe: resb 64\n"},
+
+    // open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644), write the 3-word header
+    // plus [zinc_profile+16] counters, close; a file that cannot be opened
+    // is skipped
+    {"zinc_profile_dump", RuntimeMode::Always, "",
+     "zinc_profile_dump:\n"
+     "    mov rax,2\n"
+     "    lea rdi,[rel zinc_profile_path]\n"
+     "    mov rsi,577\n"
+     "    mov rdx,420\n"
+     "    syscall\n"
+     "    test rax,rax\n"
+     "    js .profile_done\n"
+     "    mov rdi,rax\n"
+     "    lea rsi,[rel zinc_profile]\n"
+     "    mov rdx,[rel zinc_profile+16]\n"
+     "    shl rdx,3\n"
+     "    add rdx,24\n"
+     ".profile_write:\n"
+     "    test rdx,rdx\n"
+     "    jle .profile_close\n"
+     "    mov rax,1\n"
+     "    syscall\n"
+     "    test rax,rax\n"
+     "    jle .profile_close\n"
+     "    add rsi,rax\n"
+     "    sub rdx,rax\n"
+     "    jmp .profile_write\n"
+     ".profile_close:\n"
+     "    mov rax,3\n"
+     "    syscall\n"
+     ".profile_done:\n"
+     "    ret\n",
+     ""},
+
+    // ioctl(1, TCGETS) succeeds only on a terminal; there print flushes per line
+    {"zinc_rt_init", RuntimeMode::Always, "zinc_flush",
+     "zinc_rt_init:\n"
+     "    mov rax,16\n"
+     "    mov rdi,1\n"
+     "    mov rsi,0x5401\n"
+     "    lea rdx,[rel tty_probe]\n"
+     "    syscall\n"
+     "    test rax,rax\n"
+     "    jnz .rt_init_done\n"
+     "    mov qword [rel out_tty],1\n"
+     ".rt_init_done:\n"
+     "    ret\n",
+     ""},
+
+    {"zinc_print_str", RuntimeMode::Buffered, "zinc_flush zinc_write_all",
+     "zinc_print_str:\n"
+     "    push rdx\n"
+     "    mov rax,[rel out_len]\n"
+     "    add rax,rdx\n"
+     "    cmp rax,65536\n"
+     "    jbe .print_str_copy\n"
+     "    push rsi\n"
+     "    push rdx\n"
+     "    call zinc_flush\n"
+     "    pop rdx\n"
+     "    pop rsi\n"
+     "    cmp rdx,65536\n"
+     "    jbe .print_str_copy\n"
+     "    call zinc_write_all\n" // larger than the whole buffer
+     "    pop rax\n"
+     "    ret\n"
+     ".print_str_copy:\n"
+     "    lea rdi,[rel out_buf]\n"
+     "    add rdi,[rel out_len]\n"
+     "    mov rcx,rdx\n"
+     "    rep movsb\n"
+     "    add [rel out_len],rdx\n"
+     "    cmp qword [rel out_tty],0\n"
+     "    je .print_str_done\n"
+     "    mov rsi,rdi\n"
+     "    sub rsi,rdx\n"
+     ".print_str_scan_nl:\n"
+     "    test rdx,rdx\n"
+     "    jz .print_str_done\n"
+     "    cmp byte [rsi],10\n"
+     "    je .print_str_flush\n"
+     "    inc rsi\n"
+     "    dec rdx\n"
+     "    jmp .print_str_scan_nl\n"
+     ".print_str_flush:\n"
+     "    call zinc_flush\n"
+     ".print_str_done:\n"
+     "    pop rax\n"
+     "    ret\n",
+     ""},
+
+    {"zinc_print_str", RuntimeMode::Unbuffered, "",
+     "zinc_print_str:\n"
+     "    mov rax,1\n"
+     "    mov rdi,1\n"
+     "    syscall\n"
+     "    mov rax,rdx\n"
+     "    ret\n",
+     ""},
+
+    // Signed decimal conversion: rdi = value -> rsi = first char, rdx = length.
+    // Digits are produced right to left, two at a time from a 200-byte table,
+    // ending at num_buf+24; n / 100 is a multiply by the reciprocal
+    // ((n >> 2) * 0x28F5C28F5C28F5C3 >> 66), exact for every u64.
+    // The magnitude of a negative value is taken as unsigned, so INT64_MIN works.
+    {"zinc_itoa", RuntimeMode::Always, "",
+     "zinc_itoa:\n"
+     "    lea rsi,[rel num_buf+24]\n"
+     "    lea r10,[rel digit_pairs]\n"
+     "    mov r8,0x28F5C28F5C28F5C3\n"
+     "    mov rax,rdi\n"
+     "    test rax,rax\n"
+     "    jns .itoa_loop\n"
+     "    neg rax\n"
+     ".itoa_loop:\n"
+     "    cmp rax,100\n"
+     "    jb .itoa_last\n"
+     "    mov rcx,rax\n"
+     "    shr rax,2\n"
+     "    mul r8\n"
+     "    shr rdx,2\n"
+     "    mov rax,rdx\n"
+     "    imul rdx,rdx,100\n"
+     "    sub rcx,rdx\n"
+     "    movzx r9,word [r10+rcx*2]\n"
+     "    sub rsi,2\n"
+     "    mov [rsi],r9w\n"
+     "    jmp .itoa_loop\n"
+     ".itoa_last:\n"
+     "    cmp rax,10\n"
+     "    jb .itoa_one\n"
+     "    movzx r9,word [r10+rax*2]\n"
+     "    sub rsi,2\n"
+     "    mov [rsi],r9w\n"
+     "    jmp .itoa_sign\n"
+     ".itoa_one:\n"
+     "    add rax,'0'\n"
+     "    dec rsi\n"
+     "    mov [rsi],al\n"
+     ".itoa_sign:\n"
+     "    test rdi,rdi\n"
+     "    jns .itoa_done\n"
+     "    dec rsi\n"
+     "    mov byte [rsi],'-'\n"
+     ".itoa_done:\n"
+     "    lea rdx,[rel num_buf+24]\n"
+     "    sub rdx,rsi\n"
+     "    ret\n"
+     "section .data\n"
+     "digit_pairs: db \"00010203040506070809\"\n"
+     "    db \"10111213141516171819\"\n"
+     "    db \"20212223242526272829\"\n"
+     "    db \"30313233343536373839\"\n"
+     "    db \"40414243444546474849\"\n"
+     "    db \"50515253545556575859\"\n"
+     "    db \"60616263646566676869\"\n"
+     "    db \"70717273747576777879\"\n"
+     "    db \"80818283848586878889\"\n"
+     "    db \"90919293949596979899\"\n"
+     "section .text\n",
+     "num_buf: resb 32\n"},
+
+    // At most 20 chars are produced, so with 24 bytes of room the digits are
+    // copied into the buffer as three unaligned 8-byte moves.
+    {"zinc_print_int", RuntimeMode::Buffered, "zinc_itoa zinc_flush",
+     "zinc_print_int:\n"
+     "    cmp qword [rel out_len],65512\n" // 65536 - 24
+     "    jbe .print_int_room\n"
+     "    push rdi\n"
+     "    call zinc_flush\n"
+     "    pop rdi\n"
+     ".print_int_room:\n"
+     "    call zinc_itoa\n"
+     "    lea rdi,[rel out_buf]\n"
+     "    add rdi,[rel out_len]\n"
+     "    mov rax,[rsi]\n"
+     "    mov [rdi],rax\n"
+     "    mov rax,[rsi+8]\n"
+     "    mov [rdi+8],rax\n"
+     "    mov rax,[rsi+16]\n"
+     "    mov [rdi+16],rax\n"
+     "    add [rel out_len],rdx\n"
+     "    mov rax,rdx\n"
+     "    ret\n",
+     ""},
+
+    {"zinc_print_int", RuntimeMode::Unbuffered, "zinc_itoa",
+     "zinc_print_int:\n"
+     "    call zinc_itoa\n"
+     "    mov rax,1\n"
+     "    mov rdi,1\n"
+     "    syscall\n"
+     "    mov rax,rdx\n"
+     "    ret\n",
+     ""},
+
+    // Refill in_buf with one read(0): rcx = 0 (new position), rdx = bytes
+    // available (0 at end of input or on error), r10 = in_buf.
+    // Pending output is flushed first so prompts appear before we block.
+    {"zinc_in_fill", RuntimeMode::Buffered, "zinc_flush",
+     "zinc_in_fill:\n"
+     "    call zinc_flush\n",
+     ""},
+
+    {"zinc_in_fill", RuntimeMode::Unbuffered, "",
+     "zinc_in_fill:\n",
+     ""},
+
+    {"zinc_in_fill", RuntimeMode::Always, "",
+     "    xor rax,rax\n"
+     "    xor rdi,rdi\n"
+     "    lea rsi,[rel in_buf]\n"
+     "    mov rdx,65536\n"
+     "    syscall\n"
+     "    test rax,rax\n"
+     "    jg .in_fill_done\n"
+     "    xor rax,rax\n"
+     ".in_fill_done:\n"
+     "    mov [rel in_len],rax\n"
+     "    mov qword [rel in_pos],0\n"
+     "    mov rdx,rax\n"
+     "    xor rcx,rcx\n"
+     "    lea r10,[rel in_buf]\n"
+     "    ret\n",
+     "in_buf: resb 65536\n"
+     "in_pos: resq 1\n"
+     "in_len: resq 1\n"},
+
+    // Read the next whitespace separated token as a signed decimal integer.
+    // Bytes <= ' ' separate tokens. A leading '-' negates; parsing stops at the
+    // first non-digit and the rest of the token is dropped, so a token without
+    // digits reads as 0, as does end of input. r8 = value, r9 = sign and
+    // rcx/rdx = position/length in in_buf stay in registers between refills.
+    {"zinc_scan_int", RuntimeMode::Always, "zinc_in_fill",
+     "zinc_scan_int:\n"
+     "    lea r10,[rel in_buf]\n"
+     "    mov rcx,[rel in_pos]\n"
+     "    mov rdx,[rel in_len]\n"
+     "    xor r8,r8\n"
+     "    xor r9,r9\n"
+     ".scan_skip_ws:\n"
+     "    cmp rcx,rdx\n"
+     "    jb .scan_ws_char\n"
+     "    call zinc_in_fill\n"
+     "    xor r8,r8\n"
+     "    xor r9,r9\n"
+     "    test rdx,rdx\n"
+     "    jz .scan_done\n"
+     ".scan_ws_char:\n"
+     "    movzx rax,byte [r10+rcx]\n"
+     "    cmp rax,' '\n"
+     "    ja .scan_token\n"
+     "    inc rcx\n"
+     "    jmp .scan_skip_ws\n"
+     ".scan_token:\n"
+     "    cmp rax,'-'\n"
+     "    jne .scan_digits\n"
+     "    mov r9,1\n"
+     "    inc rcx\n"
+     ".scan_digits:\n"
+     "    cmp rcx,rdx\n"
+     "    jb .scan_digit_char\n"
+     "    push r8\n"
+     "    push r9\n"
+     "    call zinc_in_fill\n"
+     "    pop r9\n"
+     "    pop r8\n"
+     "    test rdx,rdx\n"
+     "    jz .scan_done\n"
+     ".scan_digit_char:\n"
+     "    movzx rax,byte [r10+rcx]\n"
+     "    sub rax,'0'\n"
+     "    cmp rax,9\n"
+     "    ja .scan_rest\n"
+     "    imul r8,r8,10\n"
+     "    add r8,rax\n"
+     "    inc rcx\n"
+     "    jmp .scan_digits\n"
+     ".scan_rest:\n"
+     "    movzx rax,byte [r10+rcx]\n"
+     "    cmp rax,' '\n"
+     "    jbe .scan_done\n"
+     "    inc rcx\n"
+     "    cmp rcx,rdx\n"
+     "    jb .scan_rest\n"
+     "    push r8\n"
+     "    push r9\n"
+     "    call zinc_in_fill\n"
+     "    pop r9\n"
+     "    pop r8\n"
+     "    test rdx,rdx\n"
+     "    jnz .scan_rest\n"
+     ".scan_done:\n"
+     "    mov [rel in_pos],rcx\n"
+     "    mov rax,r8\n"
+     "    test r9,r9\n"
+     "    jz .scan_ret\n"
+     "    neg rax\n"
+     ".scan_ret:\n"
+     "    ret\n",
+     ""},
+
+    // host_io: forward to the host's C functions. Those may clobber exactly the
+    // registers our convention allows, but need an aligned stack.
+    {"zinc_print_str", RuntimeMode::Host, "zinc_host_call",
+     "zinc_print_str:\n"
+     "    mov rdi,rsi\n"
+     "    mov rsi,rdx\n"
+     "    mov rax,[rel zinc_host_io]\n"
+     "    jmp zinc_host_call\n",
+     ""},
+
+    {"zinc_print_int", RuntimeMode::Host, "zinc_host_call",
+     "zinc_print_int:\n"
+     "    mov rax,[rel zinc_host_io+8]\n"
+     "    jmp zinc_host_call\n",
+     ""},
+
+    {"zinc_scan_int", RuntimeMode::Host, "zinc_host_call",
+     "zinc_scan_int:\n"
+     "    mov rax,[rel zinc_host_io+16]\n"
+     "    jmp zinc_host_call\n",
+     ""},
+
+    {"zinc_host_call", RuntimeMode::Host, "",
+     "zinc_host_call:\n"
+     "    push rbp\n"
+     "    mov rbp,rsp\n"
+     "    and rsp,-16\n"
+     "    call rax\n"
+     "    mov rsp,rbp\n"
+     "    pop rbp\n"
+     "    ret\n",
+     "zinc_host_io: resq 3\n"},
+};
+
+static bool mode_matches(RuntimeMode m, const RuntimeOptions &opts)
+{
+    if (opts.host_io || m == RuntimeMode::Host)
+        return opts.host_io && m == RuntimeMode::Host;
+    if (m == RuntimeMode::Always)
+        return true;
+    return (m == RuntimeMode::Buffered) == opts.buffered_output;
+}
+
+void write_start(AsmStream &out, std::set<std::string> &used, const RuntimeOptions &opts)
+{
+    bool prints = used.count("zinc_print_str") || used.count("zinc_print_int");
+    bool buffered = opts.buffered_output && prints;
+
+    // generated code does not preserve rbx; a host calling _start expects
+    // every System V callee-saved register back
+    static const char *host_saved[] = {"rbx", "rbp", "r12", "r13", "r14", "r15"};
+
+    out << "section .text\n";
+    out << "global _start\n";
+    out << "_start:\n";
+    if (opts.jit)
+        for (auto r : host_saved)
+            out << "    push " << r << "\n";
+    if (buffered)
+        out << "    call " << *used.insert("zinc_rt_init").first << "\n";
+    if (opts.init)
+        out << "    call " << init_function << "\n";
+    out << "    call main\n";
+    if (buffered)
+        out << "    call " << *used.insert("zinc_flush").first << "\n";
+    if (opts.profile)
+        out << "    call " << *used.insert("zinc_profile_dump").first << "\n";
+    if (opts.jit)
+    {
+        for (int i = 5; i >= 0; --i)
+            out << "    pop " << host_saved[i] << "\n";
+        out << "    ret\n";
+    }
+    else
+        out << "    mov rax,60\n    xor rdi,rdi\n    syscall\n";
+}
+
+void write_runtime(AsmStream &out, const std::set<std::string> &used, const RuntimeOptions &opts)
+{
+    // close over dependencies
+    std::set<std::string> all = used;
+    for (bool grew = true; grew;)
+    {
+        grew = false;
+        for (auto &r : routines)
+        {
+            if (!all.count(r.name) || !mode_matches(r.mode, opts))
+                continue;
+            std::istringstream deps(r.deps);
+            std::string d;
+            while (deps >> d)
+                grew |= all.insert(d).second;
+        }
+    }
+
+    out << "section .text\n";
+    for (auto &r : routines)
+        if (all.count(r.name) && mode_matches(r.mode, opts))
+            out << r.text;
+
+    out << "section .bss\n";
+    for (auto &r : routines)
+        if (all.count(r.name) && mode_matches(r.mode, opts))
+            out << r.bss;
+}
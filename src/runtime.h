@@ -0,0 +1,47 @@
+#pragma once
+#include "asm.h"
+#include <set>
+#include <string>
+
+// Runtime routines shared by every call site. Each routine is emitted once,
+// after the user functions, and only if the program calls it (directly or
+// through another routine).
+//
+// Calling convention (internal, not System V):
+//   zinc_print_str   in: rsi = bytes, rdx = length   out: rax = bytes written
+//   zinc_print_int   in: rdi = signed value          out: rax = bytes written
+//   zinc_scan_int                                    out: rax = next integer token
+//   zinc_flush       write out any buffered output
+//   zinc_profile_dump  write the zinc_profile block (.data) to the file named
+//                      by zinc_profile_path; both are emitted by codegen
+// All routines may clobber rax, rcx, rdx, rsi, rdi, r8-r11 and preserve every
+// other register (in particular rbx, rbp and r12-r15).
+//
+// With buffered output (the default) print appends to a 64 KiB buffer in .bss
+// that is flushed when full, after a newline if stdout is a terminal, before
+// scan blocks on a read, and by _start before the exit syscall.
+//
+// scan always reads stdin through a 64 KiB buffer, refilled when exhausted,
+// so consecutive scans cost one read(2) per 64 KiB of input.
+//
+// With host_io (code loaded next to the interpreter by --tiered) none of the
+// above is emitted: print and scan call the host's System V functions whose
+// addresses the loader stores in zinc_host_io (.bss), so native and
+// interpreted frames share one output buffer and one input buffer:
+//   [0] int64_t print_str(const char *bytes, int64_t length)
+//   [1] int64_t print_int(int64_t value)
+//   [2] int64_t scan_int()
+
+struct RuntimeOptions {
+    bool buffered_output = true;
+    bool jit = false; // _start is called in-process: save host registers and return instead of exiting
+    bool host_io = false; // print/scan call back into the host through zinc_host_io
+    bool profile = false; // _start writes the --profile-generate counters before exiting (profile.h)
+    bool init = false; // _start calls zinc$init, which sets the globals, before main (globals.h)
+};
+
+// _start: runtime setup, call zinc$init and main, flush, write the profile, exit (or
+// return, for the JIT)
+void write_start(AsmStream &out, std::set<std::string> &used, const RuntimeOptions &opts);
+// every routine in `used` plus its dependencies, then their .bss buffers
+void write_runtime(AsmStream &out, const std::set<std::string> &used, const RuntimeOptions &opts);
@@ -178,113 +178,138 @@ private:
         }
     }
 
-    // analyze expression and return its type string
+    // analyze expression and return its type string; chains of unary and
+    // binary operators are walked from an explicit stack, calls and
+    // if-expressions recurse into their operands
     std::string analyzeExpr(const Expr *e) {
         if (!e) return "unknown";
+        std::vector<std::string> types; // finished operands, in evaluation order
+        walk_expr(e, [&](const Expr *x) {
+            if (dynamic_cast<const UnaryExpr*>(x) || dynamic_cast<const BinaryExpr*>(x)) return true;
+            types.push_back(analyzeOperand(x));
+            return false;
+        }, [&](const Expr *x) {
+            std::string R = types.back();
+            types.pop_back();
+            if (auto u = dynamic_cast<const UnaryExpr*>(x)) {
+                types.push_back(analyzeUnary(u, R));
+                return;
+            }
+            std::string L = types.back();
+            types.pop_back();
+            types.push_back(analyzeBinary(static_cast<const BinaryExpr*>(x), L, R));
+        });
+        return types.back();
+    }
 
-        if (auto n = dynamic_cast<const NumberLiteral*>(e)) {
+    std::string analyzeUnary(const UnaryExpr *u, const std::string &rt) {
+        const Expr *e = u;
+        if (u->op == "-" ) {
+            if (rt != "int" && rt != "unknown") throw std::runtime_error("Unary '-' requires int");
             exprTypes[e] = "int";
             return "int";
         }
-        if (auto s = dynamic_cast<const StringLiteral*>(e)) {
-            exprTypes[e] = "string";
-            return "string";
-        }
-        if (auto b = dynamic_cast<const BoolLiteral*>(e)) {
+        if (u->op == "!") {
+            if (rt != "bool" && rt != "unknown") throw std::runtime_error("Unary '!' requires bool");
             exprTypes[e] = "bool";
             return "bool";
         }
-        if (auto id = dynamic_cast<const Identifier*>(e)) {
-            auto sym = env->lookup(id->name);
-            if (!sym) throw std::runtime_error("Undefined identifier: " + id->name);
+        exprTypes[e] = "unknown";
+        return "unknown";
+    }
+
+    std::string analyzeBinary(const BinaryExpr *bin, const std::string &L, const std::string &R) {
+        const Expr *e = bin;
+        const auto &op = bin->op;
+
+        // assignment
+        if (op == "=") {
+            // left must be ident
+            auto idl = dynamic_cast<const Identifier*>(bin->left.get());
+            if (!idl) throw std::runtime_error("Left-hand side of assignment must be a variable");
+            auto sym = env->lookup(idl->name);
+            if (!sym) throw std::runtime_error("Assign to undefined variable: " + idl->name);
+
+            if (sym->type == "unknown" && R != "unknown") {
+                // infer variable type
+                sym->type = R;
+            } else if (sym->type != "unknown" && R != "unknown" && sym->type != R) {
+                throw std::runtime_error("Type mismatch in assignment to '" + idl->name + "': " + sym->type + " <- " + R);
+            }
             exprTypes[e] = sym->type;
             return sym->type;
         }
-        if (auto u = dynamic_cast<const UnaryExpr*>(e)) {
-            std::string rt = analyzeExpr(u->right.get());
-            if (u->op == "-" ) {
-                if (rt != "int" && rt != "unknown") throw std::runtime_error("Unary '-' requires int");
+
+        // arithmetic
+        if (op == "+" || op == "-" || op == "*" || op == "/" || op == "%") {
+            if (op == "+" && L == "string" && R == "string") {
+                exprTypes[e] = "string"; // string concat
+                return "string";
+            }
+            if ((L == "int" || L == "unknown") && (R == "int" || R == "unknown")) {
                 exprTypes[e] = "int";
                 return "int";
             }
-            if (u->op == "!") {
-                if (rt != "bool" && rt != "unknown") throw std::runtime_error("Unary '!' requires bool");
+            throw std::runtime_error("Arithmetic operator '" + op + "' requires integer operands");
+        }
+
+        // comparisons
+        if (op == "==" || op == "!=") {
+            if (L != R && L != "unknown" && R != "unknown")
+                throw std::runtime_error("Comparing different types with '" + op + "': " + L + " vs " + R);
+            exprTypes[e] = "bool";
+            return "bool";
+        }
+        if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+            if (L == "int" || L == "unknown") {
                 exprTypes[e] = "bool";
                 return "bool";
             }
+            throw std::runtime_error("Relational operator '" + op + "' requires integer operands");
         }
-        if (auto bin = dynamic_cast<const BinaryExpr*>(e)) {
-            std::string L = analyzeExpr(bin->left.get());
-            std::string R = analyzeExpr(bin->right.get());
-            const auto &op = bin->op;
-
-            // assignment
-            if (op == "=") {
-                // left must be ident
-                auto idl = dynamic_cast<const Identifier*>(bin->left.get());
-                if (!idl) throw std::runtime_error("Left-hand side of assignment must be a variable");
-                auto sym = env->lookup(idl->name);
-                if (!sym) throw std::runtime_error("Assign to undefined variable: " + idl->name);
-
-                if (sym->type == "unknown" && R != "unknown") {
-                    // infer variable type
-                    sym->type = R;
-                } else if (sym->type != "unknown" && R != "unknown" && sym->type != R) {
-                    throw std::runtime_error("Type mismatch in assignment to '" + idl->name + "': " + sym->type + " <- " + R);
-                }
-                exprTypes[e] = sym->type;
-                return sym->type;
-            }
-
-            // arithmetic
-            if (op == "+" || op == "-" || op == "*" || op == "/" || op == "%") {
-                if (op == "+" && L == "string" && R == "string") {
-                    exprTypes[e] = "string"; // string concat
-                    return "string";
-                }
-                if ((L == "int" || L == "unknown") && (R == "int" || R == "unknown")) {
-                    exprTypes[e] = "int";
-                    return "int";
-                }
-                throw std::runtime_error("Arithmetic operator '" + op + "' requires integer operands");
-            }
 
-            // comparisons
-            if (op == "==" || op == "!=") {
-                if (L != R && L != "unknown" && R != "unknown")
-                    throw std::runtime_error("Comparing different types with '" + op + "': " + L + " vs " + R);
+        // logical
+        if (op == "&&" || op == "||") {
+            if ((L == "bool" || L == "unknown") && (R == "bool" || R == "unknown")) {
                 exprTypes[e] = "bool";
                 return "bool";
             }
-            if (op == "<" || op == "<=" || op == ">" || op == ">=") {
-                if (L == "int" || L == "unknown") {
-                    exprTypes[e] = "bool";
-                    return "bool";
-                }
-                throw std::runtime_error("Relational operator '" + op + "' requires integer operands");
-            }
+            throw std::runtime_error("Logical operator '" + op + "' requires bool operands");
+        }
 
-            // logical
-            if (op == "&&" || op == "||") {
-                if ((L == "bool" || L == "unknown") && (R == "bool" || R == "unknown")) {
-                    exprTypes[e] = "bool";
-                    return "bool";
-                }
-                throw std::runtime_error("Logical operator '" + op + "' requires bool operands");
+        // bitwise
+        if (op == "&" || op == "|" || op == "^" || op == "<<" || op == ">>") {
+            if ((L == "int" || L == "unknown") && (R == "int" || R == "unknown")) {
+                exprTypes[e] = "int";
+                return "int";
             }
+            throw std::runtime_error("Bitwise operator '" + op + "' requires integer operands");
+        }
 
-            // bitwise
-            if (op == "&" || op == "|" || op == "^" || op == "<<" || op == ">>") {
-                if ((L == "int" || L == "unknown") && (R == "int" || R == "unknown")) {
-                    exprTypes[e] = "int";
-                    return "int";
-                }
-                throw std::runtime_error("Bitwise operator '" + op + "' requires integer operands");
-            }
+        // fallback
+        exprTypes[e] = "unknown";
+        return "unknown";
+    }
 
-            // fallback
-            exprTypes[e] = "unknown";
-            return "unknown";
+    // literals, identifiers, calls and if-expressions
+    std::string analyzeOperand(const Expr *e) {
+        if (auto n = dynamic_cast<const NumberLiteral*>(e)) {
+            exprTypes[e] = "int";
+            return "int";
+        }
+        if (auto s = dynamic_cast<const StringLiteral*>(e)) {
+            exprTypes[e] = "string";
+            return "string";
+        }
+        if (auto b = dynamic_cast<const BoolLiteral*>(e)) {
+            exprTypes[e] = "bool";
+            return "bool";
+        }
+        if (auto id = dynamic_cast<const Identifier*>(e)) {
+            auto sym = env->lookup(id->name);
+            if (!sym) throw std::runtime_error("Undefined identifier: " + id->name);
+            exprTypes[e] = sym->type;
+            return sym->type;
         }
         if (auto call = dynamic_cast<const CallExpr*>(e)) {
             // callee should be identifier (function name) or another expression returning a function (not implemented)
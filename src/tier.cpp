@@ -0,0 +1,250 @@
+#include "tier.h"
+#include "assembler.h"
+#include "globals.h"
+#include "jit.h"
+#include "optimize.h"
+#include <chrono>
+#include <unordered_map>
+
+// ---------------- Eligibility ----------------
+// Constructs codegen leaves undefined (stale rax, uninitialized slots) would
+// make native code disagree with the interpreter, so they keep a function
+// interpreted, and so do globals: a unit has no copy of the interpreter's.
+// Calls are collected for the closure walk.
+
+using Names = std::set<std::string>;
+
+static bool native_safe_expr(const Expr *e, const Names &locals, std::vector<std::string> &calls)
+{
+    std::vector<const Expr *> todo{e};
+    while (!todo.empty())
+    {
+        const Expr *x = todo.back();
+        todo.pop_back();
+        if (dynamic_cast<const NumberLiteral *>(x))
+            continue;
+        if (auto id = dynamic_cast<const Identifier *>(x))
+        {
+            if (!locals.count(id->name))
+                return false;
+        }
+        else if (dynamic_cast<const BinaryExpr *>(x) || dynamic_cast<const IfExpr *>(x))
+            push_operands(todo, x);
+        else if (auto c = dynamic_cast<const CallExpr *>(x))
+        {
+            auto id = dynamic_cast<const Identifier *>(c->callee.get());
+            if (!id || c->args.size() > 6)
+                return false;
+            bool print = id->name == "print";
+            if (!print && id->name != "scan")
+                calls.push_back(id->name);
+            for (size_t i = c->args.size(); i-- > 0;)
+                if (!(print && dynamic_cast<const StringLiteral *>(c->args[i].get())))
+                    todo.push_back(c->args[i].get());
+        }
+        else
+            return false; // unary, bool and string values
+    }
+    return true;
+}
+
+static bool native_safe_stmt(const Stmt *s, const Names &locals, std::vector<std::string> &calls)
+{
+    if (!s)
+        return true;
+    if (auto b = dynamic_cast<const BlockStmt *>(s))
+    {
+        for (auto &st : b->stmts)
+            if (!native_safe_stmt(st.get(), locals, calls))
+                return false;
+        return true;
+    }
+    // compiler temporaries ('$', optimize.h) are declared without a value but
+    // always assigned before they are read
+    if (auto l = dynamic_cast<const LetStmt *>(s))
+        return l->init ? native_safe_expr(l->init.get(), locals, calls) : l->name[0] == '$';
+    if (auto e = dynamic_cast<const ExprStmt *>(s))
+        return native_safe_expr(e->expr.get(), locals, calls);
+    if (auto r = dynamic_cast<const ReturnStmt *>(s))
+        return r->value && native_safe_expr(r->value.get(), locals, calls);
+    if (auto i = dynamic_cast<const IfStmt *>(s))
+        return native_safe_expr(i->cond.get(), locals, calls) &&
+               native_safe_stmt(i->thenBranch.get(), locals, calls) &&
+               native_safe_stmt(i->elseBranch.get(), locals, calls);
+    if (auto w = dynamic_cast<const WhileStmt *>(s))
+        return native_safe_expr(w->cond.get(), locals, calls) && native_safe_stmt(w->body.get(), locals, calls);
+    return false;
+}
+
+// ---------------- Compiler thread ----------------
+
+TierCompiler::TierCompiler(std::vector<const FunctionDecl *> functions, HostIo io, const CodeGenOptions &opts)
+    : functions(std::move(functions)), io(io), opts(opts),
+      entries(new std::atomic<NativeEntry>[this->functions.size()]),
+      states(this->functions.size(), State::Cold), compile_ms(this->functions.size(), 0)
+{
+    this->opts.runtime.host_io = true;
+    for (size_t i = 0; i < this->functions.size(); ++i)
+        entries[i].store(nullptr, std::memory_order_relaxed);
+    worker = std::thread(&TierCompiler::run, this);
+}
+
+TierCompiler::~TierCompiler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void TierCompiler::request(int index)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (states[index] != State::Cold)
+            return;
+        states[index] = State::Queued;
+        queue.push_back(index);
+    }
+    wake.notify_one();
+}
+
+void TierCompiler::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (stopping)
+            return;
+        int index = queue.front();
+        queue.pop_front();
+        if (states[index] != State::Queued) // promoted meanwhile as another unit's callee
+            continue;
+        lock.unlock();
+        compile(index);
+        lock.lock();
+    }
+}
+
+// Generate, assemble and load `index` together with every function it can
+// reach, so the native code never calls back into the interpreter.
+void TierCompiler::compile(int index)
+{
+    auto started = std::chrono::steady_clock::now();
+
+    std::unordered_map<std::string, int> by_name;
+    for (size_t i = 0; i < functions.size(); ++i)
+        by_name[functions[i]->name] = static_cast<int>(i);
+
+    std::vector<int> unit = {index};
+    std::vector<bool> seen(functions.size());
+    seen[index] = true;
+    bool ok = true;
+    for (size_t i = 0; i < unit.size() && ok; ++i)
+    {
+        const FunctionDecl *f = functions[unit[i]];
+        std::vector<std::string> calls;
+        // native code returns whatever is in rax when it falls off the end, the
+        // interpreter returns 0: only promote functions that always return a value
+        ok = f->params.size() <= 6 && native_safe_stmt(f->body.get(), function_locals(*f), calls) &&
+             always_returns(f->body.get());
+        for (auto &name : calls)
+        {
+            auto it = by_name.find(name);
+            if (it == by_name.end())
+                ok = false;
+            else if (!seen[it->second])
+            {
+                seen[it->second] = true;
+                unit.push_back(it->second);
+            }
+        }
+    }
+
+    std::unique_ptr<JitModule> module;
+    if (ok)
+    {
+        std::vector<const FunctionDecl *> fns;
+        for (int i : unit)
+            fns.push_back(functions[i]);
+        AsmStream code;
+        gen_functions(code, fns, opts);
+
+        // System V entry stubs: generated code clobbers rbx and does not keep
+        // the stack aligned, so save what the interpreter expects preserved
+        static const char *saved[] = {"rbx", "rbp", "r12", "r13", "r14", "r15"};
+        code << "section .text\n";
+        for (auto f : fns)
+        {
+            code << "zinc_enter_" << f->name << ":\n";
+            for (auto r : saved)
+                code << "    push " << r << "\n";
+            code << "    call " << f->name << "\n";
+            for (int i = 5; i >= 0; --i)
+                code << "    pop " << saved[i] << "\n";
+            code << "    ret\n";
+        }
+
+        try
+        {
+            module.reset(new JitModule(assemble(code.lines)));
+        }
+        catch (const std::exception &)
+        {
+            ok = false; // something codegen emits that the assembler cannot encode: stay interpreted
+        }
+    }
+    if (ok)
+        if (auto table = static_cast<void **>(module->symbol("zinc_host_io")))
+        {
+            table[0] = reinterpret_cast<void *>(io.print_str);
+            table[1] = reinterpret_cast<void *>(io.print_int);
+            table[2] = reinterpret_cast<void *>(io.scan_int);
+        }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ok)
+    {
+        states[index] = State::Rejected;
+        return;
+    }
+    for (int i : unit)
+        if (states[i] != State::Native)
+        {
+            states[i] = State::Native;
+            compile_ms[i] = ms;
+            entries[i].store(reinterpret_cast<NativeEntry>(module->symbol("zinc_enter_" + functions[i]->name)),
+                             std::memory_order_release);
+        }
+    modules.push_back(std::move(module));
+}
+
+void TierCompiler::dump_stats(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "tiered execution:\n";
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        os << "  " << functions[i]->name << ": ";
+        switch (states[i])
+        {
+        case State::Cold:
+            os << "interpreted\n";
+            break;
+        case State::Queued:
+            os << "hot, still compiling at exit\n";
+            break;
+        case State::Native:
+            os << "native (unit compiled in " << compile_ms[i] << " ms)\n";
+            break;
+        case State::Rejected:
+            os << "hot, kept interpreted (not eligible for native code)\n";
+            break;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "ast.h"
+#include "codegen.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Background native compiler for tiered execution (--tiered).
+//
+// The interpreter counts calls and loop back-edges per function and calls
+// request() when a function gets hot. A worker thread then generates native
+// code for the function and everything it calls, loads it next to the
+// interpreter and publishes an entry point; the interpreter uses it from the
+// next call on. Native and interpreted code share the interpreter's print/scan
+// buffers through RuntimeOptions::host_io, so output order is unchanged.
+//
+// Only functions whose native code means the same as their bytecode are
+// promoted: at most 6 parameters, every path ending in `return <value>`, no
+// unary operators, bool or string values outside print, and no `let` without
+// an initializer, in the function and in every function it can reach. A
+// function that is hot only inside one long call (main's loop, say) keeps
+// running in the interpreter until it is called again.
+
+// Native entry point: System V call, the function's arguments in order
+// (unused ones ignored), returns the function's result.
+using NativeEntry = int64_t (*)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t);
+
+// host side of print/scan (see runtime.h)
+struct HostIo {
+    int64_t (*print_str)(const char *bytes, int64_t length);
+    int64_t (*print_int)(int64_t value);
+    int64_t (*scan_int)();
+};
+
+struct JitModule;
+
+class TierCompiler {
+public:
+    // `functions` are the program's functions, indexed as in request()/entry()
+    TierCompiler(std::vector<const FunctionDecl *> functions, HostIo io, const CodeGenOptions &opts);
+    // waits for a compile in progress, then unloads all native code
+    ~TierCompiler();
+
+    // queue function `index` for compilation; later requests for it are ignored
+    void request(int index);
+
+    // native code for function `index`, or nullptr while it is interpreted
+    NativeEntry entry(int index) const { return entries[index].load(std::memory_order_acquire); }
+
+    // per function: when it was queued and whether it was promoted
+    void dump_stats(std::ostream &os) const;
+
+private:
+    enum class State { Cold, Queued, Native, Rejected };
+
+    std::vector<const FunctionDecl *> functions;
+    HostIo io;
+    CodeGenOptions opts;
+    std::unique_ptr<std::atomic<NativeEntry>[]> entries;
+    std::vector<State> states;          // guarded by mutex
+    std::vector<double> compile_ms;     // guarded by mutex; for the unit a function was promoted in
+    std::vector<std::unique_ptr<JitModule>> modules; // owned by the worker until shutdown
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<int> queue;
+    bool stopping = false;
+    std::thread worker;
+
+    void run();
+    void compile(int index);
+};
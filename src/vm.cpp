@@ -0,0 +1,902 @@
+#include "vm.h"
+#include "codegen.h"
+#include "optimize.h"
+#include "globals.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+#include <unordered_map>
+
+// ---------------- Bytecode ----------------
+//
+// Frame layout of a function: [params and locals][constants][temporaries].
+// Constants are copied into their slots when the frame is set up, so every
+// operand is a slot and arithmetic never needs a load-constant instruction.
+
+enum class Op
+{
+    Mov,                                   // a = b
+    GetGlobal, SetGlobal,                  // a = global #b; global #a = b
+    Add, Sub, Mul, Div, Mod,               // a = b op c
+    And, Or, Xor, Shl, Shr,
+    Eq, Ne, Lt, Le, Gt, Ge,                // a = (b op c) ? 1 : 0
+    LAnd, LOr,                             // a = (b != 0) op (c != 0)
+    Neg, Not,                              // a = op b
+    Jmp,                                   // goto a
+    Loop,                                  // goto a, counting a back-edge (tiered only)
+    Jz,                                    // if b == 0 goto a
+    JEq, JNe, JLt, JLe, JGt, JGe,          // if (b op c) goto a
+    Call,                                  // a = call function b(slots c .. c+d-1)
+    Ret,                                   // return b
+    PrintStr,                              // a += write string #b
+    PrintInt,                              // a += write integer in slot b
+    Scan,                                  // a = next integer token from stdin
+    Count
+};
+
+struct Insn
+{
+    const void *handler = nullptr; // set when the code is threaded
+    Op op;
+    int32_t a = 0, b = 0, c = 0, d = 0;
+};
+
+struct VmFunction
+{
+    std::string name;
+    int params = 0;
+    int locals = 0;                  // includes params
+    std::vector<int64_t> constants;  // slots [locals, locals + constants.size())
+    int frame_size = 0;              // locals + constants + temporaries
+    size_t entry = 0;                // index of the first instruction
+    uint32_t hotness = 0;            // calls + back-edges so far (tiered only)
+};
+
+struct VmProgram
+{
+    std::vector<VmFunction> functions;
+    std::vector<Insn> code;
+    std::vector<std::string> strings; // print string arguments, escapes applied
+    std::vector<int64_t> globals;     // values before zinc$init runs (globals.h)
+    int main_index = -1;
+    int init_index = -1;              // zinc$init, if the program has one
+};
+
+// ---------------- Lowering ----------------
+
+static int64_t parse_literal(const std::string &digits)
+{
+    // same bits NASM would assemble for the literal
+    return static_cast<int64_t>(strtoull(digits.c_str(), nullptr, 10));
+}
+
+class VmCompiler
+{
+public:
+    VmCompiler(VmProgram &prog, bool count_loops) : prog(prog), count_loops(count_loops) {}
+
+    void compile(const Program &program)
+    {
+        // functions and globals are referenced by index, so number them all first
+        for (auto &stmt : program)
+            if (auto l = dynamic_cast<const LetStmt *>(stmt.get()))
+            {
+                auto n = dynamic_cast<const NumberLiteral *>(l->init.get());
+                global_index[l->name] = static_cast<int>(prog.globals.size());
+                prog.globals.push_back(n ? parse_literal(n->value) : 0);
+            }
+            else if (auto f = dynamic_cast<const FunctionDecl *>(stmt.get()))
+            {
+                if (function_index.count(f->name))
+                    throw std::runtime_error("Function already defined: " + f->name);
+                function_index[f->name] = static_cast<int>(prog.functions.size());
+                prog.functions.push_back({f->name});
+            }
+        for (auto &stmt : program)
+            if (auto f = dynamic_cast<const FunctionDecl *>(stmt.get()))
+                compile_function(f);
+        auto m = function_index.find("main");
+        if (m == function_index.end())
+            throw std::runtime_error("no main function");
+        prog.main_index = m->second;
+        auto init = function_index.find(init_function);
+        if (init != function_index.end())
+            prog.init_index = init->second;
+    }
+
+private:
+    VmProgram &prog;
+    bool count_loops;
+    std::unordered_map<std::string, int> function_index;
+    std::unordered_map<std::string, int> string_index;
+    std::unordered_map<std::string, int> global_index;
+
+    // per function
+    VmFunction *fn = nullptr;
+    std::unordered_map<std::string, int> slots;     // variable -> slot
+    std::unordered_map<int64_t, int> constant_slot; // value -> index into fn->constants
+    std::vector<std::pair<size_t, int64_t>> const_uses; // (insn, constant) for operands resolved at the end
+    int temp_top = 0;
+    int temp_max = 0;
+    // names each expression of the function assigns, once per node (see keep_left)
+    std::unordered_map<const Expr *, std::shared_ptr<const std::set<std::string>>> assigned;
+
+    // Slots for constants are only known once all locals are counted, so
+    // operands referring to constants are encoded as -1 - index and fixed up.
+    int constant(int64_t v)
+    {
+        auto it = constant_slot.find(v);
+        if (it == constant_slot.end())
+        {
+            it = constant_slot.emplace(v, static_cast<int>(fn->constants.size())).first;
+            fn->constants.push_back(v);
+        }
+        return -1 - it->second;
+    }
+
+    int temp() { temp_max = std::max(temp_max, ++temp_top); return 1 << 30 | (temp_top - 1); }
+
+    size_t emit(Op op, int a = 0, int b = 0, int c = 0, int d = 0)
+    {
+        Insn in;
+        in.op = op;
+        in.a = a;
+        in.b = b;
+        in.c = c;
+        in.d = d;
+        prog.code.push_back(in);
+        return prog.code.size() - 1;
+    }
+
+    int here() const { return static_cast<int>(prog.code.size() - fn->entry); }
+
+    int local(const std::string &name)
+    {
+        auto it = slots.find(name);
+        if (it != slots.end())
+            return it->second;
+        int s = fn->locals++;
+        slots[name] = s;
+        return s;
+    }
+
+    // every let in the body gets its slot up front, like codegen's frame pre-scan
+    void declare_lets(const Stmt *s)
+    {
+        if (auto b = dynamic_cast<const BlockStmt *>(s))
+            for (auto &st : b->stmts)
+                declare_lets(st.get());
+        else if (auto l = dynamic_cast<const LetStmt *>(s))
+            local(l->name);
+        else if (auto i = dynamic_cast<const IfStmt *>(s))
+        {
+            declare_lets(i->thenBranch.get());
+            declare_lets(i->elseBranch.get());
+        }
+        else if (auto w = dynamic_cast<const WhileStmt *>(s))
+            declare_lets(w->body.get());
+    }
+
+    void compile_function(const FunctionDecl *f)
+    {
+        fn = &prog.functions[function_index[f->name]];
+        fn->entry = prog.code.size();
+        slots.clear();
+        constant_slot.clear();
+        assigned.clear();
+        temp_top = temp_max = 0;
+
+        for (auto &p : f->params)
+            local(p.first);
+        fn->params = static_cast<int>(f->params.size());
+        declare_lets(f->body.get());
+
+        gen_stmt(f->body.get());
+        emit(Op::Ret, 0, constant(0));
+
+        // resolve constant and temporary operands now that the layout is final
+        int const_base = fn->locals;
+        int temp_base = const_base + static_cast<int>(fn->constants.size());
+        fn->frame_size = temp_base + temp_max;
+        for (size_t i = fn->entry; i < prog.code.size(); ++i)
+        {
+            Insn &in = prog.code[i];
+            bool jump = in.op == Op::Jmp || in.op == Op::Loop || in.op == Op::Jz ||
+                        (in.op >= Op::JEq && in.op <= Op::JGe);
+            auto fix = [&](int32_t &slot)
+            {
+                if (slot < 0)
+                    slot = const_base + (-1 - slot);
+                else if (slot & (1 << 30))
+                    slot = temp_base + (slot & ~(1 << 30));
+            };
+            if (jump)
+                in.a += static_cast<int32_t>(fn->entry);
+            else if (in.op != Op::SetGlobal)
+                fix(in.a);
+            if (in.op != Op::Call && in.op != Op::PrintStr && in.op != Op::GetGlobal)
+                fix(in.b);
+            fix(in.c);
+        }
+    }
+
+    // ---- statements ----
+    void gen_stmt(const Stmt *s)
+    {
+        if (!s)
+            return;
+        int saved = temp_top;
+        if (auto b = dynamic_cast<const BlockStmt *>(s))
+            for (auto &st : b->stmts)
+                gen_stmt(st.get());
+        else if (auto l = dynamic_cast<const LetStmt *>(s))
+        {
+            if (l->init)
+                gen_into(l->init.get(), local(l->name));
+        }
+        else if (auto e = dynamic_cast<const ExprStmt *>(s))
+            gen_expr(e->expr.get());
+        else if (auto r = dynamic_cast<const ReturnStmt *>(s))
+            emit(Op::Ret, 0, r->value ? gen_expr(r->value.get()) : constant(0));
+        else if (auto i = dynamic_cast<const IfStmt *>(s))
+        {
+            size_t to_else = gen_branch_if_false(i->cond.get());
+            gen_stmt(i->thenBranch.get());
+            if (i->elseBranch)
+            {
+                size_t to_end = emit(Op::Jmp);
+                prog.code[to_else].a = here();
+                gen_stmt(i->elseBranch.get());
+                prog.code[to_end].a = here();
+            }
+            else
+                prog.code[to_else].a = here();
+        }
+        else if (auto w = dynamic_cast<const WhileStmt *>(s))
+        {
+            int top = here();
+            size_t to_end = gen_branch_if_false(w->cond.get());
+            gen_stmt(w->body.get());
+            emit(count_loops ? Op::Loop : Op::Jmp, top);
+            prog.code[to_end].a = here();
+        }
+        temp_top = saved;
+    }
+
+    // Jump taken when `cond` is false; a comparison fuses into the branch.
+    // Returns the instruction whose target must be patched.
+    size_t gen_branch_if_false(const Expr *cond)
+    {
+        static const std::unordered_map<std::string, Op> inverse = {
+            {"==", Op::JNe}, {"!=", Op::JEq}, {"<", Op::JGe}, {"<=", Op::JGt}, {">", Op::JLe}, {">=", Op::JLt}};
+        if (auto bin = dynamic_cast<const BinaryExpr *>(cond))
+        {
+            auto it = inverse.find(bin->op);
+            if (it != inverse.end())
+            {
+                int l, r;
+                gen_operands(bin, l, r);
+                return emit(it->second, 0, l, r);
+            }
+        }
+        return emit(Op::Jz, 0, gen_expr(cond));
+    }
+
+    // ---- expressions ----
+
+    // evaluate into a specific slot
+    void gen_into(const Expr *e, int dest)
+    {
+        int r = gen_expr(e, dest);
+        if (r != dest)
+            emit(Op::Mov, dest, r);
+    }
+
+    // Evaluate both operands of a binary expression.
+    void gen_operands(const BinaryExpr *bin, int &l, int &r)
+    {
+        l = keep_left(bin, gen_expr(bin->left.get()));
+        r = gen_expr(bin->right.get());
+    }
+
+    // The left value `l` of `bin` must not change while the right side runs
+    // (codegen pushes it), so a variable the right side assigns is copied first.
+    int keep_left(const BinaryExpr *bin, int l)
+    {
+        if (l >= 0 && l < fn->locals)
+        {
+            for (auto &name : assigned_in(bin->right.get()))
+                if (slots.count(name) && slots[name] == l)
+                {
+                    int t = temp();
+                    emit(Op::Mov, t, l);
+                    return t;
+                }
+        }
+        return l;
+    }
+
+    // What collect_assigned_expr would find in `root`, memoized per node: a
+    // node shares its operand's set when that already holds everything, so a
+    // chain of n operators costs O(n) however often keep_left asks.
+    const std::set<std::string> &assigned_in(const Expr *root)
+    {
+        static const auto none = std::make_shared<const std::set<std::string>>();
+        std::vector<const Expr *> operands;
+        walk_expr(root, [&](const Expr *x) { return !assigned.count(x); }, [&](const Expr *x)
+                  {
+                      operands.clear();
+                      push_operands(operands, x);
+                      std::shared_ptr<const std::set<std::string>> names = none;
+                      for (auto op : operands)
+                          if (assigned[op]->size() > names->size())
+                              names = assigned[op];
+                      std::set<std::string> extra;
+                      for (auto op : operands)
+                          for (auto &name : *assigned[op])
+                              if (!names->count(name))
+                                  extra.insert(name);
+                      auto bin = dynamic_cast<const BinaryExpr *>(x);
+                      auto id = bin && bin->op == "=" ? dynamic_cast<const Identifier *>(bin->left.get()) : nullptr;
+                      if (id && !names->count(id->name))
+                          extra.insert(id->name);
+                      if (!extra.empty())
+                      {
+                          auto both = std::make_shared<std::set<std::string>>(*names);
+                          both->insert(extra.begin(), extra.end());
+                          names = both;
+                      }
+                      assigned[x] = names;
+                  });
+        return root ? *assigned[root] : *none;
+    }
+
+    // Returns the slot holding the value; `want` is a preferred destination.
+    // Unary and binary operators wait on an explicit stack while their
+    // operands are generated, so generated chains of them do not nest native
+    // calls; only if-expressions and call arguments recurse.
+    int gen_expr(const Expr *e, int want = -1)
+    {
+        static const std::unordered_map<std::string, Op> ops = {
+            {"+", Op::Add}, {"-", Op::Sub}, {"*", Op::Mul}, {"/", Op::Div}, {"%", Op::Mod},
+            {"&", Op::And}, {"|", Op::Or}, {"^", Op::Xor}, {"<<", Op::Shl}, {">>", Op::Shr},
+            {"==", Op::Eq}, {"!=", Op::Ne}, {"<", Op::Lt}, {"<=", Op::Le}, {">", Op::Gt}, {">=", Op::Ge},
+            {"&&", Op::LAnd}, {"||", Op::LOr}};
+        struct Pending
+        {
+            const Expr *e;
+            int want;
+            int saved;          // temp_top before the operands
+            bool right = false; // binary: the left value is in `l`
+            int l = 0;          // binary: slot of the left value; '=': the destination
+            int global = -1;    // '=' to a global: its index
+        };
+        std::vector<Pending> pending;
+        while (true)
+        {
+            if (auto u = dynamic_cast<const UnaryExpr *>(e))
+            {
+                pending.push_back({e, want, temp_top});
+                e = u->right.get();
+                want = -1;
+                continue;
+            }
+            if (auto bin = dynamic_cast<const BinaryExpr *>(e))
+            {
+                Pending p{e, want, temp_top};
+                if (bin->op == "=")
+                {
+                    auto id = dynamic_cast<const Identifier *>(bin->left.get());
+                    if (!id)
+                        throw std::runtime_error("Invalid assignment target");
+                    auto g = slots.count(id->name) ? global_index.end() : global_index.find(id->name);
+                    if (g != global_index.end())
+                    {
+                        p.l = want != -1 ? want : temp();
+                        p.global = g->second;
+                    }
+                    else
+                        p.l = gen_value(id, -1);
+                    want = p.l;
+                }
+                else
+                {
+                    if (!ops.count(bin->op))
+                        throw std::runtime_error("Unknown operator: " + bin->op);
+                    want = -1;
+                }
+                pending.push_back(p);
+                e = bin->op == "=" ? bin->right.get() : bin->left.get();
+                continue;
+            }
+
+            int v = gen_value(e, want);
+            // finish the operators whose operands are all done
+            while (true)
+            {
+                if (pending.empty())
+                    return v;
+                Pending &p = pending.back();
+                if (auto u = dynamic_cast<const UnaryExpr *>(p.e))
+                {
+                    temp_top = p.saved;
+                    int d = p.want != -1 ? p.want : temp();
+                    emit(u->op == "-" ? Op::Neg : Op::Not, d, v);
+                    v = d;
+                }
+                else
+                {
+                    auto bin = static_cast<const BinaryExpr *>(p.e);
+                    if (bin->op == "=")
+                    {
+                        if (v != p.l)
+                            emit(Op::Mov, p.l, v);
+                        if (p.global >= 0)
+                            emit(Op::SetGlobal, p.global, p.l);
+                        v = p.l;
+                    }
+                    else if (!p.right)
+                    {
+                        // left done: the right operand next
+                        p.right = true;
+                        p.l = keep_left(bin, v);
+                        e = bin->right.get();
+                        want = -1;
+                        break;
+                    }
+                    else
+                    {
+                        temp_top = p.saved;
+                        int d = p.want != -1 ? p.want : temp();
+                        emit(ops.at(bin->op), d, p.l, v);
+                        v = d;
+                    }
+                }
+                pending.pop_back();
+            }
+        }
+    }
+
+    // gen_expr for anything but unary and binary operators
+    int gen_value(const Expr *e, int want)
+    {
+        auto dest = [&]() { return want != -1 ? want : temp(); };
+
+        if (auto n = dynamic_cast<const NumberLiteral *>(e))
+            return constant(parse_literal(n->value));
+        if (auto b = dynamic_cast<const BoolLiteral *>(e))
+            return constant(b->value ? 1 : 0);
+        if (dynamic_cast<const StringLiteral *>(e))
+            return constant(0); // only meaningful as a print argument
+        if (auto id = dynamic_cast<const Identifier *>(e))
+        {
+            auto it = slots.find(id->name);
+            if (it != slots.end())
+                return it->second;
+            auto g = global_index.find(id->name);
+            if (g == global_index.end())
+                throw std::runtime_error("Undefined variable: " + id->name);
+            int d = dest();
+            emit(Op::GetGlobal, d, g->second);
+            return d;
+        }
+        if (auto ife = dynamic_cast<const IfExpr *>(e))
+        {
+            int d = dest();
+            size_t to_else = gen_branch_if_false(ife->cond.get());
+            gen_into(ife->thenExpr.get(), d);
+            size_t to_end = emit(Op::Jmp);
+            prog.code[to_else].a = here();
+            gen_into(ife->elseExpr.get(), d);
+            prog.code[to_end].a = here();
+            return d;
+        }
+        if (auto c = dynamic_cast<const CallExpr *>(e))
+        {
+            auto id = dynamic_cast<const Identifier *>(c->callee.get());
+            if (!id)
+                throw std::runtime_error("Call target must be a function name");
+            if (id->name == "print")
+            {
+                // the count accumulates in a temporary: an argument may read `want`
+                int d = temp();
+                emit(Op::Mov, d, constant(0));
+                for (auto &arg : c->args)
+                {
+                    int saved = temp_top;
+                    if (auto sl = dynamic_cast<const StringLiteral *>(arg.get()))
+                    {
+                        auto s = string_index.emplace(sl->value, static_cast<int>(prog.strings.size()));
+                        if (s.second)
+                            prog.strings.push_back(escape_string(sl->value));
+                        emit(Op::PrintStr, d, s.first->second);
+                    }
+                    else
+                        emit(Op::PrintInt, d, gen_expr(arg.get()));
+                    temp_top = saved;
+                }
+                return d;
+            }
+            if (id->name == "scan")
+            {
+                int d = dest();
+                emit(Op::Scan, d);
+                return d;
+            }
+            auto f = function_index.find(id->name);
+            if (f == function_index.end())
+                throw std::runtime_error("Undefined function: " + id->name);
+            int saved = temp_top;
+            int base = temp_top;
+            for (size_t i = 0; i < c->args.size(); ++i)
+                temp();
+            for (size_t i = 0; i < c->args.size(); ++i)
+                gen_into(c->args[i].get(), 1 << 30 | (base + static_cast<int>(i)));
+            temp_top = saved;
+            int d = dest();
+            emit(Op::Call, d, f->second, 1 << 30 | base, static_cast<int>(c->args.size()));
+            return d;
+        }
+        throw std::runtime_error("Unsupported expression in --run");
+    }
+};
+
+// ---------------- Runtime I/O ----------------
+// Same behaviour as the native runtime routines: buffered stdout (flushed when
+// full, per line on a terminal, before reading and at exit) and token-based scan.
+
+class VmIo
+{
+public:
+    explicit VmIo(const RuntimeOptions &opts) : buffered(opts.buffered_output), tty(isatty(1)) {}
+    ~VmIo() { flush(); }
+
+    int64_t print(const char *s, size_t n)
+    {
+        if (!buffered || n > sizeof(out))
+        {
+            flush();
+            write_all(s, n);
+            return static_cast<int64_t>(n);
+        }
+        if (out_len + n > sizeof(out))
+            flush();
+        memcpy(out + out_len, s, n);
+        out_len += n;
+        if (tty && memchr(s, '\n', n))
+            flush();
+        return static_cast<int64_t>(n);
+    }
+
+    int64_t print_int(int64_t v)
+    {
+        static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                    "8081828384858687888990919293949596979899";
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        uint64_t u = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+        while (u >= 100)
+        {
+            p -= 2;
+            memcpy(p, pairs + (u % 100) * 2, 2);
+            u /= 100;
+        }
+        if (u >= 10)
+        {
+            p -= 2;
+            memcpy(p, pairs + u * 2, 2);
+        }
+        else
+            *--p = static_cast<char>('0' + u);
+        if (v < 0)
+            *--p = '-';
+        return print(p, static_cast<size_t>(buf + sizeof(buf) - p));
+    }
+
+    int64_t scan()
+    {
+        int c;
+        while ((c = next()) >= 0 && c <= ' ')
+            ;
+        if (c < 0)
+            return 0;
+        bool neg = c == '-';
+        if (neg)
+            c = next();
+        uint64_t v = 0;
+        while (c >= '0' && c <= '9')
+        {
+            v = v * 10 + static_cast<uint64_t>(c - '0');
+            c = next();
+        }
+        while (c > ' ') // drop the rest of the token
+            c = next();
+        return static_cast<int64_t>(neg ? 0 - v : v);
+    }
+
+    void flush()
+    {
+        write_all(out, out_len);
+        out_len = 0;
+    }
+
+private:
+    bool buffered, tty;
+    char out[65536];
+    size_t out_len = 0;
+    char in[65536];
+    size_t in_pos = 0, in_len = 0;
+
+    // next byte of stdin, or -1 at end of input; refills flush pending output first
+    int next()
+    {
+        if (in_pos == in_len)
+        {
+            flush();
+            ssize_t n = read(0, in, sizeof(in));
+            in_pos = 0;
+            in_len = n > 0 ? static_cast<size_t>(n) : 0;
+            if (in_len == 0)
+                return -1;
+        }
+        return static_cast<unsigned char>(in[in_pos++]);
+    }
+
+    static void write_all(const char *s, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = write(1, s, n);
+            if (w <= 0)
+                return;
+            s += w;
+            n -= static_cast<size_t>(w);
+        }
+    }
+};
+
+// ---------------- Interpreter ----------------
+
+static int64_t wrap(uint64_t v) { return static_cast<int64_t>(v); }
+
+static const size_t VM_STACK_SLOTS = 1 << 22; // 32 MiB of frames
+static const size_t VM_MAX_DEPTH = 1 << 20;
+
+struct CallFrame
+{
+    const Insn *ret;
+    int64_t *regs;
+    VmFunction *fn;
+    int32_t dest;
+};
+
+// print/scan from native code (tier.h): forwarded to the interpreter's buffers
+static VmIo *host_io_target = nullptr;
+static int64_t host_print_str(const char *s, int64_t n) { return host_io_target->print(s, static_cast<size_t>(n)); }
+static int64_t host_print_int(int64_t v) { return host_io_target->print_int(v); }
+static int64_t host_scan_int() { return host_io_target->scan(); }
+
+// Run function `entry`; `tier` is null unless tiered execution is on
+static int64_t execute(VmProgram &prog, int entry, VmIo &io, TierCompiler *tier, uint32_t threshold)
+{
+    static const void *const handlers[] = {
+        &&op_mov, &&op_get_global, &&op_set_global, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_and, &&op_or, &&op_xor, &&op_shl,
+        &&op_shr, &&op_eq, &&op_ne, &&op_lt, &&op_le, &&op_gt, &&op_ge, &&op_land, &&op_lor, &&op_neg,
+        &&op_not, &&op_jmp, &&op_loop, &&op_jz, &&op_jeq, &&op_jne, &&op_jlt, &&op_jle, &&op_jgt, &&op_jge, &&op_call,
+        &&op_ret, &&op_print_str, &&op_print_int, &&op_scan};
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == static_cast<size_t>(Op::Count), "handler table");
+    for (auto &in : prog.code)
+        in.handler = handlers[static_cast<int>(in.op)];
+
+    // left uninitialized so untouched pages are never faulted in; enter() zeroes each frame
+    std::unique_ptr<int64_t[]> stack(new int64_t[VM_STACK_SLOTS]);
+    std::vector<CallFrame> frames;
+    const Insn *code = prog.code.data();
+
+    // set up a frame for `f` at `regs`: params already copied, rest zeroed
+    auto enter = [&](const VmFunction &f, int64_t *regs)
+    {
+        if (regs + f.frame_size > stack.get() + VM_STACK_SLOTS || frames.size() > VM_MAX_DEPTH)
+            throw std::runtime_error("stack overflow");
+        std::fill(regs + f.params, regs + f.locals, 0);
+        std::copy(f.constants.begin(), f.constants.end(), regs + f.locals);
+    };
+
+    VmFunction *fn = &prog.functions[entry];
+    int64_t *R = stack.get();
+    int64_t *G = prog.globals.data();
+    enter(*fn, R);
+    const Insn *pc = code + fn->entry;
+
+#define DISPATCH() goto *pc->handler
+#define NEXT()                                                                                                         \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        ++pc;                                                                                                          \
+        DISPATCH();                                                                                                    \
+    } while (0)
+#define BINARY(expr)                                                                                                   \
+    {                                                                                                                  \
+        int64_t x = R[pc->b], y = R[pc->c];                                                                            \
+        R[pc->a] = (expr);                                                                                             \
+        NEXT();                                                                                                        \
+    }
+#define BRANCH(cond)                                                                                                   \
+    {                                                                                                                  \
+        int64_t x = R[pc->b], y = R[pc->c];                                                                            \
+        pc = (cond) ? code + pc->a : pc + 1;                                                                           \
+        DISPATCH();                                                                                                    \
+    }
+
+    DISPATCH();
+
+op_mov:
+    R[pc->a] = R[pc->b];
+    NEXT();
+op_get_global:
+    R[pc->a] = G[pc->b];
+    NEXT();
+op_set_global:
+    G[pc->a] = R[pc->b];
+    NEXT();
+op_add:
+    BINARY(wrap(static_cast<uint64_t>(x) + static_cast<uint64_t>(y)))
+op_sub:
+    BINARY(wrap(static_cast<uint64_t>(x) - static_cast<uint64_t>(y)))
+op_mul:
+    BINARY(wrap(static_cast<uint64_t>(x) * static_cast<uint64_t>(y)))
+op_div:
+op_mod:
+{
+    // idiv traps on both of these
+    int64_t x = R[pc->b], y = R[pc->c];
+    if (y == 0 || (x == INT64_MIN && y == -1))
+        throw std::runtime_error("division by zero or overflow");
+    R[pc->a] = pc->op == Op::Div ? x / y : x % y;
+    NEXT();
+}
+op_and:
+    BINARY(x & y)
+op_or:
+    BINARY(x | y)
+op_xor:
+    BINARY(x ^ y)
+op_shl:
+    BINARY(wrap(static_cast<uint64_t>(x) << (y & 63)))
+op_shr:
+    BINARY(wrap(static_cast<uint64_t>(x) >> (y & 63)))
+op_eq:
+    BINARY(x == y)
+op_ne:
+    BINARY(x != y)
+op_lt:
+    BINARY(x < y)
+op_le:
+    BINARY(x <= y)
+op_gt:
+    BINARY(x > y)
+op_ge:
+    BINARY(x >= y)
+op_land:
+    BINARY(x != 0 && y != 0)
+op_lor:
+    BINARY(x != 0 || y != 0)
+op_neg:
+    R[pc->a] = wrap(0 - static_cast<uint64_t>(R[pc->b]));
+    NEXT();
+op_not:
+    R[pc->a] = R[pc->b] == 0;
+    NEXT();
+op_jmp:
+    pc = code + pc->a;
+    DISPATCH();
+op_loop:
+    if (++fn->hotness == threshold)
+        tier->request(static_cast<int>(fn - prog.functions.data()));
+    pc = code + pc->a;
+    DISPATCH();
+op_jz:
+    pc = R[pc->b] == 0 ? code + pc->a : pc + 1;
+    DISPATCH();
+op_jeq:
+    BRANCH(x == y)
+op_jne:
+    BRANCH(x != y)
+op_jlt:
+    BRANCH(x < y)
+op_jle:
+    BRANCH(x <= y)
+op_jgt:
+    BRANCH(x > y)
+op_jge:
+    BRANCH(x >= y)
+op_call:
+{
+    VmFunction &callee = prog.functions[pc->b];
+    if (tier)
+    {
+        if (NativeEntry native = tier->entry(pc->b))
+        {
+            int64_t a[6] = {};
+            std::copy(R + pc->c, R + pc->c + std::min(pc->d, 6), a);
+            R[pc->a] = native(a[0], a[1], a[2], a[3], a[4], a[5]);
+            NEXT();
+        }
+        if (++callee.hotness == threshold)
+            tier->request(pc->b);
+    }
+    int64_t *args = R + pc->c;
+    int64_t *next = R + fn->frame_size;
+    int n = std::min(pc->d, callee.params);
+    std::copy(args, args + n, next);
+    std::fill(next + n, next + callee.params, 0);
+    frames.push_back({pc + 1, R, fn, pc->a});
+    enter(callee, next);
+    R = next;
+    fn = &callee;
+    pc = code + callee.entry;
+    DISPATCH();
+}
+op_ret:
+{
+    int64_t v = R[pc->b];
+    if (frames.empty())
+        return v;
+    CallFrame f = frames.back();
+    frames.pop_back();
+    R = f.regs;
+    R[f.dest] = v;
+    fn = f.fn;
+    pc = f.ret;
+    DISPATCH();
+}
+op_print_str:
+{
+    const std::string &s = prog.strings[pc->b];
+    R[pc->a] += io.print(s.data(), s.size());
+    NEXT();
+}
+op_print_int:
+    R[pc->a] += io.print_int(R[pc->b]);
+    NEXT();
+op_scan:
+    R[pc->a] = io.scan();
+    NEXT();
+
+#undef BRANCH
+#undef BINARY
+#undef NEXT
+#undef DISPATCH
+}
+
+void vm_run(const Program &program, const CodeGenOptions &opts, const TierOptions &tier)
+{
+    VmProgram prog;
+    VmCompiler(prog, tier.enabled).compile(program);
+    VmIo io(opts.runtime);
+    if (!tier.enabled)
+    {
+        if (prog.init_index >= 0)
+            execute(prog, prog.init_index, io, nullptr, 0);
+        execute(prog, prog.main_index, io, nullptr, 0);
+        return;
+    }
+
+    std::vector<const FunctionDecl *> functions;
+    for (auto &stmt : program)
+        if (auto f = dynamic_cast<const FunctionDecl *>(stmt.get()))
+            functions.push_back(f);
+    host_io_target = &io;
+    TierCompiler compiler(functions, {host_print_str, host_print_int, host_scan_int}, opts);
+    if (prog.init_index >= 0)
+        execute(prog, prog.init_index, io, &compiler, tier.threshold);
+    execute(prog, prog.main_index, io, &compiler, tier.threshold);
+    if (tier.stats)
+        compiler.dump_stats(std::cerr);
+}
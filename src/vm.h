@@ -0,0 +1,31 @@
+#pragma once
+#include "ast.h"
+#include "codegen.h"
+#include "tier.h"
+
+// Bytecode interpreter for --run.
+//
+// Each function is lowered to register bytecode: every variable, constant and
+// temporary lives in a numbered slot of the function's frame, and instructions
+// name their operands directly (a = b op c), so there is no operand stack.
+// The interpreter is direct-threaded: each instruction carries the address of
+// its handler and dispatch is a computed goto. Globals (globals.h) live in one
+// array next to the frames, and zinc$init runs before main.
+//
+// Semantics follow the native backend (64-bit wrapping arithmetic, both sides
+// of && and || evaluated, logical >>, print returns the bytes written), which
+// makes --run a reference to differential-test codegen against. Errors the
+// native code would trap on (division by zero) throw std::runtime_error.
+//
+// With tiering enabled, calls and loop back-edges are counted per function
+// and hot functions move to native code in the background (see tier.h).
+
+struct TierOptions {
+    bool enabled = false;    // --tiered
+    uint32_t threshold = 1000; // calls + back-edges before a function is compiled
+    bool stats = false;      // report each function's tier on stderr at exit
+};
+
+// Compile `program` and run main. Output buffering follows `opts.runtime`;
+// the rest of `opts` applies to code compiled by the tiered backend.
+void vm_run(const Program &program, const CodeGenOptions &opts, const TierOptions &tier = {});